@@ -9,6 +9,8 @@ import pandas as pd
 import sqlite3
 import uproot
 
+from e15190.utilities import root_catalog
+
 class RunCache:
     def __init__(self, src_path_fmt, cache_path_fmt, max_workers=8):
         """
@@ -57,13 +59,16 @@ class RunCache:
             names.
         tree_name : str, default None
             The name of the tree to read. If None, the tree name is inferred
-            from the ROOT file. Infer is guaranteed only if there exists exactly
-            one TTree in the ROOT file.
+            from the index of ``catalog.exe``, or else from the ROOT file. Infer
+            is guaranteed only if there exists exactly one TTree in the ROOT
+            file.
         """
         path = Path(os.path.expandvars(self.SRC_PATH_FMT.format(run=run)))
         if not isinstance(branches, dict):
             branches = {branch: branch for branch in branches}
 
+        if tree_name is None:
+            tree_name = root_catalog.find_tree_name(path)
         if tree_name is None:
             with uproot.open(str(path)) as file:
                 tree_name = self.infer_tree_name(file)
@@ -0,0 +1,212 @@
+"""Regeneration of the random branches that ``calibrate.exe --regen-dither``
+does not write.
+
+``NWB_pos_y`` and ``NWB_pos_z`` are uniform positions within the bar, and
+``NWB_fastf_L`` and ``NWB_fastf_R`` are the raw ``NWB_fast_L`` and
+``NWB_fast_R`` dithered by up to half a channel. All of them are pure
+functions of (seed, run, entry, hit), computed with the counter-based random
+number generator Philox4x32-10 of ``scripts/include/CounterRNG.h``. This
+module reproduces them bit for bit with numpy; within ROOT, the same is done
+by ``scripts/include/NWDither.h``, see :py:func:`define_columns`.
+
+The seed and run are stored in the ``metadata`` folder of every output file,
+and ``entry`` (the input entry number) is written as a branch in this mode.
+The hit index is the position of the hit within its event, i.e. the
+``subentry`` of exploded DataFrames.
+"""
+from __future__ import annotations
+
+import numpy as np
+
+from e15190 import PROJECT_DIR
+
+# CounterRNG::Purpose
+POSITION_Y = 0
+POSITION_Z = 1
+TOTAL_L = 2
+TOTAL_R = 3
+FAST_L = 4
+FAST_R = 5
+
+BAR_Y_LENGTH = 3 * 2.54 # cm
+BAR_Z_LENGTH = 2.5 * 2.54 # cm
+
+_MASK32 = np.uint64(0xFFFFFFFF)
+
+def philox4x32(ctr, key):
+    """Philox4x32-10 on arrays of counters.
+
+    Parameters
+    ----------
+    ctr : tuple of 4 array-like of uint32
+        The four words of the counters.
+    key : tuple of 2 int
+        The two words of the key.
+
+    Returns
+    -------
+    tuple of 4 np.ndarray of uint64
+        The four words of the results, each below 2**32.
+    """
+    c0, c1, c2, c3 = (np.asarray(c, dtype=np.uint64) for c in ctr)
+    k0, k1 = (int(k) & 0xFFFFFFFF for k in key)
+    for _ in range(10):
+        p0 = np.uint64(0xD2511F53) * c0
+        p1 = np.uint64(0xCD9E8D57) * c2
+        c0, c1, c2, c3 = (
+            (p1 >> np.uint64(32)) ^ c1 ^ np.uint64(k0),
+            p1 & _MASK32,
+            (p0 >> np.uint64(32)) ^ c3 ^ np.uint64(k1),
+            p0 & _MASK32,
+        )
+        k0 = (k0 + 0x9E3779B9) & 0xFFFFFFFF
+        k1 = (k1 + 0xBB67AE85) & 0xFFFFFFFF
+    return c0, c1, c2, c3
+
+def uniform(seed: int, run: int, entry, hit, purpose: int) -> np.ndarray:
+    """Same as ``CounterRNG(seed, run).uniform(entry, hit, purpose)``.
+
+    Parameters
+    ----------
+    seed : int
+        The seed in the metadata of the output file.
+    run : int
+        The run number.
+    entry : array-like of int
+        Input entry numbers.
+    hit : array-like of int
+        Hit indices within the entries; broadcast against ``entry``.
+    purpose : int
+        One of the purposes of this module, e.g. :py:data:`FAST_L`.
+
+    Returns
+    -------
+    np.ndarray of float64
+        Uniform numbers in [0, 1).
+    """
+    entry, hit = np.broadcast_arrays(np.asarray(entry, dtype=np.int64), np.asarray(hit, dtype=np.int64))
+    entry = entry.astype(np.uint64)
+    x0, x1, _, _ = philox4x32(
+        (
+            entry & _MASK32,
+            entry >> np.uint64(32),
+            hit.astype(np.uint64) & _MASK32,
+            np.full(entry.shape, ((run << 8) | purpose) & 0xFFFFFFFF, dtype=np.uint64),
+        ),
+        (seed & 0xFFFFFFFF, seed >> 32),
+    )
+    bits = ((x0 << np.uint64(32)) | x1) >> np.uint64(11)
+    return bits.astype(np.float64) * 2.0**-53
+
+def pos_y(seed: int, run: int, entry, hit) -> np.ndarray:
+    """Regenerated ``NWB_pos_y`` in cm, as float32."""
+    low, high = -0.5 * BAR_Y_LENGTH, 0.5 * BAR_Y_LENGTH
+    return (low + (high - low) * uniform(seed, run, entry, hit, POSITION_Y)).astype(np.float32)
+
+def pos_z(seed: int, run: int, entry, hit) -> np.ndarray:
+    """Regenerated ``NWB_pos_z`` in cm, as float32."""
+    low, high = -0.5 * BAR_Z_LENGTH, 0.5 * BAR_Z_LENGTH
+    return (low + (high - low) * uniform(seed, run, entry, hit, POSITION_Z)).astype(np.float32)
+
+def dither(raw, seed: int, run: int, entry, hit, purpose: int) -> np.ndarray:
+    """Raw ADC values dithered as by ``NWHitBlock::randomize()``, as float32.
+
+    Negative values (e.g. -9999) and overflows (4096 and above) are kept,
+    zeros are spread over [0, 0.5), and everything else over [-0.5, 0.5)
+    around the raw value.
+    """
+    raw = np.asarray(raw).astype(np.float64)
+    u = uniform(seed, run, entry, hit, purpose)
+    result = np.where(raw == 0, raw + 0.5 * u, raw + (-0.5 + u))
+    result = np.where((raw < 0) | (raw >= 4096), raw, result)
+    return result.astype(np.float32)
+
+def add_columns(df, seed: int, run: int, entry='entry', hit='subentry'):
+    """Add the regenerated columns to an exploded DataFrame of NWB hits.
+
+    Parameters
+    ----------
+    df : pandas.DataFrame
+        One row per hit, with the input entry numbers and hit indices as
+        columns or index levels, and the raw ``NWB_fast_L`` and
+        ``NWB_fast_R`` if the dithered ones are wanted.
+    seed : int
+        The seed in the metadata of the output file.
+    run : int
+        The run number.
+    entry : str, default 'entry'
+        Column or index level of the input entry numbers.
+    hit : str, default 'subentry'
+        Column or index level of the hit indices.
+
+    Returns
+    -------
+    pandas.DataFrame
+        A copy of ``df`` with ``NWB_pos_y``, ``NWB_pos_z``, and, when their
+        raw columns are present, ``NWB_fastf_L`` and ``NWB_fastf_R``.
+    """
+    def get(name):
+        return df[name].to_numpy() if name in df.columns else df.index.get_level_values(name).to_numpy()
+
+    df = df.copy()
+    entries, hits = get(entry), get(hit)
+    df['NWB_pos_y'] = pos_y(seed, run, entries, hits)
+    df['NWB_pos_z'] = pos_z(seed, run, entries, hits)
+    for side, purpose in [('L', FAST_L), ('R', FAST_R)]:
+        if f'NWB_fast_{side}' in df.columns:
+            df[f'NWB_fastf_{side}'] = dither(df[f'NWB_fast_{side}'], seed, run, entries, hits, purpose)
+    return df
+
+_ROOT_DECLARED = False
+
+def define_columns(rdf, seed: int, run: int):
+    """Define the regenerated branches on an RDataFrame.
+
+    Uses ``scripts/include/NWDither.h``, so the values are computed in C++
+    during the event loop. Requires the columns ``entry``, ``NWB_multi``,
+    ``NWB_fast_L`` and ``NWB_fast_R``.
+
+    Parameters
+    ----------
+    rdf : ROOT.RDataFrame
+        The output tree of ``calibrate.exe --regen-dither``.
+    seed : int
+        The seed in the metadata of the output file.
+    run : int
+        The run number.
+
+    Returns
+    -------
+    ROOT.RDF.RNode
+        The RDataFrame with ``NWB_pos_y``, ``NWB_pos_z``, ``NWB_fastf_L`` and
+        ``NWB_fastf_R``.
+    """
+    import ROOT
+
+    global _ROOT_DECLARED
+    if not _ROOT_DECLARED:
+        include_dir = PROJECT_DIR / 'scripts/include'
+        ROOT.gInterpreter.AddIncludePath(str(include_dir))
+        ROOT.gInterpreter.Declare('#include "NWDither.h"')
+        _ROOT_DECLARED = True
+    return (rdf
+        .Define('NWB_pos_y', f'nw_dither::pos_y({seed}ULL, {run}, entry, NWB_multi)')
+        .Define('NWB_pos_z', f'nw_dither::pos_z({seed}ULL, {run}, entry, NWB_multi)')
+        .Define('NWB_fastf_L', f'nw_dither::fastf_L({seed}ULL, {run}, entry, NWB_fast_L)')
+        .Define('NWB_fastf_R', f'nw_dither::fastf_R({seed}ULL, {run}, entry, NWB_fast_R)')
+    )
+
+def read_metadata(path) -> tuple[int, int]:
+    """Read the seed and run from the metadata of an output file.
+
+    Returns
+    -------
+    seed : int
+    run : int
+    """
+    import ROOT
+
+    file = ROOT.TFile.Open(str(path))
+    values = {obj.GetTitle(): obj.GetName() for obj in file.Get('metadata').GetListOfFolders()}
+    file.Close()
+    return int(values['seed']), int(values['run'])
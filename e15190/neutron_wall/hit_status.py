@@ -0,0 +1,31 @@
+"""Bits of ``NWB_status``, the per-hit status written by ``calibrate.exe``.
+
+A hit with status zero passed every check. The bits are defined in
+``NWHitBlock::Status`` of ``scripts/include/NWHitBlock.h``, and replace tests
+against the ``-9999`` and ``9999`` sentinels, e.g. the positive ADC cut is
+``(NWB_status & (INVALID_ADC | ZERO_ADC)) == 0``.
+"""
+import enum
+
+class HitStatus(enum.IntFlag):
+    INVALID_ADC = 1 << 0 # a raw ADC is negative, e.g. -9999
+    ZERO_ADC = 1 << 1 # a raw ADC is zero
+    SATURATED_TOTAL = 1 << 2 # total_L or total_R at 4096 or above
+    PSD_OVERFLOW = 1 << 3 # fast ADC above 4095; NWB_psd is 9999
+    PSD_INVALID = 1 << 4 # a corrected ADC is negative; NWB_psd is -9999
+    OUTSIDE_BAR = 1 << 5 # NWB_pos_x outside the bar
+    INVALID_TIME = 1 << 6 # time_L or time_R below -9000
+    INVALID_BAR = 1 << 7 # NWB_bar outside 1-24; every calibrated value is -9999
+
+def none_of(*flags: HitStatus, column='NWB_status') -> str:
+    """RDataFrame expression that is true for hits with none of ``flags``.
+
+    Examples
+    --------
+    >>> none_of(HitStatus.INVALID_ADC, HitStatus.ZERO_ADC)
+    '(NWB_status & 3) == 0'
+    """
+    mask = 0
+    for flag in flags:
+        mask |= int(flag)
+    return f'({column} & {mask}) == 0'
@@ -15,6 +15,7 @@ from e15190.microball import impact_parameter
 from e15190.neutron_wall import (
     efficiency as nw_eff,
     geometry as nw_geom,
+    hit_status,
     shadow_bar as nw_shade,
 )
 from e15190.utilities import (
@@ -118,11 +119,67 @@ class Spectrum:
         
         if tree_name is None:
             tree_name = rt.infer_tree_name(self.root_file_paths)
-        result = ROOT.RDataFrame(tree_name, list(map(str, self.root_file_paths)))
+        raw_trees, aliases = self._get_raw_friends(tree_name)
+        if raw_trees:
+            # files written by ``calibrate.exe --friend``; kept alive as long as the RDataFrame
+            self._chain = ROOT.TChain(tree_name)
+            self._raw_chain = ROOT.TChain()
+            for path, raw_tree in zip(self.root_file_paths, raw_trees):
+                self._chain.Add(str(path))
+                self._raw_chain.Add(raw_tree)
+            self._chain.AddFriend(self._raw_chain, 'raw')
+            result = ROOT.RDataFrame(self._chain)
+            for name, expression in aliases.items():
+                result = result.Alias(name, expression)
+        else:
+            result = ROOT.RDataFrame(tree_name, list(map(str, self.root_file_paths)))
         if not inplace:
             return result
         self.rdf = result
     
+    def _get_raw_friends(self, tree_name: str) -> tuple[list[str], dict[str, str]]:
+        """Find the input trees of output files written in friend mode.
+
+        ``calibrate.exe --friend`` writes only the calibrated branches. The
+        input tree is recorded in the user info of the output tree as
+        ``"<path>:<tree name>"``, and every other branch is defined as an
+        alias into the friend ``raw``.
+
+        Returns
+        -------
+        raw_trees : list[str]
+            Input trees as ``"<path>/<tree name>"``, one per output file, or an
+            empty list if the files were not written in friend mode.
+        aliases : dict[str, str]
+            Alias names and the branches of ``raw`` they refer to.
+
+        Raises
+        ------
+        ValueError
+            If only some of the files were written in friend mode, or if an
+            output file does not cover all entries of its input tree, in
+            which case the entries cannot be aligned.
+        """
+        raw_trees = []
+        aliases = dict()
+        for path in self.root_file_paths:
+            file = ROOT.TFile.Open(str(path))
+            tree = file.Get(tree_name)
+            raw_info = tree.GetUserInfo().FindObject('raw')
+            if raw_info:
+                raw_path, raw_tree_name = str(raw_info.GetTitle()).rsplit(':', 1)
+                n_raw_entries = rt.get_n_entries(raw_path, raw_tree_name)
+                if tree.GetEntries() != n_raw_entries:
+                    file.Close()
+                    raise ValueError(f'{path} has {tree.GetEntries()} entries, but its input tree has {n_raw_entries}.')
+                raw_trees.append(f'{raw_path}/{raw_tree_name}')
+                for alias in tree.GetListOfAliases() or []:
+                    aliases[str(alias.GetName())] = str(alias.GetTitle())
+            file.Close()
+        if 0 < len(raw_trees) < len(self.root_file_paths):
+            raise ValueError('Cannot mix output files written with and without friend mode.')
+        return raw_trees, aliases
+
     def filter_microball_multiplicity(
         self,
         bhat_range: Optional[tuple[float, float]] = None,
@@ -322,7 +379,8 @@ class Spectrum:
             automatically if shadow bars are present in those runs. See :py:attr:`self.shadow_bar_present`.
         positive_adc_cut : bool, default True
             Whether to apply the positive ADC cut. If ``True``, all the fast and
-            total ADCs must be positive.
+            total ADCs must be positive. Files with the per-hit status
+            ``NWB_status`` are cut on its bits instead of the ADC values.
         extra_cuts : list[str], optional
             Extra cuts to be applied. Each cut should be a string that can be
             parsed by PyROOT. Any columns that are defined in the RDF can be
@@ -346,7 +404,9 @@ class Spectrum:
                 conditions.append(f'!(NWB_bar == {bar} && {Bar.left_shadow_x[0]} < NWB_pos_x && NWB_pos_x < {Bar.left_shadow_x[-1]})')
                 conditions.append(f'!(NWB_bar == {bar} && {Bar.right_shadow_x[0]} < NWB_pos_x && NWB_pos_x < {Bar.right_shadow_x[-1]})')
         
-        if positive_adc_cut:
+        if positive_adc_cut and 'NWB_status' in map(str, rdf.GetColumnNames()):
+            conditions.append(hit_status.none_of(hit_status.HitStatus.INVALID_ADC, hit_status.HitStatus.ZERO_ADC))
+        elif positive_adc_cut:
             conditions.append('NWB_fast_L > 0')
             conditions.append('NWB_fast_R > 0')
             conditions.append('NWB_total_L > 0')
@@ -13,6 +13,8 @@ from typing import Sequence
 import numpy as np
 import pandas as pd
 
+from e15190.utilities import root_catalog
+
 try:
     import ROOT
 except ImportError:
@@ -208,6 +210,10 @@ def get_all_branches(path, tree):
         return get_branches(tr)
 
 def get_n_entries(path, tree):
+    """Read from the index of ``catalog.exe`` when it is up to date for ``path``."""
+    n_entries = root_catalog.find_n_entries(path, tree)
+    if n_entries is not None:
+        return n_entries
     with TFile(path) as file:
         tr = file.Get(tree)
         return tr.GetEntries()
@@ -232,6 +238,9 @@ def infer_tree_name(path: str | pathlib.Path | Sequence[str | pathlib.Path]) ->
         - Paths contain different tree names.
         - Cannot infer tree name from the given path(s), e.g. no ROOT file
         found, multiple trees, etc.
+
+    Files in the up-to-date part of the index of ``catalog.exe`` are not
+    opened.
     """
     if not isinstance(path, (str, pathlib.Path)):
         names = list(set([infer_tree_name(p) for p in path]))
@@ -241,6 +250,10 @@ def infer_tree_name(path: str | pathlib.Path | Sequence[str | pathlib.Path]) ->
             raise ValueError(f'No tree name found in "{path}".')
         raise ValueError(f'Paths contain different tree names: {names}')
 
+    tree_name = root_catalog.find_tree_name(path)
+    if tree_name is not None:
+        return tree_name
+
     tree_names = []
     with TFile(path) as file:
         names = set([k.GetName() for k in file.GetListOfKeys()])
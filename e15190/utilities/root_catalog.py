@@ -0,0 +1,124 @@
+"""Reader of the index of ROOT files written by ``scripts/catalog.exe``.
+
+The index records, for every ``CalibratedData_XXXX.root`` and
+``run-XXXX.root`` file, the name of its tree, its number of entries, its
+cluster boundaries, the compressed and uncompressed bytes of every branch,
+and a content hash. Reading it replaces opening the files one by one, e.g.
+with :py:func:`e15190.utilities.root6.get_n_entries`:
+
+>>> from e15190.utilities.root_catalog import RootCatalog
+>>> catalog = RootCatalog()
+>>> catalog.get_n_entries('/data/CalibratedData_4083.root')
+
+:py:func:`find_tree_name` and :py:func:`find_n_entries` look files up in the
+default index and return None when they are not in it, so that callers such
+as :py:func:`e15190.utilities.root6.get_n_entries` can fall back to opening
+the file.
+
+The index is only as fresh as the last run of ``catalog.exe``; a file whose
+size or modification time differs from the index is reported as missing
+rather than with stale values.
+"""
+from __future__ import annotations
+import json
+import os
+import pathlib
+
+from e15190 import PROJECT_DIR
+
+class RootCatalog:
+    DEFAULT_PATH = PROJECT_DIR / 'database/root_files_catalog.json'
+    """``pathlib.Path`` : Default output of ``scripts/catalog.exe``."""
+
+    def __init__(self, path: str | pathlib.Path = None):
+        """
+        Parameters
+        ----------
+        path : str or pathlib.Path, default None
+            Path of the index. If None, :py:attr:`DEFAULT_PATH` is used.
+        """
+        self.path = pathlib.Path(path or self.DEFAULT_PATH)
+        with open(self.path, 'r') as file:
+            content = json.load(file)
+        self.files = {self._key(p): entry for p, entry in content['files'].items()}
+
+    @staticmethod
+    def _key(path) -> str:
+        """Absolute and normalized, like the keys written by ``catalog.exe``."""
+        return os.path.abspath(str(path))
+
+    def __contains__(self, path) -> bool:
+        key = self._key(path)
+        if key not in self.files or not os.path.isfile(key):
+            return False
+        stat = os.stat(key)
+        entry = self.files[key]
+        return stat.st_size == entry['size'] and stat.st_mtime_ns == entry['mtime']
+
+    def get(self, path) -> dict:
+        """Index entry of a ROOT file.
+
+        Raises
+        ------
+        KeyError
+            If the file is not in the index, or has changed since.
+        """
+        if path not in self:
+            raise KeyError(f'"{path}" is not in the up-to-date part of {self.path}')
+        return self.files[self._key(path)]
+
+    def get_tree_name(self, path) -> str:
+        return self.get(path)['tree']
+
+    def get_n_entries(self, path) -> int:
+        return self.get(path)['entries']
+
+    def get_clusters(self, path) -> list[tuple[int, int]]:
+        """Half-open entry ranges ``[start, stop)`` of the clusters of the tree."""
+        bounds = self.get(path)['clusters']
+        return list(zip(bounds[:-1], bounds[1:]))
+
+    def get_branch_bytes(self, path, compressed=True) -> dict[str, int]:
+        """Bytes of every terminal branch, compressed or uncompressed."""
+        i = 0 if compressed else 1
+        return {name: sizes[i] for name, sizes in self.get(path)['branches'].items()}
+
+_default_catalog = None # ((path, mtime_ns) of the index, RootCatalog)
+
+def get_default_catalog() -> RootCatalog | None:
+    """The index at :py:attr:`RootCatalog.DEFAULT_PATH`, or None if there is none.
+
+    Loaded once, and again whenever ``catalog.exe`` rewrites it.
+    """
+    global _default_catalog
+    path = RootCatalog.DEFAULT_PATH
+    if not path.is_file():
+        return None
+    key = (path, path.stat().st_mtime_ns)
+    if _default_catalog is None or _default_catalog[0] != key:
+        _default_catalog = (key, RootCatalog(path))
+    return _default_catalog[1]
+
+def find_tree_name(path) -> str | None:
+    """Tree name of a ROOT file from the default index.
+
+    Returns None if there is no index, or if the file is not in its
+    up-to-date part.
+    """
+    catalog = get_default_catalog()
+    if catalog is None or path not in catalog:
+        return None
+    return catalog.get_tree_name(path)
+
+def find_n_entries(path, tree: str = None) -> int | None:
+    """Number of entries of a ROOT file from the default index.
+
+    Returns None if there is no index, if the file is not in its up-to-date
+    part, or if ``tree`` is given and is not the tree of the index.
+    """
+    catalog = get_default_catalog()
+    if catalog is None or path not in catalog:
+        return None
+    if tree is not None and catalog.get_tree_name(path) != tree:
+        return None
+    return catalog.get_n_entries(path)
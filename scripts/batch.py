@@ -6,6 +6,8 @@ if not (sys.version_info[0] >= 3 and sys.version_info[1] >= 7):
 import argparse
 import concurrent.futures
 import inspect
+import json
+import re
 import subprocess
 import time
 
@@ -28,6 +30,21 @@ def single_job(run, cmd):
         print(f'Error in run-{run:04d}: {result.stderr}', flush=True)
     return f'run-{run:04d}: ' + result.stdout.split('\n')[-2] # last line
 
+def get_n_entries_by_run(catalog_path='../database/root_files_catalog.json'):
+    """Largest number of entries among the indexed files of every run, as
+    written by catalog.exe; read as plain JSON, so that no e15190 environment
+    is needed.
+    """
+    with open(catalog_path, 'r') as file:
+        files = json.load(file)['files']
+    n_entries = dict()
+    for path, entry in files.items():
+        match = re.search(r'(?:CalibratedData_|run-)(\d{4})\.root$', path)
+        if match:
+            run = int(match.group(1))
+            n_entries[run] = max(n_entries.get(run, 0), entry['entries'])
+    return n_entries
+
 def main():
     args = get_arguments()
     n_runs = len(args.runs)
@@ -92,6 +109,16 @@ def get_arguments():
             active.
         '''),
     )
+    parser.add_argument(
+        '--largest-first',
+        action='store_true',
+        help=inspect.cleandoc(f'''
+            If set, runs with the most entries are submitted first, so that the
+            longest jobs do not start last. The numbers of entries are read
+            from the index written by catalog.exe, without opening any ROOT
+            file; runs missing from the index are submitted last.
+        '''),
+    )
     args = parser.parse_args()
 
     # process the runs
@@ -108,6 +135,12 @@ def get_arguments():
         with open('../database/runlog/good_runs.dat', 'r') as file:
             good_runs = [int(line) for line in file.readlines() if len(line) > 0]
         runs = [run for run in runs if run in good_runs]
+    if args.largest_first:
+        try:
+            n_entries = get_n_entries_by_run()
+            runs.sort(key=lambda run: -n_entries.get(run, -1))
+        except FileNotFoundError:
+            print('WARNING: no index of ROOT files found; run catalog.exe first. Keeping the given order.')
     args.runs = runs
 
     # warn if cores too many
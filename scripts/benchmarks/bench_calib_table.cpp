@@ -0,0 +1,270 @@
+/**
+  * Microbenchmark of the per-hit calibration path: parameters looked up from
+  * the readers by string key (as calibrate.cpp used to do), versus the
+  * compiled per-bar NWCalibTable; and the eight PSD curves evaluated with the
+  * Akima interpolators, versus their UniformGridTable bakes; and the full
+  * per-hit chain, versus the NWHitBlock kernels run over blocks of hits. Hits are
+  * synthetic; only the parameters come from the database, so $PROJECT_DIR
+  * must be set.
+  *
+  * Usage: ./benchmarks/bench_calib_table.exe [run] [n_hits]
+*/
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "TError.h"
+#include "TMath.h"
+#include "TRandom3.h"
+
+#include "CounterRNG.h"
+#include "NWCalibration.h"
+#include "NWHitBlock.h"
+#include "ParamReader.h"
+
+struct Hit { // synthetic hit i is hit 0 of entry i
+    int bar;
+    double time_L, time_R, fa_time;
+    double pos_x; // within the PSD centroid curves of the bar
+    short total_L, total_R, fast_L, fast_R;
+};
+
+namespace reader_lookup {
+    /* the per-hit functions as they were before NWCalibTable, kept only as a reference */
+    double get_position(NWPositionCalibParamReader& nw_pcalib, int bar, double time_L, double time_R) {
+        double p0 = nw_pcalib.get(bar, "p0");
+        double p1 = nw_pcalib.get(bar, "p1");
+        return p0 + p1 * (time_L - time_R);
+    }
+
+    double get_time_of_flight(NWTimeOfFlightCalibParamReader& nw_tcalib, int bar, double time_L, double time_R, double fa_time) {
+        return 0.5 * (time_L + time_R) - fa_time - nw_tcalib.tof_offset[bar];
+    }
+
+    std::array<double, 4> get_corrected_adc(
+        NWADCPreprocessorParamReader& nw_acalib, const CounterRNG& rng, long entry,
+        int bar, short total_L, short total_R, short fast_L, short fast_R, const double pos_x
+    ) {
+        double totalf_L, totalf_R, fastf_L, fastf_R;
+        auto& ft_L = nw_acalib.fast_total_L[bar];
+        auto& ft_R = nw_acalib.fast_total_R[bar];
+        auto& lrt = nw_acalib.log_ratio_total[bar];
+
+        totalf_L = randomize_adc(rng, entry, 0, CounterRNG::kTotalL, total_L);
+        totalf_R = randomize_adc(rng, entry, 0, CounterRNG::kTotalR, total_R);
+        fastf_L = randomize_adc(rng, entry, 0, CounterRNG::kFastL, fast_L);
+        fastf_R = randomize_adc(rng, entry, 0, CounterRNG::kFastR, fast_R);
+
+        double ratio_R_L = exp((2 / lrt["attenuation_length"]) * pos_x + log(lrt["gain_ratio"]));
+
+        if (totalf_L >= 4096 && totalf_R < 4096) {
+            totalf_L = totalf_R / ratio_R_L;
+        }
+        else if (fastf_L > ft_L["nonlinear_fast_threshold"] && fastf_L < ft_L["stationary_point_x"]) {
+            totalf_L += ft_L["fit_params[0]"];
+            totalf_L += ft_L["fit_params[1]"] * fastf_L;
+            totalf_L += ft_L["fit_params[2]"] * fastf_L * fastf_L;
+        }
+        else if (fastf_L > ft_L["stationary_point_x"]) {
+            totalf_L += ft_L["stationary_point_y"] - total_L;
+        }
+
+        if (totalf_R >= 4096 && totalf_L < 4096) {
+            totalf_R = totalf_L * ratio_R_L;
+        }
+        else if (fastf_R > ft_R["nonlinear_fast_threshold"] && fastf_R < ft_R["stationary_point_x"]) {
+            totalf_R += ft_R["fit_params[0]"];
+            totalf_R += ft_R["fit_params[1]"] * fastf_R;
+            totalf_R += ft_R["fit_params[2]"] * fastf_R * fastf_R;
+        }
+        else if (fastf_R > ft_R["stationary_point_x"]) {
+            totalf_R += ft_R["stationary_point_y"] - total_R;
+        }
+
+        return {totalf_L, totalf_R, fastf_L, fastf_R};
+    }
+
+    double get_light_output(NWLightOutputCalibParamReader& nw_lcalib, int bar, double total_L, double total_R, const double pos_x) {
+        std::unordered_map<std::string, double> par = nw_lcalib.run_param.at(bar);
+        double light_GM = sqrt(total_L * total_R);
+        light_GM = (light_GM - (par.at("b") * pos_x + par.at("c") * pos_x * pos_x)) / par.at("a");
+        light_GM = 4.196 * par.at("e") * light_GM + par.at("d");
+        return std::max(0.0, light_GM);
+    }
+
+    std::array<double, 3> get_spherical_coordinates(NWPositionCalibParamReader& nw_pcalib, int bar, const std::array<double, 3>& position) {
+        std::array<double, 3> L = {nw_pcalib.get(bar, "L0"), nw_pcalib.get(bar, "L1"), nw_pcalib.get(bar, "L2")};
+        std::array<double, 3> X = {nw_pcalib.get(bar, "X0"), nw_pcalib.get(bar, "X1"), nw_pcalib.get(bar, "X2")};
+        std::array<double, 3> Y = {nw_pcalib.get(bar, "Y0"), nw_pcalib.get(bar, "Y1"), nw_pcalib.get(bar, "Y2")};
+        std::array<double, 3> Z = {nw_pcalib.get(bar, "Z0"), nw_pcalib.get(bar, "Z1"), nw_pcalib.get(bar, "Z2")};
+        double lab_x = position[0] * X[0] + position[1] * Y[0] + position[2] * Z[0] + L[0];
+        double lab_y = position[0] * X[1] + position[1] * Y[1] + position[2] * Z[1] + L[1];
+        double lab_z = position[0] * X[2] + position[1] * Y[2] + position[2] * Z[2] + L[2];
+        double rho = sqrt(lab_x * lab_x + lab_y * lab_y + lab_z * lab_z);
+        double theta = acos(lab_z / rho) * TMath::RadToDeg();
+        double phi = atan2(lab_y, lab_x) * TMath::RadToDeg();
+        return {rho, theta, phi};
+    }
+}
+
+double run_reader_lookup(NWCalibParamReaders& readers, const std::vector<Hit>& hits) {
+    CounterRNG rng(1, 0);
+    double checksum = 0.0;
+    for (std::size_t i = 0; i < hits.size(); ++i) {
+        auto& hit = hits[i];
+        double pos_x = reader_lookup::get_position(readers.pcalib, hit.bar, hit.time_L, hit.time_R);
+        auto sph = reader_lookup::get_spherical_coordinates(readers.pcalib, hit.bar, {pos_x, 0.0, 0.0});
+        double tof = reader_lookup::get_time_of_flight(readers.tcalib, hit.bar, hit.time_L, hit.time_R, hit.fa_time);
+        auto adc = reader_lookup::get_corrected_adc(
+            readers.acalib, rng, i, hit.bar, hit.total_L, hit.total_R, hit.fast_L, hit.fast_R, pos_x
+        );
+        double light = reader_lookup::get_light_output(readers.lcalib, hit.bar, adc[0], adc[1], pos_x);
+        checksum += sph[1] + tof + light;
+    }
+    return checksum;
+}
+
+double run_calib_table(const NWCalibTable& table, const std::vector<Hit>& hits) {
+    CounterRNG rng(1, 0);
+    double checksum = 0.0;
+    for (std::size_t i = 0; i < hits.size(); ++i) {
+        auto& hit = hits[i];
+        const auto& par = table[hit.bar];
+        double pos_x = get_position(par, hit.time_L, hit.time_R);
+        auto sph = get_spherical_coordinates(par, {pos_x, 0.0, 0.0});
+        double tof = get_time_of_flight(par, hit.time_L, hit.time_R, hit.fa_time);
+        auto adc = get_corrected_adc(par, rng, i, 0, hit.total_L, hit.total_R, hit.fast_L, hit.fast_R, pos_x);
+        double light = get_light_output(par, adc[0], adc[1], pos_x);
+        checksum += sph[1] + tof + light;
+    }
+    return checksum;
+}
+
+double run_psd_akima(NWPulseShapeDiscriminationParamReader& psd_reader, const std::vector<Hit>& hits) {
+    double checksum = 0.0;
+    for (auto& hit : hits) {
+        double pos_x = hit.pos_x;
+        checksum += psd_reader.gamma_fast_total_L[hit.bar]->Eval(hit.total_L);
+        checksum += psd_reader.neutron_fast_total_L[hit.bar]->Eval(hit.total_L);
+        checksum += psd_reader.gamma_fast_total_R[hit.bar]->Eval(hit.total_R);
+        checksum += psd_reader.neutron_fast_total_R[hit.bar]->Eval(hit.total_R);
+        checksum += psd_reader.gamma_vpsd_L[hit.bar]->Eval(pos_x);
+        checksum += psd_reader.neutron_vpsd_L[hit.bar]->Eval(pos_x);
+        checksum += psd_reader.gamma_vpsd_R[hit.bar]->Eval(pos_x);
+        checksum += psd_reader.neutron_vpsd_R[hit.bar]->Eval(pos_x);
+    }
+    return checksum;
+}
+
+double run_psd_table(const NWCalibTable& table, const std::vector<Hit>& hits) {
+    double checksum = 0.0;
+    for (auto& hit : hits) {
+        const auto& par = table[hit.bar];
+        double pos_x = hit.pos_x;
+        checksum += par.gamma_fast_total_L->Eval(hit.total_L);
+        checksum += par.neutron_fast_total_L->Eval(hit.total_L);
+        checksum += par.gamma_fast_total_R->Eval(hit.total_R);
+        checksum += par.neutron_fast_total_R->Eval(hit.total_R);
+        checksum += par.gamma_vpsd_L->Eval(pos_x);
+        checksum += par.neutron_vpsd_L->Eval(pos_x);
+        checksum += par.gamma_vpsd_R->Eval(pos_x);
+        checksum += par.neutron_vpsd_R->Eval(pos_x);
+    }
+    return checksum;
+}
+
+double finite_or_zero(double value) { return std::isfinite(value) ? value : 0.0; }
+
+double run_hit_by_hit(const NWCalibTable& table, const std::vector<Hit>& hits) {
+    /* same calls and float round trips as the old per-event loop of calibrate.cpp */
+    CounterRNG rng(1, 0);
+    double checksum = 0.0;
+    for (std::size_t i = 0; i < hits.size(); ++i) {
+        auto& hit = hits[i];
+        const auto& par = table[hit.bar];
+        float pos_x = get_position(par, hit.time_L, hit.time_R);
+        auto position = randomize_position(rng, i, 0, pos_x);
+        float distance = get_spherical_coordinates(par, position)[0];
+        float theta_c = get_spherical_coordinates(par, {pos_x, 0.0, 0.0})[1];
+        float tof = get_time_of_flight(par, hit.time_L, hit.time_R, hit.fa_time);
+        auto adc = get_corrected_adc(par, rng, i, 0, hit.total_L, hit.total_R, hit.fast_L, hit.fast_R, pos_x);
+        std::array<float, 4> adcf = {float(adc[0]), float(adc[1]), float(adc[2]), float(adc[3])};
+        float light = get_light_output(par, adcf[0], adcf[1], pos_x);
+        float psd = get_psd(par, adcf[0], adcf[1], adcf[2], adcf[3], pos_x)[0];
+        checksum += finite_or_zero(distance) + finite_or_zero(theta_c) + tof + light + finite_or_zero(psd);
+    }
+    return checksum;
+}
+
+double run_hit_block(const NWCalibTable& table, const std::vector<Hit>& hits) {
+    const std::size_t block_size = 8192;
+    CounterRNG rng(1, 0);
+    NWHitBlock block(block_size);
+    double checksum = 0.0;
+    for (std::size_t first = 0; first < hits.size(); first += block_size) {
+        std::size_t stop = std::min(hits.size(), first + block_size);
+        block.clear();
+        for (std::size_t i = first; i < stop; ++i) {
+            auto& hit = hits[i];
+            block.push_back(i, 0, hit.bar, hit.time_L, hit.time_R, hit.fa_time, hit.total_L, hit.total_R, hit.fast_L, hit.fast_R);
+        }
+        block.calibrate(table, rng);
+        for (std::size_t i = 0; i < block.n_hits; ++i) {
+            checksum += (
+                finite_or_zero(block.distance[i]) + finite_or_zero(block.theta_c[i])
+                + block.tof[i] + block.light_GM[i] + finite_or_zero(block.psd[i])
+            );
+        }
+    }
+    return checksum;
+}
+
+template <typename Func>
+void report(const std::string& label, std::size_t n_hits, Func func) {
+    auto start = std::chrono::steady_clock::now();
+    double checksum = func();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << Form("%-16s %12.3e hits/s    (checksum: %.6e)", label.c_str(), n_hits / elapsed.count(), checksum) << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    gErrorIgnoreLevel = kError;
+    int run = (argc > 1) ? std::stoi(argv[1]) : 4083;
+    std::size_t n_hits = (argc > 2) ? std::stoul(argv[2]) : 5000000;
+
+    NWCalibParamReaders readers('B', run);
+    NWCalibTable table(readers);
+
+    TRandom3 rng(12345);
+    std::vector<Hit> hits(n_hits);
+    for (auto& hit : hits) {
+        hit.bar = 1 + int(rng.Uniform(0, NWCalibTable::n_bars));
+        hit.time_L = rng.Uniform(-50, 50);
+        hit.time_R = rng.Uniform(-50, 50);
+        hit.fa_time = rng.Uniform(-10, 10);
+        hit.total_L = short(rng.Uniform(0, 4000));
+        hit.total_R = short(rng.Uniform(0, 4000));
+        hit.fast_L = short(rng.Uniform(0, 4200));
+        hit.fast_R = short(rng.Uniform(0, 4200));
+        auto* centroid = table[hit.bar].gamma_vpsd_L;
+        hit.pos_x = rng.Uniform(centroid->x_min, centroid->x_max);
+    }
+
+    std::cout << Form("run-%04d, %lu synthetic hits (position, TOF, ADC, light output)", run, n_hits) << std::endl;
+    report("reader lookup", n_hits, [&] { return run_reader_lookup(readers, hits); });
+    report("NWCalibTable", n_hits, [&] { return run_calib_table(table, hits); });
+
+    std::cout << Form("PSD curves (lookup table max deviation: %.3e)", readers.psd_reader.get_max_table_error()) << std::endl;
+    report("Akima", n_hits, [&] { return run_psd_akima(readers.psd_reader, hits); });
+    report("UniformGridTable", n_hits, [&] { return run_psd_table(table, hits); });
+
+    std::cout << "full calibration chain" << std::endl;
+    report("hit by hit", n_hits, [&] { return run_hit_by_hit(table, hits); });
+    report("NWHitBlock", n_hits, [&] { return run_hit_block(table, hits); });
+    return 0;
+}
@@ -0,0 +1,108 @@
+/**
+  * Read throughput of the two output formats of calibrate.exe (--format tree
+  * and --format rntuple), with an RDataFrame query over the branches that
+  * e15190/neutron_wall/spectra.py reads: the microball, TDC and veto wall
+  * cuts on every event, then the neutron cuts and the kinematics of every NWB
+  * hit, filled into a histogram. Both files should hold the same run, e.g.
+  *     ./calibrate.exe -r 4083 -o tree-4083.root --schema spectra
+  *     ./calibrate.exe -r 4083 -o rntuple-4083.root --schema spectra --format rntuple
+  * The RNTuple fields "NWB.x" are aliased to "NWB_x", so that both formats run
+  * the very same query. Every repetition reopens the files; the first one
+  * therefore includes reading from disk, the others mostly from page cache.
+  *
+  * Usage: ./benchmarks/bench_output_format.exe tree.root rntuple.root [n_repeats]
+*/
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ROOT/RDataFrame.hxx"
+#include "RVersion.h"
+#include "TError.h"
+#if ROOT_VERSION_CODE < ROOT_VERSION(6, 34, 0)
+#include "ROOT/RNTupleDS.hxx"
+#endif
+
+// NWB branches of the query, aliased for the RNTuple
+const std::vector<std::string> nwb_names = {
+    "bar", "total_L", "total_R", "fast_L", "fast_R",
+    "pos_x", "distance", "theta", "tof", "light_GM", "psd",
+};
+
+struct Result {
+    double seconds;
+    unsigned long long n_events;
+    double n_hits; // filled into the histogram
+};
+
+Result run_query(ROOT::RDF::RNode rdf) {
+    /* The cuts and kinematics of spectra.py, with typical parameters */
+    auto start = std::chrono::steady_clock::now();
+    auto selected = rdf
+        .Filter("MB_multi >= 1 && MB_multi <= 25")
+        .Filter("TDC_mb_nw > -1000 && TDC_mb_nw < 1000")
+        .Filter("VW_multi == 0")
+        .Define("cut",
+            "NWB_light_GM > 3.0 && NWB_pos_x > -90 && NWB_pos_x < 90"
+            " && NWB_fast_L > 0 && NWB_fast_R > 0 && NWB_total_L > 0 && NWB_total_R > 0"
+            " && (NWB_psd > 0.5 || NWB_total_L > 3500 || NWB_total_R > 3500)"
+            " && NWB_theta > 29.0 && NWB_theta < 51.0"
+        )
+        .Define("beta", "NWB_distance / NWB_tof / 29.9792458")
+        .Define("energy", "939.565 / sqrt(1 - beta * beta) - 939.565")
+        .Define("hx", "NWB_theta[cut]")
+        .Define("hy", "energy[cut]");
+    auto n_events = rdf.Count();
+    auto hist = selected.Histo2D({"", "", 50, 25.0, 55.0, 200, 0.0, 400.0}, "hx", "hy");
+    double n_hits = hist->GetEntries(); // runs the event loop, Count() included
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return {elapsed.count(), *n_events, n_hits};
+}
+
+ROOT::RDF::RNode open_tree(const std::string& path) {
+    return ROOT::RDataFrame("tree", path);
+}
+
+ROOT::RDF::RNode open_rntuple(const std::string& path) {
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6, 34, 0)
+    ROOT::RDF::RNode rdf = ROOT::RDataFrame("tree", path);
+#else
+    ROOT::RDF::RNode rdf = ROOT::RDF::Experimental::FromRNTuple("tree", path);
+#endif
+    for (auto& name : nwb_names) {
+        rdf = rdf.Alias("NWB_" + name, "NWB." + name);
+    }
+    return rdf;
+}
+
+void report(const std::string& label, const std::string& path, ROOT::RDF::RNode (*open)(const std::string&), int n_repeats) {
+    std::vector<double> seconds;
+    Result result;
+    for (int i = 0; i < n_repeats; ++i) {
+        result = run_query(open(path));
+        seconds.push_back(result.seconds);
+    }
+    double size_mb = std::filesystem::file_size(path) / 1e6;
+    double best = *std::min_element(seconds.begin(), seconds.end());
+    std::cout << label << ": " << path << std::endl;
+    std::cout << "    file size     " << size_mb << " MB" << std::endl;
+    std::cout << "    events        " << result.n_events << " (" << result.n_hits << " hits selected)" << std::endl;
+    std::cout << "    first run     " << seconds.front() << " s" << std::endl;
+    std::cout << "    best run      " << best << " s, " << result.n_events / best / 1e6 << " M events/s" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " tree.root rntuple.root [n_repeats]" << std::endl;
+        return 1;
+    }
+    gErrorIgnoreLevel = kError;
+    int n_repeats = (argc > 3) ? std::stoi(argv[3]) : 5;
+
+    report("TTree", argv[1], open_tree, n_repeats);
+    report("RNTuple", argv[2], open_rntuple, n_repeats);
+    return 0;
+}
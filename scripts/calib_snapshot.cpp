@@ -0,0 +1,256 @@
+/**
+  * Builds the calibration snapshots that calibrate.exe loads at startup (see
+  * include/NWCalibSnapshot.h), so that batch jobs can skip parsing the
+  * databases altogether. Up-to-date snapshots are left untouched.
+  *
+  * Usage: ./calib_snapshot.exe -r RUNS [-c DIR] [-t]
+  *     -r      A run, an inclusive range of runs such as 4000-4100, or a file
+  *             listing runs and ranges, as in calibrate.exe.
+  *     -c      Directory of calibration snapshots. Default is
+  *             $PROJECT_DIR/database/neutron_wall/calib_snapshots.
+  *     -t      Self-check instead: write a synthetic table, and the table of
+  *             every run of -r if given, to a temporary snapshot, map it back
+  *             and compare every field of every bar, every PSD lookup table
+  *             and the metadata. Exits with 1 on any mismatch. The snapshot
+  *             directory is not touched.
+*/
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "TError.h"
+#include "TFolder.h"
+#include "TNamed.h"
+
+#include "NWCalibSnapshot.h"
+#include "NWCalibration.h"
+#include "UniformGridTable.h"
+#include "calibrate.h"
+
+std::unique_ptr<NWCalibTable> make_synthetic_table();
+bool check_round_trip(const NWCalibTable& table, TFolder* metadata, const std::string& label);
+
+int main(int argc, char* argv[]) {
+    gErrorIgnoreLevel = kError;
+    std::filesystem::path project_dir = get_project_dir();
+    std::vector<int> runs;
+    std::filesystem::path snapshot_dir = project_dir / "database/neutron_wall/calib_snapshots";
+    bool self_check = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "hr:c:t")) != -1) {
+        switch (opt) {
+            case 'r':
+                runs = parse_runs(optarg);
+                break;
+            case 'c':
+                snapshot_dir = optarg;
+                break;
+            case 't':
+                self_check = true;
+                break;
+            default:
+                std::cerr << "Usage: ./calib_snapshot.exe -r RUNS [-c DIR] [-t]" << std::endl;
+                exit(opt == 'h' ? 0 : 1);
+        }
+    }
+
+    if (self_check) {
+        TFolder metadata("metadata", "");
+        auto pcalib = metadata.AddFolder("pcalib", "");
+        pcalib->Add(new TNamed("path", "/synthetic/position.json"));
+        pcalib->Add(new TNamed("hash", "0123456789abcdef"));
+        metadata.AddFolder("empty", "");
+        bool ok = check_round_trip(*make_synthetic_table(), &metadata, "synthetic table");
+
+        if (!runs.empty()) {
+            NWCalibParamReaders nwb_readers('B');
+            for (int run : runs) {
+                nwb_readers.load(run);
+                TFolder run_metadata("metadata", "");
+                nwb_readers.write_metadata(&run_metadata);
+                NWCalibTable table(nwb_readers);
+                ok = check_round_trip(table, &run_metadata, Form("run-%04d", run)) && ok;
+            }
+        }
+        return ok ? 0 : 1;
+    }
+
+    if (runs.empty()) {
+        std::cerr << "Option -r is mandatory" << std::endl;
+        exit(1);
+    }
+
+    NWCalibParamReaders nwb_readers('B');
+    NWCalibSnapshotCache cache(snapshot_dir, nwb_readers);
+    for (int run : runs) {
+        auto path = cache.get_path('B', run);
+        bool up_to_date = NWCalibSnapshot(path).is_valid(cache.source_hash, 'B', run);
+        if (!up_to_date) {
+            TFolder metadata("metadata", "");
+            cache.get_table(nwb_readers, run, &metadata);
+        }
+        std::cout << Form("run-%04d: %s %s", run, path.string().c_str(), up_to_date ? "(up to date)" : "(built)") << std::endl;
+    }
+    return 0;
+}
+
+template <typename Par, typename Func>
+void for_each_field(Par& par, Func func) {
+    /* Every double of NWBarCalibParams, with its name; keep in sync with the struct */
+    func("pos_p0", par.pos_p0);
+    func("pos_p1", par.pos_p1);
+    for (int i = 0; i < 3; ++i) {
+        func(Form("L[%d]", i), par.L[i]);
+        func(Form("X[%d]", i), par.X[i]);
+        func(Form("Y[%d]", i), par.Y[i]);
+        func(Form("Z[%d]", i), par.Z[i]);
+    }
+    func("tof_offset", par.tof_offset);
+    for (int i = 0; i < 2; ++i) {
+        func(Form("nonlinear_fast_threshold[%d]", i), par.nonlinear_fast_threshold[i]);
+        func(Form("stationary_point_x[%d]", i), par.stationary_point_x[i]);
+        func(Form("stationary_point_y[%d]", i), par.stationary_point_y[i]);
+        for (int j = 0; j < 3; ++j) {
+            func(Form("fast_total_fit[%d][%d]", i, j), par.fast_total_fit[i][j]);
+        }
+    }
+    func("two_over_attenuation_length", par.two_over_attenuation_length);
+    func("log_gain_ratio", par.log_gain_ratio);
+    func("light_a", par.light_a);
+    func("light_b", par.light_b);
+    func("light_c", par.light_c);
+    func("light_d", par.light_d);
+    func("light_e", par.light_e);
+    for (int i = 0; i < 2; ++i) {
+        func(Form("pca_mean[%d]", i), par.pca_mean[i]);
+        func(Form("pca_xpeaks[%d]", i), par.pca_xpeaks[i]);
+        for (int j = 0; j < 2; ++j) {
+            func(Form("pca_components[%d][%d]", i, j), par.pca_components[i][j]);
+        }
+    }
+}
+
+std::array<const UniformGridTable*, NWCalibTable::n_psd_tables> get_psd_pointers(const NWBarCalibParams& par) {
+    return {
+        par.gamma_fast_total_L, par.neutron_fast_total_L, par.gamma_fast_total_R, par.neutron_fast_total_R,
+        par.gamma_vpsd_L, par.neutron_vpsd_L, par.gamma_vpsd_R, par.neutron_vpsd_R,
+    };
+}
+
+std::unique_ptr<NWCalibTable> make_synthetic_table() {
+    /* Every value distinct, so that a shifted or swapped field cannot go
+     * unnoticed; tables of different sizes, and bar 0 left empty.
+     */
+    auto table = std::make_unique<NWCalibTable>();
+    table->AB = 'B';
+    table->run = 4083;
+    double value = 0.0;
+    for (int bar = 1; bar <= NWCalibTable::n_bars; ++bar) {
+        for_each_field(table->bars[bar], [&value](const char*, double& field) { field = (value += 1.0) / 7.0; });
+        for (int i = 0; i < NWCalibTable::n_psd_tables; ++i) {
+            UniformGridTable& psd_table = table->psd_tables[bar][i];
+            psd_table.x_min = -bar - 0.5;
+            psd_table.x_max = 100.0 * (i + 1);
+            psd_table.n_cells = 1 + (bar * NWCalibTable::n_psd_tables + i) % 13;
+            psd_table.inv_h = psd_table.n_cells / (psd_table.x_max - psd_table.x_min);
+            psd_table.max_error = 1e-9 * (i + 1) / bar;
+            psd_table.coeffs.resize(psd_table.n_cells);
+            for (auto& cell : psd_table.coeffs) {
+                for (auto& c : cell) c = (value += 1.0) / 3.0;
+            }
+        }
+    }
+    table->link_psd_tables();
+    return table;
+}
+
+std::vector<std::string> flatten_metadata(TFolder* metadata) {
+    std::vector<std::string> items;
+    for (TObject* obj : *metadata->GetListOfFolders()) {
+        auto* subfolder = dynamic_cast<TFolder*>(obj);
+        if (subfolder == nullptr) continue;
+        items.push_back(subfolder->GetName());
+        for (TObject* item : *subfolder->GetListOfFolders()) {
+            items.push_back(Form("%s/%s: %s", subfolder->GetName(), item->GetName(), item->GetTitle()));
+        }
+    }
+    return items;
+}
+
+bool check_round_trip(const NWCalibTable& table, TFolder* metadata, const std::string& label) {
+    /* Values are compared bit by bit, so that NaNs and signed zeros count too */
+    auto same = [](double a, double b) { return std::memcmp(&a, &b, sizeof(double)) == 0; };
+    std::vector<std::string> errors;
+
+    const std::uint64_t source_hash = 0x0123456789abcdefUL;
+    auto path = std::filesystem::temp_directory_path() / Form("calib_snapshot_check_%d.bin", getpid());
+    NWCalibSnapshot::write(path, table, metadata, source_hash);
+    {
+        NWCalibSnapshot snapshot(path);
+        if (!snapshot.is_valid(source_hash, table.AB, table.run)) {
+            errors.push_back("snapshot not valid after writing");
+        }
+        else {
+            auto copy = snapshot.make_table();
+            if (copy->AB != table.AB || copy->run != table.run) {
+                errors.push_back("AB or run differs");
+            }
+            for (int bar = 0; bar <= NWCalibTable::n_bars; ++bar) {
+                std::vector<double> values;
+                for_each_field(table.bars[bar], [&values](const char*, const double& field) { values.push_back(field); });
+                int i_value = 0;
+                for_each_field(copy->bars[bar], [&](const char* name, const double& field) {
+                    if (!same(field, values[i_value++])) {
+                        errors.push_back(Form("bar %d: %s differs", bar, name));
+                    }
+                });
+
+                // pointers must point into the table they belong to, at the same position
+                auto pointers = get_psd_pointers(table.bars[bar]);
+                auto copy_pointers = get_psd_pointers(copy->bars[bar]);
+                for (int i = 0; i < NWCalibTable::n_psd_tables; ++i) {
+                    long index = pointers[i] == nullptr ? -1 : pointers[i] - table.psd_tables[bar].data();
+                    long copy_index = copy_pointers[i] == nullptr ? -1 : copy_pointers[i] - copy->psd_tables[bar].data();
+                    if (index != copy_index) {
+                        errors.push_back(Form("bar %d: PSD pointer %d differs", bar, i));
+                    }
+
+                    const UniformGridTable& src = table.psd_tables[bar][i];
+                    const UniformGridTable& dst = copy->psd_tables[bar][i];
+                    bool same_table = (
+                        same(src.x_min, dst.x_min) && same(src.x_max, dst.x_max)
+                        && same(src.inv_h, dst.inv_h) && same(src.max_error, dst.max_error)
+                        && src.n_cells == dst.n_cells && src.coeffs.size() == dst.coeffs.size()
+                    );
+                    for (std::size_t j = 0; same_table && j < src.coeffs.size(); ++j) {
+                        for (int k = 0; k < 4; ++k) {
+                            same_table = same_table && same(src.coeffs[j][k], dst.coeffs[j][k]);
+                        }
+                    }
+                    if (!same_table) {
+                        errors.push_back(Form("bar %d: PSD table %d differs", bar, i));
+                    }
+                }
+            }
+
+            TFolder copy_metadata("metadata", "");
+            snapshot.write_metadata(&copy_metadata);
+            if (flatten_metadata(metadata) != flatten_metadata(&copy_metadata)) {
+                errors.push_back("metadata differs");
+            }
+        }
+    }
+    std::filesystem::remove(path);
+
+    for (auto& error : errors) {
+        std::cerr << label << ": " << error << std::endl;
+    }
+    std::cout << label << ": round trip " << (errors.empty() ? "OK" : "FAILED") << std::endl;
+    return errors.empty();
+}
@@ -1,320 +1,686 @@
 // standard libraries
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdlib>
 #include <filesystem>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 // third-party libraries
 #include <nlohmann/json.hpp>
 
 // CERN ROOT libraries
+#include "ROOT/TBufferMerger.hxx"
+#include "RVersion.h"
 #include "TError.h"
-#include "TMath.h"
 #include "TNamed.h"
-#include "TRandom.h"
 #include "TROOT.h"
 
 // local libraries
+#include "ArrowWriter.h"
+#include "BoundedQueue.h"
+#include "CounterRNG.h"
+#include "EventWriter.h"
+#include "HitTableWriter.h"
+#include "NWCalibSnapshot.h"
+#include "NWCalibration.h"
+#include "NWHitBlock.h"
+#include "OutputStorage.h"
 #include "ParamReader.h"
+#include "RNTupleEventWriter.h"
+#include "SQLiteWriter.h"
 #include "calibrate.h"
 
 using Json = nlohmann::json;
-
-// forward declarations of calibration functions
-double get_position(NWPositionCalibParamReader& nw_pcalib, int bar, double time_L, double time_R);
-double get_time_of_flight(
-    NWTimeOfFlightCalibParamReader& nw_tcalib, int bar, double time_L, double time_R, double fa_time
+using EventWriters = std::vector<std::unique_ptr<EventWriter> >;
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6, 26, 0)
+using BufferMerger = ROOT::TBufferMerger;
+#else
+using BufferMerger = ROOT::Experimental::TBufferMerger;
+#endif
+
+struct EventBlock {
+    /* Events are calibrated in blocks: all entries of a block are read first,
+     * their NWB hits are calibrated together by the NWHitBlock kernels, then
+     * the entries are filled into the output tree one by one.
+     */
+    static constexpr int max_n_events = 256;
+    long first_entry = 0;
+    int n_events = 0;
+    std::vector<Container> events;
+    std::vector<char> selected; // by --sparse; unselected events are not written
+    NWHitBlock hits;
+
+    EventBlock() : events(max_n_events), selected(max_n_events, 1) { }
+};
+
+// forward declarations
+void calibrate_run(
+    ArgumentParser& argparser, std::filesystem::path& project_dir,
+    NWCalibParamReaders& nwb_readers, NWCalibSnapshotCache* snapshot_cache,
+    const OutputSchema& schema, const OutputStorage& storage
+);
+TTree* create_output_tree(
+    const ArgumentParser& argparser, TFile* outroot, Container& evt,
+    const OutputSchema& schema, const OutputStorage& storage
 );
-std::array<double, 4> get_corrected_adc(
-    NWADCPreprocessorParamReader& nw_acalib,
-    int bar, short total_L, short total_R, short fast_L, short fast_R, const double pos_x
+void gather_hits(long entry, const Container& evt, NWHitBlock& hits);
+void scatter_hits(const NWHitBlock& hits, std::size_t first_hit, Container& evt);
+void read_block(long first, long stop, TChain* intree, Container& evt, EventBlock& block, ProgressBar* progress_bar=nullptr);
+void calibrate_block(
+    EventBlock& block, const NWCalibTable& nwb, const CounterRNG& rng,
+    OutputQuantizer* quantizer=nullptr, EventSelection* selection=nullptr
 );
-double get_light_output(
-    NWLightOutputCalibParamReader& nw_pcalib,
-    int bar, double total_L, double total_R, const double pos_x
+void write_block(const EventBlock& block, TTree* outtree, Container& evt, const EventWriters& writers={});
+void calibrate_entries(
+    long first, long stop, TChain* intree, TTree* outtree, Container& evt, EventBlock& block,
+    const NWCalibTable& nwb, const CounterRNG& rng, ProgressBar* progress_bar=nullptr,
+    const EventWriters& writers={}, OutputQuantizer* quantizer=nullptr, EventSelection* selection=nullptr
 );
-std::array<double, 2> get_psd(
-    NWPulseShapeDiscriminationParamReader& psd_reader,
-    int bar, double total_L, double total_R, double fast_L, double fast_R, const double pos_x
+void calibrate_multithreaded(
+    ArgumentParser& argparser, const NWCalibTable& nwb, const std::string& inroot_path,
+    const std::vector<std::pair<long, long> >& clusters, const OutputSchema& schema,
+    const OutputStorage& storage, ProgressBar& progress_bar, OutputQuantizer& quantizer,
+    EventSelection& selection
 );
-std::array<double, 3> randomize_position(const double pos_x);
-std::array<double, 3> get_spherical_coordinates(
-    NWPositionCalibParamReader& nw_pcalib, int bar, const std::array<double, 3>& position
+void calibrate_pipelined(
+    ArgumentParser& argparser, const NWCalibTable& nwb, TChain* intree, Container& in_evt,
+    TTree* outtree, Container& out_evt, ProgressBar& progress_bar, const EventWriters& writers,
+    OutputQuantizer& quantizer, EventSelection& selection
 );
+std::vector<EventWriter::Column> get_event_columns(const OutputSchema& schema);
+std::vector<SQLiteWriter::Table> get_sqlite_tables(const OutputSchema& schema);
+std::unique_ptr<HitTableWriter> get_hit_table();
+EventWriter::Column get_column(const BranchSpec& spec, Container& base);
+
+// event branches repeated on every entry of the hit table, for the usual cuts of spectra.py
+const std::vector<std::string> hit_table_event_columns = {"MB_multi", "VW_multi", "TDC_mb_nw"};
 
 int main(int argc, char* argv[]) {
     // initialization and argument parsing
     gErrorIgnoreLevel = kError; // ignore warnings
     std::filesystem::path project_dir = get_project_dir();
     ArgumentParser argparser(argc, argv);
+    if (argparser.n_threads > 1 || argparser.n_workers > 0) {
+        ROOT::EnableThreadSafety();
+    }
 
-    // read in parameter readers
-    NWPositionCalibParamReader nwb_pcalib('B');
-    NWTimeOfFlightCalibParamReader nwb_tcalib('B');
-    NWADCPreprocessorParamReader nwb_acalib('B');
-    NWLightOutputCalibParamReader nwb_lcalib('B');
-    NWPulseShapeDiscriminationParamReader nwb_psd_reader('B');
-    nwb_pcalib.load(argparser.run_num);
-    nwb_tcalib.load(argparser.run_num);
-    nwb_acalib.load(argparser.run_num);
-    nwb_lcalib.load(argparser.run_num);
-    nwb_psd_reader.load(argparser.run_num);
+    // parameter readers are kept for all runs, so that every database is parsed only once
+    NWCalibParamReaders nwb_readers('B');
+    std::unique_ptr<NWCalibSnapshotCache> snapshot_cache;
+    if (argparser.snapshot_dir != "none") {
+        std::filesystem::path snapshot_dir = argparser.snapshot_dir;
+        if (snapshot_dir.empty()) {
+            snapshot_dir = project_dir / "database/neutron_wall/calib_snapshots";
+        }
+        snapshot_cache = std::make_unique<NWCalibSnapshotCache>(snapshot_dir, nwb_readers);
+    }
+    // raw branches needed by the hit table or the --sparse predicate, whatever the schema
+    std::vector<std::string> extra_inputs = EventSelection(argparser.sparse_predicate).get_branches();
+    if (argparser.hit_table) {
+        extra_inputs.insert(extra_inputs.end(), hit_table_event_columns.begin(), hit_table_event_columns.end());
+    }
+    OutputSchema schema(argparser.schema, argparser.friend_mode, extra_inputs);
+    if (argparser.regen_dither) {
+        schema.drop_regenerable(argparser.friend_mode);
+    }
+    auto storage = argparser.storage_config.empty() ? OutputStorage() : OutputStorage(argparser.storage_config);
+    for (int run : argparser.runs) {
+        argparser.run_num = run;
+        if (argparser.runs.size() > 1) {
+            std::cout << Form("run-%04d -> %s", run, argparser.get_outroot_path().c_str()) << std::endl;
+        }
+        calibrate_run(argparser, project_dir, nwb_readers, snapshot_cache.get(), schema, storage);
+    }
 
-    // read in Daniele's ROOT files (Kuan's version)
-    std::filesystem::path inroot_path = get_input_root_path(project_dir, argparser);
-    TChain* intree = get_input_tree(inroot_path.string(), "E15190");
+    return 0;
+}
 
-    // prepare output (calibrated) ROOT files
-    TFile* outroot = new TFile(argparser.outroot_path.c_str(), "RECREATE");
-    TTree* outtree = get_output_tree(outroot, "tree");
+void calibrate_run(
+    ArgumentParser& argparser, std::filesystem::path& project_dir,
+    NWCalibParamReaders& nwb_readers, NWCalibSnapshotCache* snapshot_cache,
+    const OutputSchema& schema, const OutputStorage& storage
+) {
+    std::filesystem::path inroot_path = argparser.framework_input
+        ? get_input_root_path(project_dir, argparser, "daniele_root_files_dir")
+        : get_input_root_path(project_dir, argparser);
+    if (!std::filesystem::exists(inroot_path)) {
+        std::cerr << "ERROR: input file not found: " << inroot_path.string() << std::endl;
+        if (argparser.runs.size() == 1) {
+            exit(1);
+        }
+        return;
+    }
 
-    // save metadata into TFolder
+    // select parameters of this run, from the snapshot when it is up to date
     TFolder* metadata = gROOT->GetRootFolder()->AddFolder("metadata", "");
-    metadata->Add(new TNamed(inroot_path.string().c_str(), "inroot_path"));
-    TFolder* position_param_paths = metadata->AddFolder("position_param_paths", "");
-    TFolder* time_of_fligh_param_paths = metadata->AddFolder("time_of_flight_param_paths", "");
-    TFolder* adc_param_paths = metadata->AddFolder("adc_param_paths", "");
-    TFolder* light_param_paths = metadata->AddFolder("light_param_path", "");
-    TFolder* psd_param_paths = metadata->AddFolder("psd_param_paths", "");
-    nwb_pcalib.write_metadata(position_param_paths);
-    nwb_tcalib.write_metadata(time_of_fligh_param_paths);
-    nwb_acalib.write_metadata(adc_param_paths);
-    nwb_lcalib.write_metadata(light_param_paths);
-    nwb_psd_reader.write_metadata(psd_param_paths);
+    std::unique_ptr<NWCalibTable> nwb;
+    if (snapshot_cache != nullptr) {
+        nwb = snapshot_cache->get_table(nwb_readers, argparser.run_num, metadata);
+    }
+    else {
+        nwb_readers.load(argparser.run_num);
+        nwb = std::make_unique<NWCalibTable>(nwb_readers);
+        nwb_readers.write_metadata(metadata);
+    }
 
-    // main loop
-    gRandom->SetSeed((unsigned)time( NULL ));
+    // read in Daniele's ROOT files (Kuan's version)
+    auto evt_ptr = std::make_unique<Container>();
+    Container& evt = *evt_ptr; // see "calibrate.h"
+    TChain* intree = get_input_tree(inroot_path.string(), "E15190", evt, schema);
     ProgressBar progress_bar(argparser, intree->GetEntries());
-    Container& evt = container; // a shorter alias; see "calibrate.h"
-    for (int ievt = argparser.first_entry; ievt <= progress_bar.last_entry; ++ievt) {
-        progress_bar.show(ievt);
-        intree->GetEntry(ievt);
+    intree->LoadTree(argparser.first_entry);
+    auto clusters = get_entry_clusters(intree->GetTree(), argparser.first_entry, progress_bar.last_entry);
 
-        // calibrations
-        for (int m = 0; m < evt.NWB_multi; ++m) {
-            // position calibration
-            evt.NWB_pos_x[m] = get_position(
-                nwb_pcalib,
-                evt.NWB_bar[m], evt.NWB_time_L[m], evt.NWB_time_R[m]
-            );
-            std::array<double, 3> bar_position = randomize_position(evt.NWB_pos_x[m]);
-            evt.NWB_pos_y[m] = bar_position[1];
-            evt.NWB_pos_z[m] = bar_position[2];
-            std::array<double, 3> sph_coord = get_spherical_coordinates(nwb_pcalib, evt.NWB_bar[m], bar_position);
-            evt.NWB_distance[m] = sph_coord[0];
-            evt.NWB_theta[m] = sph_coord[1];
-            evt.NWB_phi[m] = sph_coord[2];
-            std::array<double, 3> bar_position_c = {evt.NWB_pos_x[m], 0.0, 0.0};
-            std::array<double, 3> sph_coord_c = get_spherical_coordinates(nwb_pcalib, evt.NWB_bar[m], bar_position_c);
-            evt.NWB_distance_c[m] = sph_coord_c[0];
-            evt.NWB_theta_c[m] = sph_coord_c[1];
-            evt.NWB_phi_c[m] = sph_coord_c[2];
-
-            // time-of-flight calibration
-            evt.NWB_tof[m] = get_time_of_flight(
-                nwb_tcalib,
-                evt.NWB_bar[m], evt.NWB_time_L[m], evt.NWB_time_R[m], evt.FA_time_mean
-            );
+    // save metadata into TFolder
+    metadata->Add(new TNamed(inroot_path.string().c_str(), "inroot_path"));
+    metadata->Add(new TNamed(Form("%d", argparser.run_num), "run"));
+    metadata->Add(new TNamed(Form("%lu", argparser.seed), "seed"));
+    metadata->Add(new TNamed("philox4x32-10", "rng"));
+    storage.write_metadata(metadata);
+    metadata->Add(new TNamed(schema.name.c_str(), "schema"));
+    metadata->Add(new TNamed(argparser.output_format.c_str(), "output_format"));
+    if (argparser.regen_dither) {
+        std::string branches;
+        for (auto& name : OutputSchema::regenerable_branches) {
+            branches += (branches.empty() ? "" : ",") + name;
+        }
+        metadata->Add(new TNamed(branches.c_str(), "regenerated_branches"));
+    }
 
-            // adc pre-processing
-            std::array<double, 4> corrected_adc = get_corrected_adc(
-                nwb_acalib,
-                evt.NWB_bar[m],
-                double(evt.NWB_total_L[m]), double(evt.NWB_total_R[m]),
-                double(evt.NWB_fast_L[m]), double(evt.NWB_fast_R[m]),
-                evt.NWB_pos_x[m]
-            );
-            evt.NWB_totalf_L[m] = corrected_adc[0];
-            evt.NWB_totalf_R[m] = corrected_adc[1];
-            evt.NWB_fastf_L[m] = corrected_adc[2];
-            evt.NWB_fastf_R[m] = corrected_adc[3];
-
-            // light output calibration
-            evt.NWB_light_GM[m] = get_light_output(
-                nwb_lcalib,
-                evt.NWB_bar[m],
-                double(evt.NWB_totalf_L[m]), double(evt.NWB_totalf_R[m]),
-                evt.NWB_pos_x[m]
-            );
-            
-            // pulse shape discrimination
-            std::array<double, 2> psd = get_psd(
-                nwb_psd_reader,
-                evt.NWB_bar[m],
-                double(evt.NWB_totalf_L[m]), double(evt.NWB_totalf_R[m]),
-                double(evt.NWB_fastf_L[m]), double(evt.NWB_fastf_R[m]),
-                evt.NWB_pos_x[m]
+    // the output file of -j is only created by the merger
+    std::string outroot_path = argparser.get_outroot_path();
+    TFile* outroot = nullptr;
+    if (argparser.n_threads == 1) {
+        outroot = new TFile(outroot_path.c_str(), "RECREATE");
+        storage.apply(outroot);
+    }
+
+    // the output RNTuple and optional copies of the output, filled along with the output tree
+    EventWriters writers;
+    bool write_tree = (argparser.output_format == "tree");
+    if (!write_tree) {
+        writers.push_back(std::make_unique<RNTupleEventWriter>(outroot, "tree", get_event_columns(schema), storage.compression));
+    }
+    if (argparser.arrow_path != "") {
+        writers.push_back(std::make_unique<ArrowWriter>(
+            argparser.get_arrow_path(), get_event_columns(schema),
+            std::vector<std::pair<std::string, std::string> >{
+                {"run", Form("%d", argparser.run_num)},
+                {"inroot_path", inroot_path.string()},
+                {"seed", Form("%lu", argparser.seed)},
+                {"rng", "philox4x32-10"},
+                {"schema", schema.name},
+            }
+        ));
+    }
+    if (argparser.sqlite_path != "") {
+        writers.push_back(std::make_unique<SQLiteWriter>(
+            argparser.get_sqlite_path(), get_sqlite_tables(schema), offsetof(Container, entry)
+        ));
+    }
+    HitTableWriter* hit_table = nullptr; // owned by writers
+    if (argparser.hit_table) {
+        writers.push_back(get_hit_table());
+        hit_table = static_cast<HitTableWriter*>(writers.back().get());
+    }
+
+    // main loop
+    OutputQuantizer quantizer(schema, storage);
+    EventSelection selection(argparser.sparse_predicate);
+    if (argparser.n_threads > 1) {
+        delete intree;
+        calibrate_multithreaded(
+            argparser, *nwb, inroot_path.string(), clusters, schema, storage, progress_bar, quantizer, selection
+        );
+        progress_bar.terminate();
+        outroot = new TFile(outroot_path.c_str(), "UPDATE");
+    }
+    else if (argparser.n_workers > 0) {
+        auto out_evt_ptr = std::make_unique<Container>();
+        TTree* outtree = write_tree ? create_output_tree(argparser, outroot, *out_evt_ptr, schema, storage) : nullptr;
+        calibrate_pipelined(
+            argparser, *nwb, intree, evt, outtree, *out_evt_ptr, progress_bar, writers, quantizer, selection
+        );
+
+        if (outtree != nullptr) {
+            outroot->cd();
+            outtree->Write();
+        }
+        delete intree;
+    }
+    else {
+        // prepare output (calibrated) ROOT files
+        TTree* outtree = write_tree ? create_output_tree(argparser, outroot, evt, schema, storage) : nullptr;
+
+        CounterRNG rng(argparser.seed, argparser.run_num);
+        auto block = std::make_unique<EventBlock>();
+        for (std::size_t i_cluster = 0; i_cluster < clusters.size(); ++i_cluster) {
+            calibrate_entries(
+                clusters[i_cluster].first, clusters[i_cluster].second,
+                intree, outtree, evt, *block, *nwb, rng, &progress_bar, writers, &quantizer, &selection
             );
-            evt.NWB_psd[m] = psd[0];
-            evt.NWB_psd_perp[m] = psd[1];
         }
 
-        outtree->Fill();
+        if (outtree != nullptr) {
+            outroot->cd();
+            outtree->Write();
+        }
+        delete intree;
+        progress_bar.terminate();
+    }
+
+    for (auto& writer : writers) {
+        writer->close();
+    }
+    if (hit_table != nullptr) {
+        hit_table->write(outroot, storage);
+    }
+
+    // the friend tree points to the input tree; the merged tree of -j only exists now
+    if (argparser.friend_mode) {
+        TTree* outtree = outroot->Get<TTree>("tree");
+        link_friend_tree(outtree, inroot_path.string(), "E15190");
+        outroot->cd();
+        outtree->Write("", TObject::kOverwrite);
     }
-    progress_bar.terminate();
 
     // save output to file
+    quantizer.report(metadata);
+    selection.write_metadata(metadata);
     outroot->cd();
     metadata->Write();
-    outtree->Write();
     outroot->Close();
+    delete outroot;
 
-    return 0;
+    // the next run gets a fresh metadata folder
+    gROOT->GetRootFolder()->Remove(metadata);
+    delete metadata;
+}
+
+std::vector<EventWriter::Column> get_event_columns(const OutputSchema& schema) {
+    /* The input entry number, then the output branches, as fields of Container */
+    auto base_ptr = std::make_unique<Container>();
+    Container& base = *base_ptr;
+    auto offset = [&base](void* field) { return static_cast<char*>(field) - reinterpret_cast<char*>(&base); };
+
+    std::vector<EventWriter::Column> columns = {{"entry", 'L', offset(&base.entry)}};
+    for (auto* spec : schema.output_branches) {
+        columns.push_back(get_column(*spec, base));
+    }
+    return columns;
+}
+
+std::unique_ptr<HitTableWriter> get_hit_table() {
+    /* Every NWB array, raw or calibrated, with hit_table_event_columns; hits are sorted by bar */
+    auto base_ptr = std::make_unique<Container>();
+    Container& base = *base_ptr;
+    std::vector<EventWriter::Column> event_columns, hit_columns;
+    for (auto& name : hit_table_event_columns) {
+        event_columns.push_back(get_column(*find_branch_spec(name), base));
+    }
+    for (auto& spec : branch_specs) {
+        if (spec.get_counter() == "NWB_multi") {
+            hit_columns.push_back(get_column(spec, base));
+        }
+    }
+    return std::make_unique<HitTableWriter>("hits", event_columns, hit_columns, offsetof(Container, entry), "NWB_bar");
 }
 
-double get_position(NWPositionCalibParamReader& nw_pcalib, int bar, double time_L, double time_R) {
-    double p0 = nw_pcalib.get(bar, "p0");
-    double p1 = nw_pcalib.get(bar, "p1");
-    return p0 + p1 * (time_L - time_R);
+EventWriter::Column get_column(const BranchSpec& spec, Container& base) {
+    /* The field of spec in base, with offsets relative to base */
+    auto offset = [&base](void* field) { return static_cast<char*>(field) - reinterpret_cast<char*>(&base); };
+    EventWriter::Column column = {spec.name, std::string(spec.leaflist).back(), offset(spec.address(base))};
+    std::string counter = spec.get_counter();
+    if (counter != "") {
+        column.counter_offset = offset(find_branch_spec(counter)->address(base));
+    }
+    return column;
 }
 
-double get_time_of_flight(NWTimeOfFlightCalibParamReader& nw_tcalib, int bar, double time_L, double time_R, double fa_time) {
-    return 0.5 * (time_L + time_R) - fa_time - nw_tcalib.tof_offset[bar];
+std::vector<SQLiteWriter::Table> get_sqlite_tables(const OutputSchema& schema) {
+    /* The tables of scripts/root_to_sqlite.py, which groups branches by prefix */
+    std::vector<SQLiteWriter::Table> tables = {{"tdc"}, {"mb"}, {"fa"}, {"vw"}, {"nwb"}};
+    auto columns = get_event_columns(schema);
+    for (auto& table : tables) {
+        std::string prefix = table.name;
+        std::transform(prefix.begin(), prefix.end(), prefix.begin(), ::toupper);
+        for (auto& column : columns) {
+            if (column.name.rfind(prefix, 0) == 0) {
+                table.columns.push_back(column);
+            }
+        }
+    }
+    tables.erase(
+        std::remove_if(tables.begin(), tables.end(), [](auto& table) { return table.columns.empty(); }),
+        tables.end()
+    );
+    return tables;
 }
 
-std::array<double, 4> get_corrected_adc(
-    NWADCPreprocessorParamReader& nw_acalib,
-    int bar, short total_L, short total_R, short fast_L, short fast_R, const double pos_x
+TTree* create_output_tree(
+    const ArgumentParser& argparser, TFile* outroot, Container& evt,
+    const OutputSchema& schema, const OutputStorage& storage
 ) {
-    double totalf_L, totalf_R, fastf_L, fastf_R;
-    auto& ft_L = nw_acalib.fast_total_L[bar];
-    auto& ft_R = nw_acalib.fast_total_R[bar];
-    auto& lrt = nw_acalib.log_ratio_total[bar];
-
-    // randomize ADC
-    auto randomize = [](short raw) {
-        if (raw < 0) return double(raw); // e.g. -9999
-        else if (raw == 0) return raw + gRandom->Uniform(0, 0.5);
-        else if (raw < 4096) return raw + gRandom->Uniform(-0.5, 0.5);
-        else return double(raw);
-    };
-    totalf_L = randomize(total_L);
-    totalf_R = randomize(total_R);
-    fastf_L = randomize(fast_L);
-    fastf_R = randomize(fast_R);
+    bool with_entry = argparser.friend_mode || argparser.regen_dither || argparser.sparse_predicate != "";
+    TTree* tree = get_output_tree(outroot, "tree", evt, schema, with_entry);
+    storage.apply(tree);
+    return tree;
+}
 
-    double ratio_R_L = exp((2 / lrt["attenuation_length"]) * pos_x + log(lrt["gain_ratio"]));
+void gather_hits(long entry, const Container& evt, NWHitBlock& hits) {
+    for (int m = 0; m < evt.NWB_multi; ++m) {
+        hits.push_back(
+            entry, m, evt.NWB_bar[m], evt.NWB_time_L[m], evt.NWB_time_R[m], evt.FA_time_mean,
+            evt.NWB_total_L[m], evt.NWB_total_R[m], evt.NWB_fast_L[m], evt.NWB_fast_R[m]
+        );
+    }
+}
+
+void scatter_hits(const NWHitBlock& hits, std::size_t first_hit, Container& evt) {
+    for (int m = 0; m < evt.NWB_multi; ++m) {
+        std::size_t i = first_hit + m;
+        evt.NWB_pos_x[m] = hits.pos_x[i];
+        evt.NWB_pos_y[m] = hits.pos_y[i];
+        evt.NWB_pos_z[m] = hits.pos_z[i];
+        evt.NWB_distance[m] = hits.distance[i];
+        evt.NWB_theta[m] = hits.theta[i];
+        evt.NWB_phi[m] = hits.phi[i];
+        evt.NWB_distance_c[m] = hits.distance_c[i];
+        evt.NWB_theta_c[m] = hits.theta_c[i];
+        evt.NWB_phi_c[m] = hits.phi_c[i];
+        evt.NWB_tof[m] = hits.tof[i];
+        evt.NWB_totalf_L[m] = hits.totalf_L[i];
+        evt.NWB_totalf_R[m] = hits.totalf_R[i];
+        evt.NWB_fastf_L[m] = hits.fastf_L[i];
+        evt.NWB_fastf_R[m] = hits.fastf_R[i];
+        evt.NWB_light_GM[m] = hits.light_GM[i];
+        evt.NWB_psd[m] = hits.psd[i];
+        evt.NWB_psd_perp[m] = hits.psd_perp[i];
+        evt.NWB_status[m] = hits.status[i];
+    }
+}
 
-    // correct for total_L
-    if (totalf_L >= 4096 && totalf_R < 4096) {
-        totalf_L = totalf_R / ratio_R_L;
+void read_block(long first, long stop, TChain* intree, Container& evt, EventBlock& block, ProgressBar* progress_bar) {
+    /* Read entries [first, stop) into the block. The input tree is bound to
+     * evt, so every entry is copied into the block once read.
+     */
+    block.first_entry = first;
+    block.n_events = stop - first;
+    block.hits.clear();
+    for (long ievt = first; ievt < stop; ++ievt) {
+        if (progress_bar) progress_bar->show(ievt);
+        intree->GetEntry(ievt);
+        evt.entry = ievt;
+        gather_hits(ievt, evt, block.hits);
+        block.events[ievt - first] = evt;
     }
-    else if (fastf_L > ft_L["nonlinear_fast_threshold"] && fastf_L < ft_L["stationary_point_x"]) {
-        totalf_L += ft_L["fit_params[0]"];
-        totalf_L += ft_L["fit_params[1]"] * fastf_L;
-        totalf_L += ft_L["fit_params[2]"] * fastf_L * fastf_L;
+}
+
+void calibrate_block(
+    EventBlock& block, const NWCalibTable& nwb, const CounterRNG& rng,
+    OutputQuantizer* quantizer, EventSelection* selection
+) {
+    block.hits.calibrate(nwb, rng);
+    std::size_t first_hit = 0;
+    for (int i = 0; i < block.n_events; ++i) {
+        scatter_hits(block.hits, first_hit, block.events[i]);
+        first_hit += block.events[i].NWB_multi;
     }
-    else if (fastf_L > ft_L["stationary_point_x"]) {
-        totalf_L += ft_L["stationary_point_y"] - total_L;
+    if (quantizer != nullptr && !quantizer->empty()) {
+        quantizer->apply(block.events.data(), block.n_events);
     }
 
-    // correct for total_R
-    if (totalf_R >= 4096 && totalf_L < 4096) {
-        totalf_R = totalf_L * ratio_R_L;
+    // the predicate sees the values as they are written
+    long n_selected = 0;
+    for (int i = 0; i < block.n_events; ++i) {
+        block.selected[i] = (selection == nullptr) || selection->evaluate(block.events[i]);
+        n_selected += block.selected[i];
     }
-    else if (fastf_R > ft_R["nonlinear_fast_threshold"] && fastf_R < ft_R["stationary_point_x"]) {
-        totalf_R += ft_R["fit_params[0]"];
-        totalf_R += ft_R["fit_params[1]"] * fastf_R;
-        totalf_R += ft_R["fit_params[2]"] * fastf_R * fastf_R;
+    if (selection != nullptr) {
+        selection->n_selected += n_selected;
+        selection->n_skipped += block.n_events - n_selected;
     }
-    else if (fastf_R > ft_R["stationary_point_x"]) {
-        totalf_R += ft_R["stationary_point_y"] - total_R;
+}
+
+void write_block(const EventBlock& block, TTree* outtree, Container& evt, const EventWriters& writers) {
+    /* The output tree is bound to evt, so every entry is copied back first; outtree is null for RNTuple output */
+    for (int i = 0; i < block.n_events; ++i) {
+        if (!block.selected[i]) continue;
+        if (outtree != nullptr) {
+            evt = block.events[i];
+            outtree->Fill();
+        }
+        for (auto& writer : writers) {
+            writer->fill(&block.events[i]);
+        }
     }
+}
 
-    return {totalf_L, totalf_R, fastf_L, fastf_R};
+void calibrate_entries(
+    long first, long stop, TChain* intree, TTree* outtree, Container& evt, EventBlock& block,
+    const NWCalibTable& nwb, const CounterRNG& rng, ProgressBar* progress_bar,
+    const EventWriters& writers, OutputQuantizer* quantizer, EventSelection* selection
+) {
+    /* Calibrates entries [first, stop) block by block, on the calling thread */
+    for (long block_first = first; block_first < stop; block_first += EventBlock::max_n_events) {
+        long block_stop = std::min(stop, block_first + EventBlock::max_n_events);
+        read_block(block_first, block_stop, intree, evt, block, progress_bar);
+        calibrate_block(block, nwb, rng, quantizer, selection);
+        write_block(block, outtree, evt, writers);
+    }
 }
 
-double get_light_output(NWLightOutputCalibParamReader& nw_lcalib, int bar, double total_L, double total_R, const double pos_x) {
-    std::unordered_map<std::string, double> par = nw_lcalib.run_param.at(bar);
+void calibrate_multithreaded(
+    ArgumentParser& argparser, const NWCalibTable& nwb, const std::string& inroot_path,
+    const std::vector<std::pair<long, long> >& clusters, const OutputSchema& schema,
+    const OutputStorage& storage, ProgressBar& progress_bar, OutputQuantizer& quantizer,
+    EventSelection& selection
+) {
+    /* All threads share the read-only calibration table. Each thread owns its
+     * own input chain, container and in-memory output file. Clusters
+     * are handed out in input order, and each one is pushed to the merger
+     * only after all earlier clusters, so the output keeps the input order.
+     */
+    BufferMerger merger(argparser.get_outroot_path().c_str(), "RECREATE", storage.compression);
+    std::atomic<std::size_t> next_cluster = 0;
+    std::atomic<long> n_done = 0;
+    std::atomic<int> n_running = argparser.n_threads;
+    std::size_t next_to_write = 0;
+    std::mutex write_mutex;
+    std::condition_variable write_cv;
+
+    auto worker = [&]() {
+        auto evt = std::make_unique<Container>();
+        TChain* intree = get_input_tree(inroot_path, "E15190", *evt, schema);
+        auto outfile = merger.GetFile();
+        TTree* outtree = create_output_tree(argparser, outfile.get(), *evt, schema, storage);
+
+        CounterRNG rng(argparser.seed, argparser.run_num);
+        auto block = std::make_unique<EventBlock>();
+        std::size_t i_cluster;
+        while ((i_cluster = next_cluster++) < clusters.size()) {
+            calibrate_entries(
+                clusters[i_cluster].first, clusters[i_cluster].second,
+                intree, outtree, *evt, *block, nwb, rng, nullptr, {}, &quantizer, &selection
+            );
+            n_done += clusters[i_cluster].second - clusters[i_cluster].first;
 
-    // light output calibration
-    double light_GM = sqrt(total_L * total_R);
-    light_GM = (light_GM - (par.at("b") * pos_x + par.at("c") * pos_x * pos_x)) / par.at("a");
-    light_GM = 4.196 * par.at("e") * light_GM + par.at("d"); // 4.196 MeVee is the Compton edge energy AmBe 4.4 MeV transition
-    return std::max(0.0, light_GM); // light output cannot be negative
+            std::unique_lock<std::mutex> lock(write_mutex);
+            write_cv.wait(lock, [&] { return next_to_write == i_cluster; });
+            outfile->Write();
+            ++next_to_write;
+            write_cv.notify_all();
+        }
+        delete intree;
+        --n_running;
+    };
+
+    std::vector<std::thread> threads;
+    for (int i_thread = 0; i_thread < argparser.n_threads; ++i_thread) {
+        threads.emplace_back(worker);
+    }
+    while (n_running > 0) {
+        progress_bar.show(argparser.first_entry + n_done, 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
 }
 
-std::array<double, 2> get_psd(
-    NWPulseShapeDiscriminationParamReader& psd_reader,
-    int bar,
-    double total_L, double total_R,
-    double fast_L, double fast_R,
-    const double pos_x
+void calibrate_pipelined(
+    ArgumentParser& argparser, const NWCalibTable& nwb, TChain* intree, Container& in_evt,
+    TTree* outtree, Container& out_evt, ProgressBar& progress_bar, const EventWriters& writers,
+    OutputQuantizer& quantizer, EventSelection& selection
 ) {
-    /*****eliminate bad data*****/
-    if (fast_L < 0 || fast_R < 0 || total_L < 0 || total_R < 0) return {-9999.0, 0.0}; // these are invalid ADC values from original framework
-    if (fast_L > 4095 || fast_R > 4095) return {9999.0, 0.0}; // count as neutrons
-
-    /*****value assigning*****/
-    double gamma_L = psd_reader.gamma_fast_total_L[bar]->Eval(total_L);
-    double neutron_L = psd_reader.neutron_fast_total_L[bar]->Eval(total_L);
-    double vpsd_L = (fast_L - gamma_L) / (neutron_L - gamma_L);
-
-    double gamma_R = psd_reader.gamma_fast_total_R[bar]->Eval(total_R);
-    double neutron_R = psd_reader.neutron_fast_total_R[bar]->Eval(total_R);
-    double vpsd_R = (fast_R - gamma_R) / (neutron_R - gamma_R);
-
-    /*****position correction*****/
-    gamma_L = psd_reader.gamma_vpsd_L[bar]->Eval(pos_x);
-    neutron_L = psd_reader.neutron_vpsd_L[bar]->Eval(pos_x);
-    gamma_R = psd_reader.gamma_vpsd_R[bar]->Eval(pos_x);
-    neutron_R = psd_reader.neutron_vpsd_R[bar]->Eval(pos_x);
-
-    std::array<double, 2> xy = {vpsd_L - gamma_L, vpsd_R - gamma_R};
-    std::array<double, 2> gn_vec = {neutron_L - gamma_L, neutron_R - gamma_R};
-    std::array<double, 2> gn_rot90 = {-gn_vec[1], gn_vec[0]};
-
-    // project to gn_vec and gn_rot90
-    double x = (xy[0] * gn_vec[0] + xy[1] * gn_vec[1]);
-    x /= sqrt(gn_vec[0] * gn_vec[0] + gn_vec[1] * gn_vec[1]);
-    double y = (xy[0] * gn_rot90[0] + xy[1] * gn_rot90[1]);
-    y /= sqrt(gn_rot90[0] * gn_rot90[0] + gn_rot90[1] * gn_rot90[1]);
-
-    // PCA transform
-    x -= psd_reader.pca_mean[bar][0];
-    y -= psd_reader.pca_mean[bar][1];
-    auto& pca_matrix = psd_reader.pca_components[bar];
-    double pca_x = pca_matrix[0][0] * x + pca_matrix[0][1] * y;
-    double pca_y = pca_matrix[1][0] * x + pca_matrix[1][1] * y;
-
-    // normalization
-    auto& xpeaks = psd_reader.pca_xpeaks[bar];
-    double ppsd = (x - xpeaks[0]) / (xpeaks[1] - xpeaks[0]);
-    double ppsd_perp = y;
-
-    return {ppsd, ppsd_perp};
-}
+    /* Three stages connected by bounded lock-free queues of event blocks:
+     *     reader (1 thread)  --read_queue-->  compute (argparser.n_workers threads)
+     *     --done_queue-->  writer (1 thread)  --free_queue-->  reader
+     * The reader decompresses and unpacks entries, the compute workers run
+     * the calibration kernels, and the writer fills the output tree, where
+     * baskets get compressed and flushed. Blocks are recycled through
+     * free_queue, which bounds the memory in flight. Workers may finish
+     * blocks out of order; the writer restores the input order.
+     *
+     * Every stage records the time it spends working and the time it spends
+     * waiting on an empty input or a full output queue; the busy fractions
+     * are reported at the end, and the stage closest to 100% is the
+     * bottleneck.
+     */
+    using Clock = std::chrono::steady_clock;
+    struct StageStats {
+        std::atomic<long> busy_ns = 0;
+        std::atomic<long> wait_ns = 0;
+    };
 
-std::array<double, 3> randomize_position(const double pos_x) {
-    const double y_length = 3 * 2.54; // cm
-    const double z_length = 2.5 * 2.54; // cm
-    double pos_y = gRandom->Uniform(-0.5 * y_length, 0.5 * y_length);
-    double pos_z = gRandom->Uniform(-0.5 * z_length, 0.5 * z_length);
-    return {pos_x, pos_y, pos_z};
-}
+    const int n_workers = argparser.n_workers;
+    const std::size_t n_blocks_in_flight = 2 * n_workers + 4;
+    std::vector<std::unique_ptr<EventBlock> > pool;
+    BoundedQueue<EventBlock*> free_queue(n_blocks_in_flight);
+    BoundedQueue<EventBlock*> read_queue(n_blocks_in_flight);
+    BoundedQueue<EventBlock*> done_queue(n_blocks_in_flight);
+    for (std::size_t i = 0; i < n_blocks_in_flight; ++i) {
+        pool.push_back(std::make_unique<EventBlock>());
+        free_queue.try_push(pool.back().get());
+    }
 
-std::array<double, 3> get_spherical_coordinates(NWPositionCalibParamReader& nw_pcalib, int bar, const std::array<double, 3>& position) {
-    std::array<double, 3> L = {
-        nw_pcalib.get(bar, "L0"), nw_pcalib.get(bar, "L1"), nw_pcalib.get(bar, "L2")
+    const long first = argparser.first_entry;
+    const long stop = progress_bar.last_entry + 1;
+    const long n_blocks = (stop - first + EventBlock::max_n_events - 1) / EventBlock::max_n_events;
+    std::atomic<long> n_done = 0;
+    StageStats reader_stats, compute_stats, writer_stats;
+
+    // blocking wrappers: spin briefly, then back off; waiting time goes to stats
+    auto pop = [](BoundedQueue<EventBlock*>& queue, StageStats& stats) {
+        EventBlock* block;
+        auto start = Clock::now();
+        for (int n_tries = 0; !queue.try_pop(block); ++n_tries) {
+            if (n_tries < 64) std::this_thread::yield();
+            else std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        stats.wait_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        return block;
     };
-    std::array<double, 3> X = {
-        nw_pcalib.get(bar, "X0"), nw_pcalib.get(bar, "X1"), nw_pcalib.get(bar, "X2")
+    auto push = [](BoundedQueue<EventBlock*>& queue, EventBlock* block, StageStats& stats) {
+        auto start = Clock::now();
+        for (int n_tries = 0; !queue.try_push(block); ++n_tries) {
+            if (n_tries < 64) std::this_thread::yield();
+            else std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        stats.wait_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
     };
-    std::array<double, 3> Y = {
-        nw_pcalib.get(bar, "Y0"), nw_pcalib.get(bar, "Y1"), nw_pcalib.get(bar, "Y2")
+    auto busy_since = [](Clock::time_point start, StageStats& stats) {
+        stats.busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
     };
-    std::array<double, 3> Z = {
-        nw_pcalib.get(bar, "Z0"), nw_pcalib.get(bar, "Z1"), nw_pcalib.get(bar, "Z2")
+
+    auto reader = [&]() {
+        for (long i_block = 0; i_block < n_blocks; ++i_block) {
+            EventBlock* block = pop(free_queue, reader_stats);
+            auto start = Clock::now();
+            long block_first = first + i_block * EventBlock::max_n_events;
+            read_block(block_first, std::min(stop, block_first + EventBlock::max_n_events), intree, in_evt, *block);
+            busy_since(start, reader_stats);
+            push(read_queue, block, reader_stats);
+        }
+        for (int i = 0; i < n_workers; ++i) {
+            push(read_queue, nullptr, reader_stats); // one end marker per worker
+        }
     };
-    
-    double lab_x = position[0] * X[0] + position[1] * Y[0] + position[2] * Z[0] + L[0];
-    double lab_y = position[0] * X[1] + position[1] * Y[1] + position[2] * Z[1] + L[1];
-    double lab_z = position[0] * X[2] + position[1] * Y[2] + position[2] * Z[2] + L[2];
-    
-    double rho = sqrt(lab_x * lab_x + lab_y * lab_y + lab_z * lab_z);
-    double theta = acos(lab_z / rho) * TMath::RadToDeg();
-    double phi = atan2(lab_y, lab_x) * TMath::RadToDeg();
-    
-    return {rho, theta, phi};
+
+    auto worker = [&]() {
+        CounterRNG rng(argparser.seed, argparser.run_num);
+        EventBlock* block;
+        while ((block = pop(read_queue, compute_stats)) != nullptr) {
+            auto start = Clock::now();
+            calibrate_block(*block, nwb, rng, &quantizer, &selection);
+            busy_since(start, compute_stats);
+            push(done_queue, block, compute_stats);
+        }
+    };
+
+    auto writer = [&]() {
+        std::map<long, EventBlock*> pending; // finished out of order; first entry -> block
+        long next_entry = first;
+        while (next_entry < stop) {
+            EventBlock* block = pop(done_queue, writer_stats);
+            pending[block->first_entry] = block;
+            while (!pending.empty() && pending.begin()->first == next_entry) {
+                block = pending.begin()->second;
+                pending.erase(pending.begin());
+                auto start = Clock::now();
+                write_block(*block, outtree, out_evt, writers);
+                busy_since(start, writer_stats);
+                next_entry += block->n_events;
+                n_done += block->n_events;
+                push(free_queue, block, writer_stats);
+            }
+        }
+    };
+
+    auto wall_start = Clock::now();
+    std::atomic<bool> finished = false;
+    std::vector<std::thread> threads;
+    threads.emplace_back(reader);
+    for (int i = 0; i < n_workers; ++i) {
+        threads.emplace_back(worker);
+    }
+    std::thread writer_thread([&]() { writer(); finished = true; });
+
+    // progress and queue fill levels, sampled from the main thread
+    double read_queue_fill = 0.0, done_queue_fill = 0.0;
+    long n_samples = 0;
+    while (!finished) {
+        progress_bar.show(first + n_done, 1);
+        read_queue_fill += read_queue.size();
+        done_queue_fill += done_queue.size();
+        ++n_samples;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    writer_thread.join();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - wall_start).count();
+
+    progress_bar.terminate();
+    auto percent = [wall_ns](const StageStats& stats, int n_threads) { return 1e2 * stats.busy_ns / (wall_ns * n_threads); };
+    std::cout << "> pipeline occupancy (busy time / wall time):" << std::endl;
+    std::cout << Form("    reader   %6.2f%%", percent(reader_stats, 1)) << std::endl;
+    std::cout << Form("    compute  %6.2f%%  (average over %d workers)", percent(compute_stats, n_workers), n_workers) << std::endl;
+    std::cout << Form("    writer   %6.2f%%", percent(writer_stats, 1)) << std::endl;
+    if (n_samples > 0) {
+        std::cout << Form(
+            "    average queue fill: read %.1f/%lu, done %.1f/%lu",
+            read_queue_fill / n_samples, read_queue.capacity(), done_queue_fill / n_samples, done_queue.capacity()
+        ) << std::endl;
+    }
 }
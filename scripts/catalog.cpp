@@ -0,0 +1,274 @@
+/**
+  * Scans the ROOT files of the campaign in parallel and writes one index of
+  * their trees, so that batch scripts and Python tools (see
+  * e15190/utilities/root_catalog.py) read entries and sizes from it instead
+  * of opening hundreds of files. For every file, the index records:
+  *     size, mtime     of the file, to tell whether an entry is up to date;
+  *                     mtime in nanoseconds since the Unix epoch, as os.stat().st_mtime_ns
+  *     hash            content hash of the whole file, see hash_file()
+  *     tree            name of the only TTree, found from the class names of
+  *                     the keys, without reading any other object
+  *     entries         number of entries of the tree
+  *     clusters        first entry of every cluster, then the number of entries
+  *     branches        {name: [compressed bytes, uncompressed bytes]} of
+  *                     every terminal branch
+  * Files are keyed by their absolute, normalized path. Files that have not
+  * changed since the previous index (same size and mtime) are not opened
+  * again, and files that no longer exist are dropped.
+  *
+  * Usage: ./catalog.exe [-j N] [-o PATH] [DIR_OR_FILE ...]
+  *     -j      Number of threads. Default is the number of cores.
+  *     -o      Index path. Default is $PROJECT_DIR/database/root_files_catalog.json.
+  *     DIR_OR_FILE
+  *             ROOT files, or directories whose CalibratedData_XXXX.root and
+  *             run-XXXX.root files are scanned. Default is the framework files
+  *             (daniele_root_files_dir of database/local_paths.json),
+  *             database/root_files_daniele and database/root_files.
+*/
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "TBranch.h"
+#include "TError.h"
+#include "TFile.h"
+#include "TROOT.h"
+#include "TTree.h"
+
+#include "TreeIntrospection.h"
+
+using Json = nlohmann::json;
+
+std::filesystem::path get_project_dir();
+std::vector<std::filesystem::path> find_root_files(const std::filesystem::path& path);
+long get_mtime(const std::filesystem::path& path);
+std::uint64_t hash_file(const std::filesystem::path& path);
+Json scan_file(const std::filesystem::path& path);
+void add_branches(TBranch* branch, Json& branches);
+
+int main(int argc, char* argv[]) {
+    gErrorIgnoreLevel = kError;
+    std::filesystem::path project_dir = get_project_dir();
+    std::filesystem::path index_path = project_dir / "database/root_files_catalog.json";
+    int n_threads = std::max(1U, std::thread::hardware_concurrency());
+
+    int opt;
+    while ((opt = getopt(argc, argv, "hj:o:")) != -1) {
+        switch (opt) {
+            case 'j':
+                n_threads = std::stoi(optarg);
+                break;
+            case 'o':
+                index_path = optarg;
+                break;
+            default:
+                std::cerr << "Usage: ./catalog.exe [-j N] [-o PATH] [DIR_OR_FILE ...]" << std::endl;
+                exit(opt == 'h' ? 0 : 1);
+        }
+    }
+    if (n_threads < 1) {
+        std::cerr << "Option -j must be at least 1" << std::endl;
+        exit(1);
+    }
+
+    std::vector<std::filesystem::path> inputs(argv + optind, argv + argc);
+    if (inputs.empty()) {
+        std::ifstream local_paths_file(project_dir / "database/local_paths.json");
+        Json local_paths = Json::parse(local_paths_file, nullptr, false);
+        if (local_paths.is_object() && local_paths.contains("daniele_root_files_dir")) {
+            inputs.push_back(local_paths["daniele_root_files_dir"].get<std::string>());
+        }
+        inputs.push_back(project_dir / "database/root_files_daniele");
+        inputs.push_back(project_dir / "database/root_files");
+    }
+    std::vector<std::filesystem::path> paths;
+    for (auto& input : inputs) {
+        // keys of the index are absolute, whatever the working directory of the reader
+        auto found = find_root_files(std::filesystem::absolute(input).lexically_normal());
+        paths.insert(paths.end(), found.begin(), found.end());
+    }
+
+    // entries of the previous index are kept when their file has not changed
+    Json index = {{"hash", "fnv1a64-words"}, {"files", Json::object()}};
+    if (std::filesystem::exists(index_path)) {
+        std::ifstream index_file(index_path);
+        Json previous = Json::parse(index_file, nullptr, false);
+        if (previous.is_object() && previous.value("hash", "") == index["hash"]) {
+            index["files"] = previous["files"];
+        }
+    }
+    for (auto it = index["files"].begin(); it != index["files"].end(); ) {
+        bool is_valid = std::filesystem::path(it.key()).is_absolute() && std::filesystem::exists(it.key());
+        it = is_valid ? std::next(it) : index["files"].erase(it);
+    }
+    std::vector<std::filesystem::path> stale_paths;
+    for (auto& path : paths) {
+        auto& files = index["files"];
+        std::string key = path.string();
+        bool up_to_date = files.contains(key)
+            && files[key]["size"] == std::filesystem::file_size(path)
+            && files[key]["mtime"] == get_mtime(path);
+        if (!up_to_date) stale_paths.push_back(path);
+    }
+
+    ROOT::EnableThreadSafety();
+    std::atomic<std::size_t> next_path = 0;
+    std::mutex index_mutex;
+    auto worker = [&]() {
+        std::size_t i;
+        while ((i = next_path++) < stale_paths.size()) {
+            Json entry = scan_file(stale_paths[i]);
+            std::lock_guard<std::mutex> lock(index_mutex);
+            if (entry.is_null()) {
+                index["files"].erase(stale_paths[i].string());
+                continue;
+            }
+            index["files"][stale_paths[i].string()] = entry;
+            std::cout << Form(
+                "%s: %s, %ld entries", stale_paths[i].string().c_str(),
+                entry["tree"].get<std::string>().c_str(), entry["entries"].get<long>()
+            ) << std::endl;
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i_thread = 0; i_thread < n_threads; ++i_thread) {
+        threads.emplace_back(worker);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // written next to the index first, so that readers never see a partial file
+    std::filesystem::path tmp_path = index_path.string() + ".tmp";
+    std::ofstream index_file(tmp_path);
+    index_file << index.dump() << std::endl;
+    index_file.close();
+    std::filesystem::rename(tmp_path, index_path);
+    std::cout << Form(
+        "%lu files indexed (%lu scanned) in %s", index["files"].size(), stale_paths.size(), index_path.string().c_str()
+    ) << std::endl;
+    return 0;
+}
+
+std::filesystem::path get_project_dir() {
+    const char* project_dir = std::getenv("PROJECT_DIR");
+    if (project_dir == nullptr) {
+        std::cerr << "Environment variable $PROJECT_DIR is not defined in current session" << std::endl;
+        exit(1);
+    }
+    return std::filesystem::path(project_dir);
+}
+
+std::vector<std::filesystem::path> find_root_files(const std::filesystem::path& path) {
+    /* path itself if it is a file; otherwise its run files, sorted */
+    if (std::filesystem::is_regular_file(path)) return {path};
+    if (!std::filesystem::is_directory(path)) {
+        std::cerr << "WARNING: " << path.string() << " not found" << std::endl;
+        return {};
+    }
+    const std::regex run_file_regex(R"((CalibratedData_|run-)\d{4}\.root)");
+    std::vector<std::filesystem::path> paths;
+    for (auto& entry : std::filesystem::directory_iterator(path)) {
+        if (entry.is_regular_file() && std::regex_match(entry.path().filename().string(), run_file_regex)) {
+            paths.push_back(entry.path());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+long get_mtime(const std::filesystem::path& path) {
+    /* Unix time in nanoseconds; the epoch of std::filesystem::file_time_type is implementation-defined */
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return -1;
+    }
+    return st.st_mtim.tv_sec * 1000000000L + st.st_mtim.tv_nsec;
+}
+
+std::uint64_t hash_file(const std::filesystem::path& path) {
+    /* FNV-1a over 8-byte words instead of bytes, so that hashing keeps up
+     * with the disk; the last incomplete word is padded with zeros. Unlike
+     * NWCalibSnapshot::hash_files(), the path is not hashed, so that copies
+     * of a file have the same hash.
+     */
+    std::uint64_t hash = 0xcbf29ce484222325UL;
+    std::ifstream file(path, std::ios::binary);
+    std::vector<std::uint64_t> buffer(1 << 19); // 4 MB
+    char* data = reinterpret_cast<char*>(buffer.data());
+    while (file.read(data, buffer.size() * sizeof(std::uint64_t)) || file.gcount() > 0) {
+        std::size_t n_bytes = file.gcount();
+        std::size_t n_words = (n_bytes + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t);
+        std::memset(data + n_bytes, 0, n_words * sizeof(std::uint64_t) - n_bytes);
+        for (std::size_t i = 0; i < n_words; ++i) {
+            hash = (hash ^ buffer[i]) * 0x100000001b3UL;
+        }
+    }
+    return hash;
+}
+
+Json scan_file(const std::filesystem::path& path) {
+    /* Index entry of one file; null if it cannot be read or has no single tree */
+    std::unique_ptr<TFile> file(TFile::Open(path.string().c_str(), "READ"));
+    if (file == nullptr || file->IsZombie()) {
+        std::cerr << "WARNING: cannot open " << path.string() << std::endl;
+        return nullptr;
+    }
+    auto tree_names = TreeIntrospection::find_tree_names(file.get());
+    if (tree_names.size() != 1) {
+        std::cerr << Form("WARNING: found %lu trees in %s", tree_names.size(), path.string().c_str()) << std::endl;
+        return nullptr;
+    }
+    TTree* tree = file->Get<TTree>(tree_names[0].c_str());
+
+    Json entry;
+    entry["size"] = std::filesystem::file_size(path);
+    entry["mtime"] = get_mtime(path);
+    entry["tree"] = tree_names[0];
+    entry["entries"] = tree->GetEntries();
+
+    std::vector<long> clusters;
+    auto cluster_iter = tree->GetClusterIterator(0);
+    long start;
+    while ((start = cluster_iter()) < tree->GetEntries()) {
+        clusters.push_back(start);
+    }
+    clusters.push_back(tree->GetEntries());
+    entry["clusters"] = clusters;
+
+    entry["branches"] = Json::object();
+    auto branches = tree->GetListOfBranches();
+    for (int i = 0; i < branches->GetEntries(); ++i) {
+        add_branches(static_cast<TBranch*>(branches->At(i)), entry["branches"]);
+    }
+    file->Close();
+
+    entry["hash"] = Form("%016lx", hash_file(path));
+    return entry;
+}
+
+void add_branches(TBranch* branch, Json& branches) {
+    auto sub_branches = branch->GetListOfBranches();
+    if (sub_branches->GetEntries() == 0) {
+        branches[branch->GetName()] = {branch->GetZipBytes(), branch->GetTotBytes()};
+        return;
+    }
+    for (int i = 0; i < sub_branches->GetEntries(); ++i) {
+        add_branches(static_cast<TBranch*>(sub_branches->At(i)), branches);
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "EventWriter.h"
+
+class ArrowWriter : public EventWriter {
+    /* Writes events to an Arrow IPC file (Feather v2), which pandas, polars
+     * and duckdb can memory-map without any conversion. Scalars become
+     * primitive columns and arrays become list columns. Rows are buffered by
+     * Arrow builders and written as one record batch every batch_size events.
+     *
+     * Arrow is optional: it is only linked when building with
+     * `make calibrate ARROW=1`, which defines WITH_ARROW. Otherwise the
+     * constructor reports that the feature is missing and exits.
+     */
+public:
+    ArrowWriter(
+        const std::string& path, const std::vector<Column>& columns,
+        const std::vector<std::pair<std::string, std::string> >& metadata, long batch_size = 65536
+    );
+    ~ArrowWriter();
+
+    void fill(const void* event) override;
+    void close() override; // writes the buffered rows and the file footer
+
+private:
+    struct Impl; // Arrow objects; kept out of this header so that users need no Arrow headers
+    std::unique_ptr<Impl> impl;
+};
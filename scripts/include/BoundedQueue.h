@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+template <typename T>
+class BoundedQueue {
+    /* Bounded multi-producer multi-consumer lock-free queue, after Dmitry
+     * Vyukov's array-based algorithm. Every cell carries a sequence number
+     * that tells producers and consumers whether it is free or filled for
+     * their turn, so each operation is a single compare-and-swap on the
+     * enqueue or dequeue position. try_push() and try_pop() never block;
+     * they return false when the queue is full or empty.
+     */
+public:
+    BoundedQueue(std::size_t capacity) {
+        std::size_t n = 2;
+        while (n < capacity) n *= 2;
+        this->mask = n - 1;
+        this->cells = std::make_unique<Cell[]>(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            this->cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    std::size_t capacity() const { return this->mask + 1; }
+
+    bool try_push(const T& value) {
+        std::size_t pos = this->enqueue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = this->cells[pos & this->mask];
+            std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+            long diff = long(seq) - long(pos);
+            if (diff == 0) {
+                if (this->enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0) {
+                return false; // full
+            }
+            else {
+                pos = this->enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T& value) {
+        std::size_t pos = this->dequeue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = this->cells[pos & this->mask];
+            std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+            long diff = long(seq) - long(pos + 1);
+            if (diff == 0) {
+                if (this->dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = cell.value;
+                    cell.sequence.store(pos + this->mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0) {
+                return false; // empty
+            }
+            else {
+                pos = this->dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // number of queued elements; only a snapshot while other threads are active
+    std::size_t size() const {
+        std::size_t head = this->dequeue_pos.load(std::memory_order_relaxed);
+        std::size_t tail = this->enqueue_pos.load(std::memory_order_relaxed);
+        return (tail > head) ? tail - head : 0;
+    }
+
+private:
+    struct alignas(64) Cell {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    std::size_t mask;
+    alignas(64) std::atomic<std::size_t> enqueue_pos = 0;
+    alignas(64) std::atomic<std::size_t> dequeue_pos = 0;
+};
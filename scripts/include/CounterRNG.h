@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+class CounterRNG {
+    /* Counter-based random numbers, Philox4x32-10 (Salmon et al., SC'11).
+     * Every number is a pure function of (seed, run, entry, hit, purpose),
+     * so results do not depend on the order in which entries are processed,
+     * nor on how they are split among threads or blocks. The seed is the
+     * Philox key; the counter holds the entry number, the hit index, and the
+     * run number together with the purpose.
+     *
+     * Each call runs one Philox block and keeps 53 of its 128 bits, which
+     * gives a double uniform in [0, 1).
+     */
+public:
+    enum Purpose : std::uint32_t {
+        kPositionY = 0, // position within the bar
+        kPositionZ,
+        kTotalL, // ADC dithering
+        kTotalR,
+        kFastL,
+        kFastR,
+    };
+
+    std::uint64_t seed;
+    int run;
+
+    CounterRNG(std::uint64_t seed, int run) : seed(seed), run(run) { }
+
+    static std::array<std::uint32_t, 4> philox4x32(
+        std::array<std::uint32_t, 4> ctr, std::array<std::uint32_t, 2> key
+    ) {
+        constexpr std::uint64_t M0 = 0xD2511F53;
+        constexpr std::uint64_t M1 = 0xCD9E8D57;
+        constexpr std::uint32_t W0 = 0x9E3779B9;
+        constexpr std::uint32_t W1 = 0xBB67AE85;
+        for (int round = 0; round < 10; ++round) {
+            std::uint64_t p0 = M0 * ctr[0];
+            std::uint64_t p1 = M1 * ctr[2];
+            ctr = {
+                std::uint32_t(p1 >> 32) ^ ctr[1] ^ key[0],
+                std::uint32_t(p1),
+                std::uint32_t(p0 >> 32) ^ ctr[3] ^ key[1],
+                std::uint32_t(p0),
+            };
+            key[0] += W0;
+            key[1] += W1;
+        }
+        return ctr;
+    }
+
+    double uniform(long entry, int hit, Purpose purpose) const {
+        auto x = philox4x32(
+            {
+                std::uint32_t(entry),
+                std::uint32_t(std::uint64_t(entry) >> 32),
+                std::uint32_t(hit),
+                (std::uint32_t(this->run) << 8) | purpose,
+            },
+            {std::uint32_t(this->seed), std::uint32_t(this->seed >> 32)}
+        );
+        std::uint64_t bits = ((std::uint64_t(x[0]) << 32) | x[1]) >> 11;
+        return bits * 0x1.0p-53;
+    }
+
+    double uniform(long entry, int hit, Purpose purpose, double low, double high) const {
+        return low + (high - low) * this->uniform(entry, hit, purpose);
+    }
+
+    // bulk version for the block kernels; out[i] = uniform(entry[i], hit[i], purpose)
+    void fill_uniform(
+        Purpose purpose, std::size_t n,
+        const long* __restrict__ entry, const int* __restrict__ hit, double* __restrict__ out
+    ) const {
+        for (std::size_t i = 0; i < n; ++i) {
+            out[i] = this->uniform(entry[i], hit[i], purpose);
+        }
+    }
+};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+class EventWriter {
+    /* An extra output of calibrate.exe, such as an Arrow or SQLite file. It
+     * receives every calibrated event, in input order, from the thread that
+     * fills the output tree. Events are plain structs, e.g. Container,
+     * described by a list of columns: every column is a field at a fixed byte
+     * offset in the struct. Arrays are sized by an int counter field of the
+     * same struct, e.g. NWB_bar by NWB_multi.
+     */
+public:
+    struct Column {
+        std::string name;
+        char type; // ROOT leaf type: 'D', 'F', 'L', 'I' or 'S'
+        std::ptrdiff_t offset; // of the field, or of the first array element
+        std::ptrdiff_t counter_offset = -1; // of the int counter of an array; negative for scalars
+    };
+
+    virtual ~EventWriter() { }
+    virtual void fill(const void* event) = 0;
+    virtual void close() = 0; // flushes everything; further calls do nothing
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "TDirectory.h"
+
+#include "EventWriter.h"
+#include "OutputStorage.h"
+
+class HitTableWriter : public EventWriter {
+    /* Flat tree of hits, with one entry per array element of the events, e.g.
+     * one entry per NWB hit. Every entry holds the number of its event in the
+     * input ("entry"), its index within that event ("hit"), the hit columns,
+     * and the event columns repeated on every hit of the event (e.g. MB_multi
+     * for the usual cuts), so that per-hit analyses need no exploding.
+     *
+     * Rows are grouped by the value of cluster_column (e.g. NWB_bar), in input
+     * order, until write() fills the tree group by group. At most
+     * max_buffer_bytes of rows are held in memory (about 130 bytes per NWB
+     * hit); beyond that, every group is appended to a temporary file of its
+     * own, which write() reads back before the rows still in memory.
+     * Every group is flushed as a cluster of its own, so that reading the hits
+     * of one bar touches one contiguous range of baskets. The entry range of
+     * every group is recorded in the user info of the tree, as
+     * TNamed("<value>", "<first entry> <last entry + 1>").
+     */
+public:
+    HitTableWriter(
+        const std::string& tree_name, const std::vector<Column>& event_columns,
+        const std::vector<Column>& hit_columns, std::ptrdiff_t entry_offset,
+        const std::string& cluster_column, std::size_t max_buffer_bytes = 64 << 20
+    );
+
+    void fill(const void* event) override;
+    void close() override { } // rows are kept for write()
+
+    // writes the tree to directory with the compression of storage and frees the rows
+    void write(TDirectory* directory, const OutputStorage& storage);
+
+private:
+    std::string tree_name;
+    std::vector<Column> event_columns;
+    std::vector<Column> hit_columns;
+    std::ptrdiff_t entry_offset;
+    std::ptrdiff_t counter_offset;
+    std::size_t cluster_index; // in hit_columns
+
+    // row layout: entry (long), hit (int), every event column, then every hit column
+    std::vector<std::size_t> event_offsets;
+    std::vector<std::size_t> hit_offsets;
+    std::size_t row_size;
+    std::map<int, std::vector<char> > groups; // value of cluster_column -> rows
+    std::size_t max_buffer_bytes;
+    std::size_t buffered_bytes = 0; // of all groups
+
+    struct FileCloser {
+        void operator()(std::FILE* file) const { std::fclose(file); }
+    };
+    std::map<int, std::unique_ptr<std::FILE, FileCloser> > spills; // value of cluster_column -> rows on disk
+
+    void spill();
+    static std::size_t get_size(char type);
+};
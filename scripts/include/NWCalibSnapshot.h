@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "TFolder.h"
+
+#include "NWCalibration.h"
+
+class NWCalibSnapshot {
+    /* Binary snapshot of a compiled NWCalibTable for one run, together with
+     * the metadata written by NWCalibParamReaders::write_metadata(). The file
+     * is mapped into memory and copied into a fresh table without any
+     * parsing. It stores a hash of all source files of the readers and of
+     * the way the table is built from them (see get_builder_key()), and is
+     * only used while that hash still matches.
+     *
+     * Layout, in native byte order:
+     *     Header
+     *     NWBarCalibParams[n_bars + 1]           (table pointers zeroed)
+     *     Table[(n_bars + 1) * n_psd_tables]     (bar-major)
+     *     std::array<double, 4>[n_coeffs]        (cells of all tables)
+     *     metadata                               (NUL-terminated folder, name, title triplets)
+     */
+public:
+    static constexpr char magic[8] = "NWCALIB";
+    static constexpr std::uint32_t version = 2;
+    // bump whenever the table or its metadata change for the same source files
+    static constexpr std::uint32_t builder_version = 2;
+
+    struct Header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t bar_size; // sizeof(NWBarCalibParams), guards against layout changes
+        std::uint64_t source_hash;
+        std::int32_t run;
+        char AB;
+        char padding[3];
+        std::uint64_t bars_offset;
+        std::uint64_t tables_offset;
+        std::uint64_t coeffs_offset;
+        std::uint64_t n_coeffs;
+        std::uint64_t metadata_offset;
+        std::uint64_t metadata_size;
+        std::uint64_t file_size;
+    };
+
+    struct Table {
+        double x_min;
+        double x_max;
+        double inv_h;
+        double max_error;
+        std::int64_t n_cells;
+        std::uint64_t first_coeff;
+    };
+
+    std::filesystem::path path;
+
+    NWCalibSnapshot(const std::filesystem::path& path);
+    ~NWCalibSnapshot();
+
+    bool is_valid(std::uint64_t source_hash, char AB, int run) const;
+    std::unique_ptr<NWCalibTable> make_table() const;
+    void write_metadata(TFolder* folder) const;
+
+    static void write(
+        const std::filesystem::path& path, const NWCalibTable& table,
+        TFolder* metadata, std::uint64_t source_hash
+    );
+    static std::uint64_t hash_files(const std::vector<std::filesystem::path>& paths, const std::string& salt = "");
+    static std::string get_builder_key();
+
+private:
+    const char* data = nullptr; // mapped file
+    std::size_t size = 0;
+    const Header& header() const { return *reinterpret_cast<const Header*>(this->data); }
+};
+
+class NWCalibSnapshotCache {
+    /* Directory of snapshots, one file per wall and run. get_table() returns
+     * the table of a run from its snapshot when that is up to date, and
+     * otherwise loads the run with the readers and (re)writes the snapshot.
+     * Either way, the readers' provenance ends up in the metadata folder.
+     */
+public:
+    std::filesystem::path dir;
+    std::uint64_t source_hash; // of the readers' source files and the builder key, when the cache was created
+
+    NWCalibSnapshotCache(const std::filesystem::path& dir, NWCalibParamReaders& readers);
+    ~NWCalibSnapshotCache();
+
+    std::filesystem::path get_path(char AB, int run) const;
+    std::unique_ptr<NWCalibTable> get_table(NWCalibParamReaders& readers, int run, TFolder* metadata);
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <array>
+#include <filesystem>
+#include <vector>
+
+#include "TFolder.h"
+
+#include "CounterRNG.h"
+#include "ParamReader.h"
+#include "UniformGridTable.h"
+
+// all parameter readers needed to calibrate one neutron wall
+struct NWCalibParamReaders {
+    NWPositionCalibParamReader pcalib;
+    NWTimeOfFlightCalibParamReader tcalib;
+    NWADCPreprocessorParamReader acalib;
+    NWLightOutputCalibParamReader lcalib;
+    NWPulseShapeDiscriminationParamReader psd_reader;
+    int run = 0; // the last loaded run
+
+    NWCalibParamReaders(const char AB);
+    NWCalibParamReaders(const char AB, int run);
+
+    // databases are parsed on the first load only; later loads re-select the per-run parameters
+    void load(int run);
+    void write_metadata(TFolder* metadata);
+    std::vector<std::filesystem::path> get_source_paths(); // every file the readers parse
+};
+
+// all calibration parameters of one bar for one run, flattened for the per-hit path
+struct alignas(64) NWBarCalibParams {
+    // position: pos_x = pos_p0 + pos_p1 * (time_L - time_R)
+    double pos_p0;
+    double pos_p1;
+
+    // bar frame to lab frame: lab = L + x * X + y * Y + z * Z
+    std::array<double, 3> L;
+    std::array<double, 3> X;
+    std::array<double, 3> Y;
+    std::array<double, 3> Z;
+
+    // time-of-flight
+    double tof_offset;
+
+    // ADC pre-processing; index 0 is left, index 1 is right
+    std::array<double, 2> nonlinear_fast_threshold;
+    std::array<double, 2> stationary_point_x;
+    std::array<double, 2> stationary_point_y;
+    std::array<std::array<double, 3>, 2> fast_total_fit; // fit_params[0..2]
+    double two_over_attenuation_length;
+    double log_gain_ratio;
+
+    // light output
+    double light_a;
+    double light_b;
+    double light_c;
+    double light_d;
+    double light_e;
+
+    // pulse shape discrimination; point into NWCalibTable::psd_tables, which owns the lookup tables
+    const UniformGridTable* gamma_fast_total_L;
+    const UniformGridTable* neutron_fast_total_L;
+    const UniformGridTable* gamma_fast_total_R;
+    const UniformGridTable* neutron_fast_total_R;
+    const UniformGridTable* gamma_vpsd_L;
+    const UniformGridTable* neutron_vpsd_L;
+    const UniformGridTable* gamma_vpsd_R;
+    const UniformGridTable* neutron_vpsd_R;
+    std::array<double, 2> pca_mean;
+    std::array<std::array<double, 2>, 2> pca_components;
+    std::array<double, 2> pca_xpeaks;
+};
+
+class NWCalibTable {
+    /* Parameters of every bar, frozen after all readers have loaded a run.
+     * Indexed directly by bar number, so a hit costs no string or map lookup.
+     * The table is read-only, hence can be shared by threads. It keeps its
+     * own copy of the PSD lookup tables, so it does not depend on the readers
+     * once built; it cannot be copied, since the bars point into that copy.
+     */
+public:
+    static constexpr int n_bars = 24;
+    static constexpr int n_psd_tables = 8; // in the order of the pointers in NWBarCalibParams
+    char AB;
+    int run = 0;
+    std::array<NWBarCalibParams, n_bars + 1> bars; // bar 0 is unused
+    std::array<std::array<UniformGridTable, n_psd_tables>, n_bars + 1> psd_tables;
+
+    NWCalibTable();
+    NWCalibTable(NWCalibParamReaders& readers);
+    NWCalibTable(const NWCalibTable&) = delete;
+    NWCalibTable& operator=(const NWCalibTable&) = delete;
+    ~NWCalibTable();
+
+    // point the PSD table pointers of every bar to psd_tables
+    void link_psd_tables();
+
+    // unchecked; bar must be in [1, n_bars], as NWHitBlock::push_back() ensures
+    const NWBarCalibParams& operator[](int bar) const { return this->bars[bar]; }
+};
+
+// per-hit calibration functions
+double get_position(const NWBarCalibParams& par, double time_L, double time_R);
+double get_time_of_flight(const NWBarCalibParams& par, double time_L, double time_R, double fa_time);
+std::array<double, 4> get_corrected_adc(
+    const NWBarCalibParams& par, const CounterRNG& rng, long entry, int hit,
+    short total_L, short total_R, short fast_L, short fast_R, const double pos_x
+);
+double get_light_output(const NWBarCalibParams& par, double total_L, double total_R, const double pos_x);
+std::array<double, 2> get_psd(
+    const NWBarCalibParams& par,
+    double total_L, double total_R, double fast_L, double fast_R, const double pos_x
+);
+std::array<double, 3> randomize_position(const CounterRNG& rng, long entry, int hit, const double pos_x);
+double randomize_adc(const CounterRNG& rng, long entry, int hit, CounterRNG::Purpose purpose, short raw);
+std::array<double, 3> get_spherical_coordinates(const NWBarCalibParams& par, const std::array<double, 3>& position);
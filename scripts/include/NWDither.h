@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ROOT/RVec.hxx"
+
+#include "CounterRNG.h"
+
+namespace nw_dither {
+    /* Regenerates the branches that `calibrate.exe --regen-dither` does not
+     * write (see OutputSchema::regenerable_branches), bit for bit, from the
+     * seed and run in the metadata of the output file, the input entry
+     * number "entry", and the raw ADC values. The arithmetic is the same as
+     * in NWHitBlock::randomize(); the results are rounded to float like the
+     * branches were. Meant for RDataFrame, e.g. from Python:
+     *     ROOT.gInterpreter.Declare('#include "NWDither.h"')
+     *     rdf = rdf.Define("NWB_fastf_L", "nw_dither::fastf_L(4242ULL, 4083, entry, NWB_fast_L)")
+     * See also e15190/neutron_wall/dither.py, which does the same with numpy.
+     */
+
+    inline ROOT::RVecF uniform(
+        std::uint64_t seed, int run, long entry, std::size_t n_hits,
+        CounterRNG::Purpose purpose, double low, double high
+    ) {
+        CounterRNG rng(seed, run);
+        ROOT::RVecF result(n_hits);
+        for (std::size_t i = 0; i < n_hits; ++i) {
+            result[i] = low + (high - low) * rng.uniform(entry, i, purpose);
+        }
+        return result;
+    }
+
+    inline ROOT::RVecF dither(
+        std::uint64_t seed, int run, long entry,
+        const ROOT::RVec<short>& raw, CounterRNG::Purpose purpose
+    ) {
+        CounterRNG rng(seed, run);
+        ROOT::RVecF result(raw.size());
+        for (std::size_t i = 0; i < raw.size(); ++i) {
+            double u = rng.uniform(entry, i, purpose);
+            result[i] = (raw[i] < 0) ? double(raw[i])
+                : (raw[i] == 0) ? raw[i] + 0.5 * u
+                : (raw[i] < 4096) ? raw[i] + (-0.5 + u)
+                : double(raw[i]);
+        }
+        return result;
+    }
+
+    // same ranges as randomize_position()
+    inline ROOT::RVecF pos_y(std::uint64_t seed, int run, long entry, int n_hits) {
+        const double y_length = 3 * 2.54; // cm
+        return uniform(seed, run, entry, n_hits, CounterRNG::kPositionY, -0.5 * y_length, 0.5 * y_length);
+    }
+
+    inline ROOT::RVecF pos_z(std::uint64_t seed, int run, long entry, int n_hits) {
+        const double z_length = 2.5 * 2.54; // cm
+        return uniform(seed, run, entry, n_hits, CounterRNG::kPositionZ, -0.5 * z_length, 0.5 * z_length);
+    }
+
+    inline ROOT::RVecF fastf_L(std::uint64_t seed, int run, long entry, const ROOT::RVec<short>& fast_L) {
+        return dither(seed, run, entry, fast_L, CounterRNG::kFastL);
+    }
+
+    inline ROOT::RVecF fastf_R(std::uint64_t seed, int run, long entry, const ROOT::RVec<short>& fast_R) {
+        return dither(seed, run, entry, fast_R, CounterRNG::kFastR);
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "CounterRNG.h"
+#include "NWCalibration.h"
+
+class NWHitBlock {
+    /* Structure-of-arrays buffers holding the NWB hits of a block of events.
+     * Hits are appended one at a time with push_back(), then calibrate() runs
+     * every calibration stage as a plain loop over the whole block, written
+     * so that the compiler can vectorize it. The results are identical to
+     * those of the per-hit functions in NWCalibration.h.
+     *
+     * Random numbers are keyed by the entry number and the hit index of each
+     * hit (see CounterRNG.h), and are drawn in bulk by the first stage.
+     */
+public:
+    enum Status : short {
+        /* Bits of the per-hit status (branch NWB_status); zero means a clean
+         * hit. They replace the tests of downstream cuts against the
+         * -9999/9999 sentinels, e.g. all raw ADCs positive is
+         * (status & (kInvalidADC | kZeroADC)) == 0.
+         */
+        kInvalidADC = 1 << 0, // a raw ADC is negative, e.g. -9999 from the original framework
+        kZeroADC = 1 << 1, // a raw ADC is zero
+        kSaturatedTotal = 1 << 2, // total_L or total_R at 4096 or above; left as is by the dithering
+        kPsdOverflow = 1 << 3, // fastf_L or fastf_R above 4095; psd is 9999 (counted as neutron)
+        kPsdInvalid = 1 << 4, // a corrected ADC is negative; psd is -9999
+        kOutsideBar = 1 << 5, // pos_x outside the bar, i.e. outside (-bar_half_length, bar_half_length)
+        kInvalidTime = 1 << 6, // time_L or time_R below -9000, e.g. -9999
+        kInvalidBar = 1 << 7, // bar outside 1-24; not calibrated, every output is -9999
+    };
+    static constexpr double bar_half_length = 90.0; // cm; Bar.edges_x of e15190/neutron_wall/geometry.py
+
+    std::size_t n_hits = 0;
+
+    // inputs
+    std::vector<long> entry;
+    std::vector<int> hit; // index within the entry
+    std::vector<int> bar; // 1 in place of an invalid bar, so that the stages can index the table
+    std::vector<double> time_L;
+    std::vector<double> time_R;
+    std::vector<double> fa_time;
+    std::vector<short> total_L;
+    std::vector<short> total_R;
+    std::vector<short> fast_L;
+    std::vector<short> fast_R;
+    std::vector<std::size_t> invalid_bar_hits; // hits whose bar is not in the table
+
+    // random numbers and the quantities derived from them
+    std::vector<double> rand_pos_y; // position within the bar
+    std::vector<double> rand_pos_z;
+    std::vector<double> dithered_total_L; // ADC with uniform dithering
+    std::vector<double> dithered_total_R;
+    std::vector<double> dithered_fast_L;
+    std::vector<double> dithered_fast_R;
+
+    // outputs; same types as the output branches, since later stages read them back
+    std::vector<float> pos_x;
+    std::vector<float> pos_y;
+    std::vector<float> pos_z;
+    std::vector<float> distance;
+    std::vector<float> theta;
+    std::vector<float> phi;
+    std::vector<float> distance_c;
+    std::vector<float> theta_c;
+    std::vector<float> phi_c;
+    std::vector<float> tof;
+    std::vector<float> totalf_L;
+    std::vector<float> totalf_R;
+    std::vector<float> fastf_L;
+    std::vector<float> fastf_R;
+    std::vector<float> light_GM;
+    std::vector<float> psd;
+    std::vector<float> psd_perp;
+    std::vector<short> status; // bits of Status
+
+    NWHitBlock(std::size_t capacity=8192);
+    ~NWHitBlock();
+
+    void clear();
+    void push_back(
+        long entry, int hit, int bar, double time_L, double time_R, double fa_time,
+        short total_L, short total_R, short fast_L, short fast_R
+    );
+    void calibrate(const NWCalibTable& table, const CounterRNG& rng);
+
+    // individual stages, in the order calibrate() runs them
+    void randomize(const CounterRNG& rng);
+    void calibrate_position(const NWCalibTable& table);
+    void calibrate_spherical_coordinates(const NWCalibTable& table);
+    void calibrate_time_of_flight(const NWCalibTable& table);
+    void calibrate_adc(const NWCalibTable& table);
+    void calibrate_light_output(const NWCalibTable& table);
+    void calibrate_psd(const NWCalibTable& table);
+    void calibrate_status();
+    void mask_invalid_bars();
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "TFile.h"
+#include "TFolder.h"
+#include "TTree.h"
+
+class OutputStorage {
+    /* Compression and basket layout of the calibrated output. Branches are
+     * matched against groups of shell-style patterns (e.g. "NWB_*_L"); when
+     * several groups match, the last one wins. A group sets the compression
+     * algorithm and level and the basket size of its branches; the cluster
+     * size (auto-flush) applies to the whole tree, since ROOT clusters span
+     * all branches.
+     *
+     * The defaults are tuned for e15190/neutron_wall/spectra.py: branches read
+     * by its RDataFrame cuts and definitions are compressed with LZ4, which
+     * decompresses several times faster than ZSTD, and everything else with
+     * ZSTD, which is smaller. Clusters are kept small enough that implicit
+     * multithreading in RDataFrame, which processes one cluster per task,
+     * has enough tasks for a typical run.
+     *
+     * A JSON file replaces the defaults:
+     *     {
+     *         "compression": "zstd:5",      // file default; also used for unmatched branches
+     *         "auto_flush": 20000,          // entries per cluster; negative means bytes, as in TTree::SetAutoFlush
+     *         "groups": [
+     *             {"branches": ["NWB_*"], "compression": "lz4:4", "basket_size": 64000},
+     *             ...
+     *         ],
+     *         "quantization": [             // optional; none by default
+     *             {"branches": ["NWB_tof"], "min": -50, "max": 250, "bits": 16},
+     *             ...
+     *         ]
+     *     }
+     * Compression is written as "algorithm:level", with algorithm one of zlib,
+     * lzma, lz4 or zstd, or as "none".
+     *
+     * Quantization trades precision of float branches for size: values within
+     * [min, max] are rounded to a grid of at most 2^bits points, whose step
+     * is rounded up to a power of two, so that the rounded floats end in
+     * zero bits, which the compression then removes. The error is at most
+     * half a step. Values outside [min, max], e.g. the -9999 and 9999
+     * sentinels, are written unchanged. Branches are still written as floats,
+     * so readers need no change. Only float (leaf type 'F') branches are
+     * quantized; when several rules match, the last one wins.
+     */
+public:
+    struct Group {
+        std::vector<std::string> branches; // patterns
+        int compression = -1; // ROOT compression settings, 100 * algorithm + level; negative means unchanged
+        int basket_size = -1; // bytes; negative means unchanged
+    };
+
+    struct Quantization {
+        std::vector<std::string> branches; // patterns
+        double min;
+        double max;
+        int bits;
+        double step; // power of two
+
+        float apply(float value) const {
+            if (!(value >= this->min && value <= this->max)) return value; // also keeps NaN
+            return float(std::nearbyint(value / this->step) * this->step);
+        }
+    };
+
+    std::string path; // configuration file; empty for the defaults
+    int compression;
+    long auto_flush;
+    std::vector<Group> groups;
+    std::vector<Quantization> quantizations;
+
+    OutputStorage();
+    OutputStorage(const std::string& path);
+    ~OutputStorage();
+
+    void apply(TFile* file) const;
+    void apply(TTree* tree) const;
+    void write_metadata(TFolder* metadata) const;
+
+    static int parse_compression(const std::string& spec);
+    static std::string format_compression(int settings);
+    static Quantization make_quantization(const std::vector<std::string>& branches, double min, double max, int bits);
+};
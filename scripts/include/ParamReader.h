@@ -15,6 +15,9 @@
 #include "TTree.h"
 #include "TTreeReader.h"
 
+#include "RunRangeIndex.h"
+#include "UniformGridTable.h"
+
 using Json = nlohmann::json;
 
 template <typename index_t>
@@ -38,7 +41,10 @@ public:
 class NWPositionCalibParamReader {
 private:
     std::map<std::pair<int, std::string>, double> param; // (bar, par) -> value
+    Json database; // all bars and runs; parsed on the first load()
+    RunRangeIndex index; // (bar, run) -> record of database
     std::filesystem::path resolve_project_dir(const std::string& path);
+    bool read_in_calib_params();
 
 public:
     const char AB;
@@ -63,6 +69,7 @@ public:
     std::string json_filename = "calib_params_nw%c.json";
     std::filesystem::path json_path;
     Json database; // all bars and runs
+    RunRangeIndex index; // (bar, run) -> record of database
     std::unordered_map<int, double> tof_offset; // all bars for a given run; <bar, tof_offset>
 
     NWTimeOfFlightCalibParamReader(const char AB, bool load_params=true);
@@ -82,6 +89,8 @@ public:
     std::filesystem::path calib_reldir = "database/neutron_wall/adc_preprocessing/";
     std::string filename = "calib_params_%s.json";
     std::vector<std::filesystem::path> filepaths; // to be written as metadata
+    std::unordered_map<std::string, Json> database; // parsed files, kept across runs; e.g. "fast_total_L" -> content
+    std::unordered_map<std::string, RunRangeIndex> index; // e.g. "fast_total_L" -> (bar, run) -> record
     std::unordered_map<int, std::unordered_map<std::string, double> > fast_total_L;
     std::unordered_map<int, std::unordered_map<std::string, double> > fast_total_R;
     std::unordered_map<int, std::unordered_map<std::string, double> > log_ratio_total;
@@ -90,6 +99,8 @@ public:
     ~NWADCPreprocessorParamReader();
 
     void load(int run);
+    std::filesystem::path get_filepath(const std::string& name);
+    RunRangeIndex& get_index(const std::string& name);
     void load_fast_total(char side);
     void load_log_ratio_total();
     void write_metadata(TFolder* folder, bool relative_path=true);
@@ -121,6 +132,7 @@ private:
     std::vector<double> get_neutron_linear_params(double x_switch_neutron, std::vector<double>& quadratic_params);
     std::vector<double> get_neutron_linear_params(double x_switch_neutron, Json& quadratic_params);
     Json get_bar_params(int run, int bar);
+    std::unordered_map<int, Json> loaded_params; // bar -> run-range record the interpolators were built from
     void fast_total_interpolation(int bar, Json& params);
     void centroid_interpolation(int bar, Json& params);
     void process_pca(int bar, Json& params);
@@ -137,6 +149,7 @@ public:
     // std::unordered_map<int, Json> database; // bar -> json
     // std::unordered_map<int, std::unordered_map<std::string, double>> database; // bar -> <param, value>
     Json database;
+    RunRangeIndex index; // (bar, run) -> record of database
 
     std::unordered_map<int, ROOT::Math::Interpolator*> gamma_fast_total_L; // bar -> interpolator
     std::unordered_map<int, ROOT::Math::Interpolator*> neutron_fast_total_L; // bar -> interpolator
@@ -148,6 +161,16 @@ public:
     std::unordered_map<int, ROOT::Math::Interpolator*> gamma_vpsd_R; // bar - > interpolator
     std::unordered_map<int, ROOT::Math::Interpolator*> neutron_vpsd_R; // bar - > interpolator
 
+    // the interpolators above baked into lookup tables for the per-hit path
+    std::unordered_map<int, UniformGridTable> gamma_fast_total_L_table; // bar -> table
+    std::unordered_map<int, UniformGridTable> neutron_fast_total_L_table; // bar -> table
+    std::unordered_map<int, UniformGridTable> gamma_fast_total_R_table; // bar -> table
+    std::unordered_map<int, UniformGridTable> neutron_fast_total_R_table; // bar -> table
+    std::unordered_map<int, UniformGridTable> gamma_vpsd_L_table; // bar -> table
+    std::unordered_map<int, UniformGridTable> neutron_vpsd_L_table; // bar -> table
+    std::unordered_map<int, UniformGridTable> gamma_vpsd_R_table; // bar -> table
+    std::unordered_map<int, UniformGridTable> neutron_vpsd_R_table; // bar -> table
+
     std::unordered_map<int, std::array<double, 2> > pca_mean; // bar -> (vpsd_L, vpsd_R)
     std::unordered_map<int, std::array<std::array<double, 2>, 2> > pca_components; // bar -> 2x2 matrix
     std::unordered_map<int, std::array<double, 2> > pca_xpeaks; // bar -> (g_xpeak, n_xpeak)
@@ -157,5 +180,6 @@ public:
 
     void load(int run);
     void read_in_calib_params();
+    double get_max_table_error();
     void write_metadata(TFolder* folder, bool relative_path=true);
 };
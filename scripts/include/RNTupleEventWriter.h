@@ -0,0 +1,35 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "TFile.h"
+
+#include "EventWriter.h"
+
+class RNTupleEventWriter : public EventWriter {
+    /* Writes events to an RNTuple in an open ROOT file, as the alternative to
+     * the output TTree. Scalars become fields of the same name. Arrays that
+     * share a counter become one collection of records, named after their
+     * common prefix, e.g. NWB_bar, NWB_pos_x, ... sized by NWB_multi become
+     * the field NWB of type std::vector<{bar, pos_x, ...}>, read back as
+     * "NWB.bar", "NWB.pos_x", ...; the counters are kept as scalars too, so
+     * that cuts such as "MB_multi >= 5" read the same on both formats.
+     *
+     * RNTuple is optional: it is only linked when building with
+     * `make calibrate RNTUPLE=1`, which defines WITH_RNTUPLE and requires
+     * ROOT 6.32 or newer. Otherwise the constructor reports that the feature
+     * is missing and exits.
+     */
+public:
+    RNTupleEventWriter(TFile* file, const std::string& name, const std::vector<Column>& columns, int compression);
+    ~RNTupleEventWriter();
+
+    void fill(const void* event) override;
+    void close() override; // commits the clusters and the footer; the file must still be open
+
+private:
+    struct Impl; // RNTuple objects; kept out of this header so that users need no RNTuple headers
+    std::unique_ptr<Impl> impl;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+using Json = nlohmann::json;
+
+class RunRangeIndex {
+    /* Index over a calibration database of the form
+     *     {"<bar>": [{"run_range": [first, last], ...}, ...], ...}
+     * mapping (bar, run) to the record whose inclusive run range contains the
+     * run, by binary search. Run ranges are converted once, when the index
+     * is built; records are not copied, so the database must outlive the
+     * index and must not be modified.
+     *
+     * Gaps between run ranges and overlapping run ranges of a bar are
+     * reported when the index is built. Where ranges overlap, the record
+     * that comes first in the file wins, as with a linear scan.
+     */
+public:
+    struct Interval {
+        int first;
+        int last; // inclusive
+        const Json* record;
+    };
+    struct Issue {
+        int bar;
+        int first;
+        int last; // inclusive
+    };
+
+    std::string name; // used in messages, e.g. the file path
+    std::unordered_map<int, std::vector<Interval> > intervals; // bar -> sorted, disjoint intervals
+    std::vector<Issue> gaps;
+    std::vector<Issue> overlaps;
+
+    RunRangeIndex();
+    RunRangeIndex(const Json& database, const std::string& name="");
+    ~RunRangeIndex();
+
+    const Json* find(int bar, int run) const; // nullptr if not found
+
+private:
+    void add_bar(int bar, const Json& records);
+};
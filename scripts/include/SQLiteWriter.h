@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "EventWriter.h"
+
+class SQLiteWriter : public EventWriter {
+    /* Writes events to the SQLite tables of scripts/root_to_sqlite.py, which
+     * are what pandas' to_sql() makes of the uproot DataFrames: a table of
+     * scalars has one row per event and an INTEGER column "entry"; a table
+     * with arrays has one row per array element, with columns "entry" and
+     * "subentry", and its scalars repeated on every row (events with empty
+     * arrays have no rows). Columns are REAL or INTEGER after their leaf type,
+     * and every table gets the index "ix_<table>_entry[_subentry]".
+     *
+     * Existing tables of the same names are replaced. Everything is written
+     * in a single transaction in WAL mode, with multi-row prepared INSERTs
+     * of as many rows as SQLite accepts bound variables; indexes are only
+     * created after the last row.
+     *
+     * SQLite is optional: it is only linked when building with
+     * `make calibrate SQLITE=1`, which defines WITH_SQLITE. Otherwise the
+     * constructor reports that the feature is missing and exits.
+     */
+public:
+    struct Table {
+        std::string name;
+        std::vector<Column> columns; // arrays of one table must share their counter
+    };
+
+    SQLiteWriter(const std::string& path, const std::vector<Table>& tables, std::ptrdiff_t entry_offset);
+    ~SQLiteWriter();
+
+    void fill(const void* event) override;
+    void close() override; // commits, then creates the indexes
+
+private:
+    struct Impl; // sqlite3 objects; kept out of this header so that users need no SQLite headers
+    std::unique_ptr<Impl> impl;
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "TBranch.h"
+#include "TFile.h"
+#include "TTree.h"
+
+class TreeIntrospection {
+    /* Tree name, branch names and leaflists of a ROOT file, found with one
+     * open file and one traversal of the branches, in the calling process.
+     * Replaces running modular_scripts/infer_tree_name.exe and
+     * modular_scripts/output_leaflists.exe as child processes, each of which
+     * had to initialize ROOT and reopen the file.
+     *
+     * Leaflists follow TTree::Branch(), e.g. "TDCTriggers.MASTER_TRG/D" or
+     * "NWB.fLeft[NWB.fmulti]/S", for scalars and 1D arrays only. Failures
+     * throw std::runtime_error, with the path of the file in the message.
+     */
+public:
+    std::string path;
+    std::string tree_name;
+    std::vector<std::string> branch_names; // terminal branches, in tree order
+    std::vector<std::string> leaflists; // same order as branch_names
+
+    // the only TTree of the file when tree_name is empty
+    TreeIntrospection(const std::string& path, const std::string& tree_name = "");
+    ~TreeIntrospection();
+
+    TFile* get_file() const { return this->file.get(); }
+    TTree* get_tree() const { return this->tree; }
+    bool has_branch(const std::string& name) const { return this->name_set.count(name) > 0; }
+    std::string get_leaflist(TBranch* branch) const;
+
+    // from the class names of the keys; no object is read
+    static std::vector<std::string> find_tree_names(TFile* file);
+
+    // leaf type names to leaflist codes, e.g. "Short_t" -> 'S'
+    static const std::map<std::string, char> type_char_map;
+
+private:
+    std::unique_ptr<TFile> file;
+    TTree* tree = nullptr; // owned by file
+    std::unordered_set<std::string> name_set;
+
+    void collect_branch_names(TBranch* branch);
+};
+
+// parts of a leaflist, e.g. "NWB.fLeft[NWB.fmulti]/S" -> "NWB.fLeft", 'S', true
+std::string extract_branch_name(const std::string& leaflist);
+char extract_branch_type(const std::string& leaflist);
+bool is_array(const std::string& leaflist);
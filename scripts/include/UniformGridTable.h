@@ -0,0 +1,54 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <vector>
+
+#include "Math/Interpolator.h"
+
+class UniformGridTable {
+    /* A curve baked into cubic Hermite segments on a uniform grid, using the
+     * values and first derivatives of a reference interpolator at the nodes.
+     * The reference must be a C1 piecewise cubic, such as Akima, with the
+     * given knots. The first grid has one cell per interval between the
+     * knots; when the knots are evenly spaced, it lies on them, and the table
+     * reproduces the reference up to rounding. The largest deviation from
+     * the reference is then computed exactly (see measure_error()), and the
+     * grid is refined until it is below the requested tolerance.
+     *
+     * Like the GSL interpolators, Eval() returns NaN outside [x_min, x_max].
+     */
+public:
+    static constexpr double default_tolerance = 1e-6;
+    static constexpr int default_max_n_cells = 1 << 14;
+
+    double x_min = 0.0;
+    double x_max = 0.0;
+    double inv_h = 0.0; // 1 / cell width
+    int n_cells = 0;
+    double max_error = 0.0; // largest deviation from the reference over [x_min, x_max]
+    std::vector<std::array<double, 4> > coeffs; // per cell: c0 + t * (c1 + t * (c2 + t * c3)), t in [0, 1]
+
+    UniformGridTable();
+    UniformGridTable(
+        const ROOT::Math::Interpolator& reference, const std::vector<double>& knots,
+        double tolerance=default_tolerance, int max_n_cells=default_max_n_cells
+    );
+    ~UniformGridTable();
+
+    double Eval(double x) const {
+        // written without branches; NaN input ends up clamped, then masked
+        double xc = std::min(this->x_max, std::max(this->x_min, x));
+        double u = (xc - this->x_min) * this->inv_h;
+        int i = std::min(int(u), this->n_cells - 1);
+        double t = u - i;
+        const auto& c = this->coeffs[i];
+        double y = c[0] + t * (c[1] + t * (c[2] + t * c[3]));
+        return (x >= this->x_min && x <= this->x_max) ? y : std::numeric_limits<double>::quiet_NaN();
+    }
+
+private:
+    void bake(const ROOT::Math::Interpolator& reference, int n_cells);
+    double measure_error(const ROOT::Math::Interpolator& reference, const std::vector<double>& knots) const;
+};
@@ -1,21 +1,41 @@
 #pragma once
 
 // standard libraries
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <clocale>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fnmatch.h>
+#include <fstream>
+#include <getopt.h>
 #include <iostream>
+#include <mutex>
+#include <regex>
+#include <sstream>
+#include <stdexcept>
 #include <string>
 #include <unistd.h>
+#include <utility>
 #include <vector>
 
 // CERN ROOT libraries
 #include "TChain.h"
 #include "TFile.h"
+#include "TFolder.h"
+#include "TList.h"
+#include "TNamed.h"
 #include "TTree.h"
 
+#include "OutputStorage.h"
+
 struct Container {
     static constexpr int max_multi = 128;
 
+    long entry; // entry number in the input tree
+
     // TDC triggers
     double TDC_hira_ds_nwtdc;
     double TDC_hira_live;
@@ -86,27 +106,102 @@ struct Container {
     std::array<float, max_multi> NWB_light_GM;
     std::array<float, max_multi> NWB_psd;
     std::array<float, max_multi> NWB_psd_perp;
+    std::array<short, max_multi> NWB_status; // bits of NWHitBlock::Status
 };
-Container container;
+
+std::vector<int> parse_runs(const std::string& arg) {
+    /* Parse a run number, an inclusive range of runs like "4000-4100", or
+     * a file listing runs and ranges, one per line ('#' starts a comment).
+     */
+    std::vector<std::string> tokens;
+    if (std::filesystem::is_regular_file(arg)) {
+        std::ifstream file(arg);
+        std::string line;
+        while (std::getline(file, line)) {
+            line = line.substr(0, line.find('#'));
+            std::istringstream iss(line);
+            std::string token;
+            while (iss >> token) {
+                tokens.push_back(token);
+            }
+        }
+    }
+    else {
+        tokens.push_back(arg);
+    }
+
+    std::vector<int> runs;
+    for (auto& token : tokens) {
+        try {
+            std::size_t pos = token.find('-');
+            if (pos == std::string::npos) {
+                runs.push_back(std::stoi(token));
+                continue;
+            }
+            int run_start = std::stoi(token.substr(0, pos));
+            int run_stop = std::stoi(token.substr(pos + 1));
+            if (run_start > run_stop) {
+                throw std::invalid_argument("reversed range");
+            }
+            for (int run = run_start; run <= run_stop; ++run) {
+                runs.push_back(run);
+            }
+        }
+        catch (...) {
+            std::cerr << "Unrecognized run specification: " << token << std::endl;
+            exit(1);
+        }
+    }
+    return runs;
+}
 
 class ArgumentParser {
 public:
-    int run_num = 0;
+    int run_num = 0; // the run being calibrated
+    std::vector<int> runs; // all runs, in order
     std::string outroot_path = "";
     int first_entry = 0;
     int n_entries = -1; // negative value means all entries
+    int n_threads = 1;
+    int n_workers = 0; // compute workers of the pipelined mode; zero disables it
+    unsigned long seed = 0; // zero means seeding from time
+    std::string snapshot_dir = ""; // empty means the default directory; "none" disables snapshots
+    std::string storage_config = ""; // empty means the default compression and basket layout
+    bool friend_mode = false; // write only the calibrated branches, as a friend of the input tree
+    std::string schema = "full"; // preset or JSON manifest of output branches; see OutputSchema
+    std::string arrow_path = ""; // Arrow IPC output; empty means none
+    std::string sqlite_path = ""; // SQLite output; empty means none
+    bool hit_table = false; // also write the tree "hits", one entry per NWB hit
+    std::string output_format = "tree"; // "tree" (TTree) or "rntuple"
+    bool regen_dither = false; // drop the purely random branches, which readers regenerate from the seed
+    std::string sparse_predicate = ""; // only write events passing it; empty writes all events
+    bool framework_input = false; // read CalibratedData of the framework instead of the output of remove_tclass.exe
 
     ArgumentParser(int argc, char* argv[]) {
         opterr = 0; // getopt() return '?' when getting errors
 
+        const option long_options[] = {
+            {"help",   no_argument, nullptr, 'h'},
+            {"friend", no_argument, nullptr, 'F'},
+            {"schema", required_argument, nullptr, 'S'},
+            {"arrow",  required_argument, nullptr, 'A'},
+            {"sqlite", required_argument, nullptr, 'Q'},
+            {"hits",   no_argument, nullptr, 'H'},
+            {"format", required_argument, nullptr, 'T'},
+            {"regen-dither", no_argument, nullptr, 'D'},
+            {"sparse", optional_argument, nullptr, 'P'},
+            {"framework", no_argument, nullptr, 'W'},
+            {nullptr,  0,           nullptr, 0},
+        };
+
         int opt;
-        while((opt = getopt(argc, argv, "hr:o:i:n:")) != -1) {
+        while((opt = getopt_long(argc, argv, "hr:o:i:n:j:s:c:p:z:", long_options, nullptr)) != -1) {
             switch (opt) {
                 case 'h':
                     this->print_help();
                     exit(0);
                 case 'r':
-                    this->run_num = std::stoi(optarg);
+                    this->runs = parse_runs(optarg);
                     break;
                 case 'o':
                     this->outroot_path = optarg;
@@ -117,6 +212,48 @@ public:
                 case 'n':
                     this->n_entries = std::stoi(optarg);
                     break;
+                case 'j':
+                    this->n_threads = std::stoi(optarg);
+                    break;
+                case 's':
+                    this->seed = std::stoul(optarg);
+                    break;
+                case 'c':
+                    this->snapshot_dir = optarg;
+                    break;
+                case 'p':
+                    this->n_workers = std::stoi(optarg);
+                    break;
+                case 'z':
+                    this->storage_config = optarg;
+                    break;
+                case 'F':
+                    this->friend_mode = true;
+                    break;
+                case 'S':
+                    this->schema = optarg;
+                    break;
+                case 'A':
+                    this->arrow_path = optarg;
+                    break;
+                case 'Q':
+                    this->sqlite_path = optarg;
+                    break;
+                case 'H':
+                    this->hit_table = true;
+                    break;
+                case 'T':
+                    this->output_format = optarg;
+                    break;
+                case 'D':
+                    this->regen_dither = true;
+                    break;
+                case 'P':
+                    this->sparse_predicate = (optarg == nullptr) ? "NWB_multi > 0" : optarg;
+                    break;
+                case 'W':
+                    this->framework_input = true;
+                    break;
                 case '?':
                     if (optopt == 'r') {
                         std::cerr << "Option -" << char(optopt) << " requires an argument" << std::endl;
@@ -129,7 +266,7 @@ public:
         }
 
         // check for mandatory arguments
-        if (this->run_num == 0) {
+        if (this->runs.empty()) {
             std::cerr << "Option -r is mandatory" << std::endl;
             exit(1);
         }
@@ -137,20 +274,179 @@ public:
             std::cerr << "Option -o is mandatory" << std::endl;
             exit(1);
         }
+        if (this->runs.size() > 1 && this->outroot_path.find("RUN") == std::string::npos) {
+            std::cerr << "Option -o must contain the placeholder \"RUN\" when calibrating several runs" << std::endl;
+            exit(1);
+        }
+        if (this->runs.size() > 1 && this->arrow_path != "" && this->arrow_path.find("RUN") == std::string::npos) {
+            std::cerr << "Option --arrow must contain the placeholder \"RUN\" when calibrating several runs" << std::endl;
+            exit(1);
+        }
+        if (this->runs.size() > 1 && this->sqlite_path != "" && this->sqlite_path.find("RUN") == std::string::npos) {
+            std::cerr << "Option --sqlite must contain the placeholder \"RUN\" when calibrating several runs" << std::endl;
+            exit(1);
+        }
+        this->run_num = this->runs.front();
+        if (this->n_threads < 1) {
+            std::cerr << "Option -j must be at least 1" << std::endl;
+            exit(1);
+        }
+        if (this->n_workers < 0) {
+            std::cerr << "Option -p must not be negative" << std::endl;
+            exit(1);
+        }
+        if (this->n_workers > 0 && this->n_threads > 1) {
+            std::cerr << "Options -j and -p cannot be combined" << std::endl;
+            exit(1);
+        }
+        if ((this->arrow_path != "" || this->sqlite_path != "" || this->hit_table) && this->n_threads > 1) {
+            std::cerr << "Options --arrow, --sqlite and --hits cannot be combined with -j; use -p instead" << std::endl;
+            exit(1);
+        }
+        if (this->output_format != "tree" && this->output_format != "rntuple") {
+            std::cerr << "Option --format must be \"tree\" or \"rntuple\"" << std::endl;
+            exit(1);
+        }
+        if (this->output_format == "rntuple" && (this->n_threads > 1 || this->friend_mode)) {
+            std::cerr << "Option --format rntuple cannot be combined with -j or --friend" << std::endl;
+            exit(1);
+        }
+        if (this->sparse_predicate != "" && this->friend_mode) {
+            std::cerr << "Options --sparse and --friend cannot be combined, since friends align entries by position" << std::endl;
+            exit(1);
+        }
+        if (this->framework_input && this->friend_mode) {
+            std::cerr << "Options --framework and --friend cannot be combined, since friends need the flat input tree" << std::endl;
+            exit(1);
+        }
+        if (this->seed == 0) {
+            this->seed = (unsigned long)time(NULL);
+        }
+    }
+
+    std::string get_outroot_path() {
+        /* Output path of the current run; "RUN" is replaced by the run number */
+        return this->replace_run(this->outroot_path);
+    }
+
+    std::string get_arrow_path() {
+        return this->replace_run(this->arrow_path);
+    }
+
+    std::string get_sqlite_path() {
+        return this->replace_run(this->sqlite_path);
+    }
+
+    std::string replace_run(std::string path) {
+        std::size_t pos = path.find("RUN");
+        if (pos != std::string::npos) {
+            path.replace(pos, 3, Form("%04d", this->run_num));
+        }
+        return path;
     }
 
     void print_help() {
         const char* msg = R"(
         Mandatory arguments:
-            -r      HiRA run number (four-digit).
-            -o      ROOT file output path.
+            -r      HiRA run number (four-digit), an inclusive range of runs
+                    such as 4000-4100, or a file listing runs and ranges. All
+                    runs are calibrated by the same process, so calibration
+                    databases are only parsed once.
+            -o      ROOT file output path. When calibrating several runs, the
+                    path must contain "RUN", which is replaced by the four-digit
+                    run number, e.g. ./out_dir/run-RUN.root.
 
         Optional arguments:
-            -h      Print help message.
+            -h, --help
+                    Print help message.
             -i      First entry to process. Default is 0.
             -n      Number of entries to process. Default is all.
                     If `n + i` is greater than the total number of entries, the
                     program will safely stop after the last entry.
+            -j      Number of threads. Default is 1. Entries are split along the
+                    clusters of the input tree and merged back in input order.
+            -s      Random seed for ADC and position randomization. Default is
+                    the current time. Random numbers are keyed by the run, entry
+                    and hit, so the same seed gives identical output for any
+                    number of threads and any choice of -i and -n.
+            -p      Number of compute workers of the pipelined mode. Default is
+                    0 (disabled). One thread reads and unpacks the input, the
+                    workers calibrate blocks of entries, and one thread fills
+                    and compresses the output, all running concurrently. An
+                    occupancy report of the three stages is printed at the
+                    end. Cannot be combined with -j.
+            -z      JSON file setting the compression algorithm and level, the
+                    basket sizes and the cluster size of the output, per group
+                    of branches (see include/OutputStorage.h). By default,
+                    branches read by e15190/neutron_wall/spectra.py use LZ4 and
+                    all others ZSTD.
+            --friend
+                    Write only the calibrated NWB branches, plus NWB_multi and
+                    the input entry number "entry", instead of copying every
+                    input branch. The output tree records the input file and
+                    defines aliases for all other branches through the friend
+                    "raw", i.e. the input tree "E15190" (see link_friend_tree()).
+            --schema SCHEMA
+                    Output branches: "full" (default), "spectra" (branches read
+                    by e15190/neutron_wall/spectra.py), "nwb-only", or a JSON
+                    manifest {"branches": [patterns]}. Input branches that are
+                    neither written nor needed by the calibration are not read.
+            --arrow PATH
+                    Also write the output branches, plus the input entry number
+                    "entry", to an Arrow IPC (Feather v2) file; "RUN" is
+                    replaced as in -o. Arrays become list columns. Requires
+                    building with `make calibrate ARROW=1`; cannot be combined
+                    with -j.
+            --sqlite PATH
+                    Also write the tables of scripts/root_to_sqlite.py (tdc, mb,
+                    fa, vw and nwb) to an SQLite file; "RUN" is replaced as in
+                    -o. Requires building with `make calibrate SQLITE=1`;
+                    cannot be combined with -j.
+            --hits  Also write the tree "hits" to the output file, with one
+                    entry per NWB hit: the input entry number "entry", the hit
+                    index "hit", all NWB arrays, and MB_multi, VW_multi and
+                    TDC_mb_nw. Entries are sorted by NWB_bar, one cluster per
+                    bar, whose entry ranges are kept in the user info of the
+                    tree. Up to 64 MB of hits (about 130 bytes each) are held
+                    in memory, the rest in temporary files of every bar until
+                    the end of the run; cannot be combined with -j.
+            --format FORMAT
+                    Format of the output "tree": "tree" (TTree, default) or
+                    "rntuple". An RNTuple has the scalar branches as fields,
+                    plus "entry", and every detector's arrays as a collection
+                    of records, e.g. NWB_pos_x is read as "NWB.pos_x". Requires
+                    building with `make calibrate RNTUPLE=1` (ROOT 6.32 or
+                    newer); cannot be combined with -j or --friend.
+            --regen-dither
+                    Do not write NWB_pos_y, NWB_pos_z, NWB_fastf_L and
+                    NWB_fastf_R, which are uniform noise and dithered raw ADC
+                    values, and therefore hardly compress. They are pure
+                    functions of (seed, run, entry, hit), so readers regenerate
+                    them bit for bit from the seed and run in the metadata,
+                    the input entry number "entry" (written in this mode) and
+                    the raw NWB_fast_L and NWB_fast_R (kept in the output, or
+                    in the input tree with --friend); see include/NWDither.h
+                    and e15190/neutron_wall/dither.py.
+            --sparse[=PREDICATE]
+                    Only write events that pass PREDICATE, "NWB_multi > 0" by
+                    default, to the output tree and every other output. The
+                    predicate is a conjunction of comparisons of scalar
+                    branches with numbers, e.g. "NWB_multi > 0 && MB_multi >= 2".
+                    The input entry number "entry" is written with every
+                    event, and the numbers of selected and skipped events
+                    are saved in the metadata. Cannot be combined with --friend.
+            --framework
+                    Read the CalibratedData files of the analysis framework,
+                    from "daniele_root_files_dir" of database/local_paths.json,
+                    instead of their copies without TClass in
+                    database/root_files_daniele. The split class members are
+                    read directly, so remove_tclass.exe is not needed. Cannot
+                    be combined with --friend.
+            -c      Directory of calibration snapshots. Default is
+                    $PROJECT_DIR/database/neutron_wall/calib_snapshots. The
+                    parameters of a run are loaded from its snapshot when all
+                    source files are unchanged, and the snapshot is rebuilt
+                    otherwise. Use "-c none" to always parse the databases.
         )";
         std::cout << msg << std::endl;
     }
@@ -240,188 +536,468 @@ std::filesystem::path get_input_root_path(
     return inroot_path;
 }
 
-TChain* get_input_tree(const std::string& path, const std::string& tree_name) {
-    TChain* chain = new TChain(tree_name.c_str());
-    chain->Add(path.c_str());
+std::vector<std::pair<long, long> > get_entry_clusters(TTree* tree, long first_entry, long last_entry) {
+    /* Split [first_entry, last_entry] along the on-disk clusters of the tree.
+     * Each pair is a half-open range [start, stop). The split only depends on
+     * the input file, so the work units are the same for any number of threads.
+     */
+    std::vector<std::pair<long, long> > clusters;
+    auto cluster_iter = tree->GetClusterIterator(first_entry);
+    long start;
+    while ((start = cluster_iter()) <= last_entry) {
+        long stop = std::min(long(cluster_iter.GetNextEntry()), last_entry + 1);
+        clusters.push_back({std::max(start, first_entry), stop});
+    }
+    return clusters;
+}
 
-    //TDC triggers
-    chain->SetBranchAddress("TDCTriggers.HiRA_DS_TRG_NWTDC",    &container.TDC_hira_ds_nwtdc);
-    chain->SetBranchAddress("TDCTriggers.HiRA_LIVE",            &container.TDC_hira_live);
-    chain->SetBranchAddress("TDCTriggers.MASTER_TRG",           &container.TDC_master);
-    chain->SetBranchAddress("TDCTriggers.MASTER_TRG_NWTDC",     &container.TDC_master_nw);
-    chain->SetBranchAddress("TDCTriggers.MASTER_TRG_VWTDC",     &container.TDC_master_vw);
-    chain->SetBranchAddress("TDCTriggers.NW_DS_TRG",            &container.TDC_nw_ds);
-    chain->SetBranchAddress("TDCTriggers.NW_DS_TRG_NWTDC",      &container.TDC_nw_ds_nwtdc);
-    chain->SetBranchAddress("TDCTriggers.RF_TRG_NWTDC",         &container.TDC_rf_nwtdc);
-    chain->SetBranchAddress("TDCTriggers.uBallHiRA_TRG",        &container.TDC_mb_hira);
-    chain->SetBranchAddress("TDCTriggers.uBallHiRA_TRG_NWTDC",  &container.TDC_mb_hira_nwtdc);
-    chain->SetBranchAddress("TDCTriggers.uBallNW_TRG",          &container.TDC_mb_nw);
-    chain->SetBranchAddress("TDCTriggers.uBallNW_TRG_NWTDC",    &container.TDC_mb_nw_nwtdc);
-    chain->SetBranchAddress("TDCTriggers.uBall_DS_TRG",         &container.TDC_mb_ds);
-    // Microball
-    chain->SetBranchAddress("uBall.fmulti",                     &container.MB_multi);
-    chain->SetBranchAddress("uBall.fnumring",                   &container.MB_ring[0]);
-    chain->SetBranchAddress("uBall.fnumdet",                    &container.MB_det[0]);
-    chain->SetBranchAddress("uBall.fTail",                      &container.MB_tail[0]);
-    chain->SetBranchAddress("uBall.fFast",                      &container.MB_fast[0]);
-    chain->SetBranchAddress("uBall.fTime",                      &container.MB_time[0]);
-    // Forward Array
-    chain->SetBranchAddress("ForwardArray.fmulti",              &container.FA_multi);
-    chain->SetBranchAddress("ForwardArray.fTimeMin",            &container.FA_time_min);
-    chain->SetBranchAddress("ForwardArray.fTimeMean",           &container.FA_time_mean);
-    chain->SetBranchAddress("ForwardArray.fnumdet",             &container.FA_det[0]);
-    chain->SetBranchAddress("ForwardArray.fE",                  &container.FA_total[0]);
-    chain->SetBranchAddress("ForwardArray.fTime",               &container.FA_time[0]);
-    // Veto Wall
-    chain->SetBranchAddress("VetoWall.fmulti",                  &container.VW_multi);
-    chain->SetBranchAddress("VetoWall.fnumbar",                 &container.VW_bar[0]);
-    chain->SetBranchAddress("VetoWall.fTop",                    &container.VW_total_T[0]);
-    chain->SetBranchAddress("VetoWall.fBottom",                 &container.VW_total_B[0]);
-    chain->SetBranchAddress("VetoWall.fTimeTop",                &container.VW_time_T[0]);
-    chain->SetBranchAddress("VetoWall.fTimeBottom",             &container.VW_time_B[0]);
-    // Neutron Wall A
-    chain->SetBranchAddress("NWA.fmulti",                       &container.NWA_multi);
-    chain->SetBranchAddress("NWA.fnumbar",                      &container.NWA_bar[0]);
-    // Neutron Wall B
-    chain->SetBranchAddress("NWB.fmulti",                       &container.NWB_multi);
-    chain->SetBranchAddress("NWB.fnumbar",                      &container.NWB_bar[0]);
-    chain->SetBranchAddress("NWB.fLeft",                        &container.NWB_total_L[0]);
-    chain->SetBranchAddress("NWB.fRight",                       &container.NWB_total_R[0]);
-    chain->SetBranchAddress("NWB.ffastLeft",                    &container.NWB_fast_L[0]);
-    chain->SetBranchAddress("NWB.ffastRight",                   &container.NWB_fast_R[0]);
-    chain->SetBranchAddress("NWB.fTimeLeft",                    &container.NWB_time_L[0]);
-    chain->SetBranchAddress("NWB.fTimeRight",                   &container.NWB_time_R[0]);
-
-    // enable class objects
-    chain->SetMakeClass(1);
+struct BranchSpec {
+    /* One branch of the output tree. Raw branches are copied from the input
+     * tree, where they are called input_name; the others are computed by
+     * calibrate.exe and have no input_name.
+     */
+    const char* name;
+    const char* input_name; // nullptr for calibrated branches
+    const char* leaflist;
+    void* (*address)(Container& container);
+
+    bool is_raw() const { return this->input_name != nullptr; }
+    std::string get_counter() const {
+        /* e.g. "MB_multi" for "MB_ring[MB_multi]/I"; empty for scalars */
+        std::string leaflist = this->leaflist;
+        std::size_t open = leaflist.find('['), close = leaflist.find(']');
+        return (open == std::string::npos) ? "" : leaflist.substr(open + 1, close - open - 1);
+    }
+};
 
-    // set branch status
-    chain->SetBranchStatus("*", false);
+#define CONTAINER_FIELD(field) [](Container& container) -> void* { return &container.field; }
+// all output branches, in output order
+const std::vector<BranchSpec> branch_specs = {
     // TDC triggers
-    chain->SetBranchStatus("TDCTriggers.HiRA_DS_TRG_NWTDC", true);
-    chain->SetBranchStatus("TDCTriggers.HiRA_LIVE", true);
-    chain->SetBranchStatus("TDCTriggers.MASTER_TRG", true);
-    chain->SetBranchStatus("TDCTriggers.MASTER_TRG_NWTDC", true);
-    chain->SetBranchStatus("TDCTriggers.MASTER_TRG_VWTDC", true);
-    chain->SetBranchStatus("TDCTriggers.NW_DS_TRG", true);
-    chain->SetBranchStatus("TDCTriggers.NW_DS_TRG_NWTDC", true);
-    chain->SetBranchStatus("TDCTriggers.RF_TRG_NWTDC", true);
-    chain->SetBranchStatus("TDCTriggers.uBallHiRA_TRG", true);
-    chain->SetBranchStatus("TDCTriggers.uBallHiRA_TRG_NWTDC", true);
-    chain->SetBranchStatus("TDCTriggers.uBallNW_TRG", true);
-    chain->SetBranchStatus("TDCTriggers.uBallNW_TRG_NWTDC", true);
-    chain->SetBranchStatus("TDCTriggers.uBall_DS_TRG", true);
+    {"TDC_hira_ds_nwtdc",   "TDCTriggers.HiRA_DS_TRG_NWTDC",    "TDC_hira_ds_nwtdc/D",          CONTAINER_FIELD(TDC_hira_ds_nwtdc)},
+    {"TDC_hira_live",       "TDCTriggers.HiRA_LIVE",            "TDC_hira_live/D",              CONTAINER_FIELD(TDC_hira_live)},
+    {"TDC_master",          "TDCTriggers.MASTER_TRG",           "TDC_master/D",                 CONTAINER_FIELD(TDC_master)},
+    {"TDC_master_nw",       "TDCTriggers.MASTER_TRG_NWTDC",     "TDC_master_nw/D",              CONTAINER_FIELD(TDC_master_nw)},
+    {"TDC_master_vw",       "TDCTriggers.MASTER_TRG_VWTDC",     "TDC_master_vw/D",              CONTAINER_FIELD(TDC_master_vw)},
+    {"TDC_nw_ds",           "TDCTriggers.NW_DS_TRG",            "TDC_nw_ds/D",                  CONTAINER_FIELD(TDC_nw_ds)},
+    {"TDC_nw_ds_nwtdc",     "TDCTriggers.NW_DS_TRG_NWTDC",      "TDC_nw_ds_nwtdc/D",            CONTAINER_FIELD(TDC_nw_ds_nwtdc)},
+    {"TDC_rf_nwtdc",        "TDCTriggers.RF_TRG_NWTDC",         "TDC_rf_nwtdc/D",               CONTAINER_FIELD(TDC_rf_nwtdc)},
+    {"TDC_mb_hira",         "TDCTriggers.uBallHiRA_TRG",        "TDC_mb_hira/D",                CONTAINER_FIELD(TDC_mb_hira)},
+    {"TDC_mb_hira_nwtdc",   "TDCTriggers.uBallHiRA_TRG_NWTDC",  "TDC_mb_hira_nwtdc/D",          CONTAINER_FIELD(TDC_mb_hira_nwtdc)},
+    {"TDC_mb_nw",           "TDCTriggers.uBallNW_TRG",          "TDC_mb_nw/D",                  CONTAINER_FIELD(TDC_mb_nw)},
+    {"TDC_mb_nw_nwtdc",     "TDCTriggers.uBallNW_TRG_NWTDC",    "TDC_mb_nw_nwtdc/D",            CONTAINER_FIELD(TDC_mb_nw_nwtdc)},
+    {"TDC_mb_ds",           "TDCTriggers.uBall_DS_TRG",         "TDC_mb_ds/D",                  CONTAINER_FIELD(TDC_mb_ds)},
     // Microball
-    chain->SetBranchStatus("uBall.fmulti", true);
-    chain->SetBranchStatus("uBall.fnumring", true);
-    chain->SetBranchStatus("uBall.fnumdet", true);
-    chain->SetBranchStatus("uBall.fTail", true);
-    chain->SetBranchStatus("uBall.fFast", true);
-    chain->SetBranchStatus("uBall.fTime", true);
+    {"MB_multi",            "uBall.fmulti",                     "MB_multi/I",                   CONTAINER_FIELD(MB_multi)},
+    {"MB_ring",             "uBall.fnumring",                   "MB_ring[MB_multi]/I",          CONTAINER_FIELD(MB_ring)},
+    {"MB_det",              "uBall.fnumdet",                    "MB_det[MB_multi]/I",           CONTAINER_FIELD(MB_det)},
+    {"MB_tail",             "uBall.fTail",                      "MB_tail[MB_multi]/S",          CONTAINER_FIELD(MB_tail)},
+    {"MB_fast",             "uBall.fFast",                      "MB_fast[MB_multi]/S",          CONTAINER_FIELD(MB_fast)},
+    {"MB_time",             "uBall.fTime",                      "MB_time[MB_multi]/S",          CONTAINER_FIELD(MB_time)},
     // Forward Array
-    chain->SetBranchStatus("ForwardArray.fmulti", true);
-    chain->SetBranchStatus("ForwardArray.fTimeMin", true);
-    chain->SetBranchStatus("ForwardArray.fTimeMean", true);
-    chain->SetBranchStatus("ForwardArray.fnumdet", true);
-    chain->SetBranchStatus("ForwardArray.fE", true);
-    chain->SetBranchStatus("ForwardArray.fTime", true);
+    {"FA_multi",            "ForwardArray.fmulti",              "FA_multi/I",                   CONTAINER_FIELD(FA_multi)},
+    {"FA_time_min",         "ForwardArray.fTimeMin",            "FA_time_min/D",                CONTAINER_FIELD(FA_time_min)},
+    {"FA_time_mean",        "ForwardArray.fTimeMean",           "FA_time_mean/D",               CONTAINER_FIELD(FA_time_mean)},
+    {"FA_det",              "ForwardArray.fnumdet",             "FA_det[FA_multi]/I",           CONTAINER_FIELD(FA_det)},
+    {"FA_total",            "ForwardArray.fE",                  "FA_total[FA_multi]/S",         CONTAINER_FIELD(FA_total)},
+    {"FA_time",             "ForwardArray.fTime",               "FA_time[FA_multi]/D",          CONTAINER_FIELD(FA_time)},
     // Veto Wall
-    chain->SetBranchStatus("VetoWall.fmulti", true);
-    chain->SetBranchStatus("VetoWall.fnumbar", true);
-    chain->SetBranchStatus("VetoWall.fTop", true);
-    chain->SetBranchStatus("VetoWall.fBottom", true);
-    chain->SetBranchStatus("VetoWall.fTimeTop", true);
-    chain->SetBranchStatus("VetoWall.fTimeBottom", true);
+    {"VW_multi",            "VetoWall.fmulti",                  "VW_multi/I",                   CONTAINER_FIELD(VW_multi)},
+    {"VW_bar",              "VetoWall.fnumbar",                 "VW_bar[VW_multi]/I",           CONTAINER_FIELD(VW_bar)},
+    {"VW_total_T",          "VetoWall.fTop",                    "VW_total_T[VW_multi]/S",       CONTAINER_FIELD(VW_total_T)},
+    {"VW_total_B",          "VetoWall.fBottom",                 "VW_total_B[VW_multi]/S",       CONTAINER_FIELD(VW_total_B)},
+    {"VW_time_T",           "VetoWall.fTimeTop",                "VW_time_T[VW_multi]/D",        CONTAINER_FIELD(VW_time_T)},
+    {"VW_time_B",           "VetoWall.fTimeBottom",             "VW_time_B[VW_multi]/D",        CONTAINER_FIELD(VW_time_B)},
     // Neutron Wall A
-    chain->SetBranchStatus("NWA.fmulti", true);
-    chain->SetBranchStatus("NWA.fnumbar", true);
+    {"NWA_multi",           "NWA.fmulti",                       "NWA_multi/I",                  CONTAINER_FIELD(NWA_multi)},
+    {"NWA_bar",             "NWA.fnumbar",                      "NWA_bar[NWA_multi]/I",         CONTAINER_FIELD(NWA_bar)},
     // Neutron Wall B
-    chain->SetBranchStatus("NWB.fmulti", true);
-    chain->SetBranchStatus("NWB.fnumbar", true);
-    chain->SetBranchStatus("NWB.fLeft", true);
-    chain->SetBranchStatus("NWB.fRight", true);
-    chain->SetBranchStatus("NWB.ffastLeft", true);
-    chain->SetBranchStatus("NWB.ffastRight", true);
-    chain->SetBranchStatus("NWB.fTimeLeft", true);
-    chain->SetBranchStatus("NWB.fTimeRight", true);
+    {"NWB_multi",           "NWB.fmulti",                       "NWB_multi/I",                  CONTAINER_FIELD(NWB_multi)},
+    {"NWB_bar",             "NWB.fnumbar",                      "NWB_bar[NWB_multi]/I",         CONTAINER_FIELD(NWB_bar)},
+    {"NWB_total_L",         "NWB.fLeft",                        "NWB_total_L[NWB_multi]/S",     CONTAINER_FIELD(NWB_total_L)},
+    {"NWB_total_R",         "NWB.fRight",                       "NWB_total_R[NWB_multi]/S",     CONTAINER_FIELD(NWB_total_R)},
+    {"NWB_fast_L",          "NWB.ffastLeft",                    "NWB_fast_L[NWB_multi]/S",      CONTAINER_FIELD(NWB_fast_L)},
+    {"NWB_fast_R",          "NWB.ffastRight",                   "NWB_fast_R[NWB_multi]/S",      CONTAINER_FIELD(NWB_fast_R)},
+    {"NWB_time_L",          "NWB.fTimeLeft",                    "NWB_time_L[NWB_multi]/D",      CONTAINER_FIELD(NWB_time_L)},
+    {"NWB_time_R",          "NWB.fTimeRight",                   "NWB_time_R[NWB_multi]/D",      CONTAINER_FIELD(NWB_time_R)},
+    /* new / modified branches */
+    {"NWB_totalf_L",        nullptr,                            "NWB_totalf_L[NWB_multi]/F",    CONTAINER_FIELD(NWB_totalf_L)},
+    {"NWB_totalf_R",        nullptr,                            "NWB_totalf_R[NWB_multi]/F",    CONTAINER_FIELD(NWB_totalf_R)},
+    {"NWB_fastf_L",         nullptr,                            "NWB_fastf_L[NWB_multi]/F",     CONTAINER_FIELD(NWB_fastf_L)},
+    {"NWB_fastf_R",         nullptr,                            "NWB_fastf_R[NWB_multi]/F",     CONTAINER_FIELD(NWB_fastf_R)},
+    {"NWB_tof",             nullptr,                            "NWB_tof[NWB_multi]/F",         CONTAINER_FIELD(NWB_tof)},
+    {"NWB_pos_x",           nullptr,                            "NWB_pos_x[NWB_multi]/F",       CONTAINER_FIELD(NWB_pos_x)},
+    {"NWB_pos_y",           nullptr,                            "NWB_pos_y[NWB_multi]/F",       CONTAINER_FIELD(NWB_pos_y)},
+    {"NWB_pos_z",           nullptr,                            "NWB_pos_z[NWB_multi]/F",       CONTAINER_FIELD(NWB_pos_z)},
+    {"NWB_distance",        nullptr,                            "NWB_distance[NWB_multi]/F",    CONTAINER_FIELD(NWB_distance)},
+    {"NWB_theta",           nullptr,                            "NWB_theta[NWB_multi]/F",       CONTAINER_FIELD(NWB_theta)},
+    {"NWB_phi",             nullptr,                            "NWB_phi[NWB_multi]/F",         CONTAINER_FIELD(NWB_phi)},
+    {"NWB_distance_c",      nullptr,                            "NWB_distance_c[NWB_multi]/F",  CONTAINER_FIELD(NWB_distance_c)},
+    {"NWB_theta_c",         nullptr,                            "NWB_theta_c[NWB_multi]/F",     CONTAINER_FIELD(NWB_theta_c)},
+    {"NWB_phi_c",           nullptr,                            "NWB_phi_c[NWB_multi]/F",       CONTAINER_FIELD(NWB_phi_c)},
+    {"NWB_light_GM",        nullptr,                            "NWB_light_GM[NWB_multi]/F",    CONTAINER_FIELD(NWB_light_GM)},
+    {"NWB_psd",             nullptr,                            "NWB_psd[NWB_multi]/F",         CONTAINER_FIELD(NWB_psd)},
+    {"NWB_psd_perp",        nullptr,                            "NWB_psd_perp[NWB_multi]/F",    CONTAINER_FIELD(NWB_psd_perp)},
+    {"NWB_status",          nullptr,                            "NWB_status[NWB_multi]/S",      CONTAINER_FIELD(NWB_status)},
+};
+#undef CONTAINER_FIELD
 
-    return chain;
+const BranchSpec* find_branch_spec(const std::string& name) {
+    for (auto& spec : branch_specs) {
+        if (name == spec.name) return &spec;
+    }
+    return nullptr;
 }
 
-TTree* get_output_tree(TFile*& outroot, const std::string& tree_name) {
-    outroot->cd();
-    TTree* tree = new TTree(tree_name.c_str(), "");
+class OutputSchema {
+    /* Which branches are written, and therefore which input branches are
+     * read. A schema is either a preset or a JSON manifest
+     *     {"branches": ["NWB_*", "VW_*", "TDC_mb_nw"]}
+     * whose entries are shell-style patterns over output branch names. The
+     * counter of every selected array (e.g. MB_multi for MB_ring) is always
+     * written along with it. Input branches that the calibration needs are
+     * read regardless of the schema; all other input branches that are not
+     * written are never enabled, so their baskets are never decompressed.
+     *
+     * Presets:
+     *     full       every branch (default)
+     *     spectra    what e15190/neutron_wall/spectra.py reads: the trigger
+     *                and multiplicity branches it cuts on and all NWB branches
+     *     nwb-only   NWB branches only
+     *
+     * In --friend mode, raw branches are dropped except the counter NWB_multi.
+     */
+public:
+    std::string name; // preset name or manifest path
+    std::vector<const BranchSpec*> output_branches; // in output order
+    std::vector<const BranchSpec*> input_branches;
+
+    // raw branches read by the calibration itself (see gather_hits())
+    static inline const std::vector<std::string> calibration_inputs = {
+        "FA_time_mean", "NWB_multi", "NWB_bar", "NWB_total_L", "NWB_total_R",
+        "NWB_fast_L", "NWB_fast_R", "NWB_time_L", "NWB_time_R",
+    };
+
+    OutputSchema(
+        const std::string& name = "full", bool friend_mode = false,
+        const std::vector<std::string>& extra_inputs = {} // raw branches read even if not written
+    ) : name(name) {
+        std::vector<std::string> patterns = get_patterns(name);
+        std::vector<std::string> selected;
+        for (auto& spec : branch_specs) {
+            if (friend_mode && spec.is_raw() && std::string(spec.name) != "NWB_multi") continue;
+            for (auto& pattern : patterns) {
+                if (fnmatch(pattern.c_str(), spec.name, 0) != 0) continue;
+                selected.push_back(spec.name);
+                if (spec.get_counter() != "") selected.push_back(spec.get_counter());
+                break;
+            }
+        }
+        if (selected.empty()) {
+            std::cerr << "Schema \"" << name << "\" selects no branches" << std::endl;
+            exit(1);
+        }
 
-    //   TDC triggers
-    tree->Branch("TDC_hira_ds_nwtdc",  &container.TDC_hira_ds_nwtdc,  "TDC_hira_ds_nwtdc/D");
-    tree->Branch("TDC_hira_live",      &container.TDC_hira_live,      "TDC_hira_live/D");
-    tree->Branch("TDC_master",         &container.TDC_master,         "TDC_master/D");
-    tree->Branch("TDC_master_nw",      &container.TDC_master_nw,      "TDC_master_nw/D");
-    tree->Branch("TDC_master_vw",      &container.TDC_master_vw,      "TDC_master_vw/D");
-    tree->Branch("TDC_nw_ds",          &container.TDC_nw_ds,          "TDC_nw_ds/D");
-    tree->Branch("TDC_nw_ds_nwtdc",    &container.TDC_nw_ds_nwtdc,    "TDC_nw_ds_nwtdc/D");
-    tree->Branch("TDC_rf_nwtdc",       &container.TDC_rf_nwtdc,       "TDC_rf_nwtdc/D");
-    tree->Branch("TDC_mb_hira",        &container.TDC_mb_hira,        "TDC_mb_hira/D");
-    tree->Branch("TDC_mb_hira_nwtdc",  &container.TDC_mb_hira_nwtdc,  "TDC_mb_hira_nwtdc/D");
-    tree->Branch("TDC_mb_nw",          &container.TDC_mb_nw,          "TDC_mb_nw/D");
-    tree->Branch("TDC_mb_nw_nwtdc",    &container.TDC_mb_nw_nwtdc,    "TDC_mb_nw_nwtdc/D");
-    tree->Branch("TDC_mb_ds",          &container.TDC_mb_ds,          "TDC_mb_ds/D");
+        auto contains = [](const std::vector<std::string>& names, const char* name) {
+            return std::find(names.begin(), names.end(), name) != names.end();
+        };
+        for (auto& spec : branch_specs) {
+            if (contains(selected, spec.name)) {
+                this->output_branches.push_back(&spec);
+            }
+            bool is_input = contains(selected, spec.name) || contains(calibration_inputs, spec.name) || contains(extra_inputs, spec.name);
+            if (spec.is_raw() && is_input) {
+                this->input_branches.push_back(&spec);
+            }
+        }
+    }
 
-    // Microball
-    tree->Branch("MB_multi",        &container.MB_multi,          "MB_multi/I");
-    tree->Branch("MB_ring",         &container.MB_ring[0],        "MB_ring[MB_multi]/I");
-    tree->Branch("MB_det",          &container.MB_det[0],         "MB_det[MB_multi]/I");
-    tree->Branch("MB_tail",         &container.MB_tail[0],        "MB_tail[MB_multi]/S");
-    tree->Branch("MB_fast",         &container.MB_fast[0],        "MB_fast[MB_multi]/S");
-    tree->Branch("MB_time",         &container.MB_time[0],        "MB_time[MB_multi]/S");
+    // calibrated branches that only depend on (seed, run, entry, hit) and raw branches; see NWDither.h
+    static inline const std::vector<std::string> regenerable_branches = {
+        "NWB_pos_y", "NWB_pos_z", "NWB_fastf_L", "NWB_fastf_R",
+    };
+    static inline const std::vector<std::string> regeneration_inputs = {"NWB_fast_L", "NWB_fast_R"};
+
+    void drop_regenerable(bool friend_mode) {
+        /* For --regen-dither: drop regenerable_branches, and write the raw
+         * branches they are regenerated from, unless the input tree is
+         * linked as friend anyway.
+         */
+        auto is_regenerable = [](const BranchSpec* spec) {
+            auto& names = regenerable_branches;
+            return std::find(names.begin(), names.end(), spec->name) != names.end();
+        };
+        this->output_branches.erase(
+            std::remove_if(this->output_branches.begin(), this->output_branches.end(), is_regenerable),
+            this->output_branches.end()
+        );
+        if (friend_mode) return;
+        std::vector<const BranchSpec*> branches;
+        for (auto& spec : branch_specs) {
+            bool is_output = std::find(this->output_branches.begin(), this->output_branches.end(), &spec) != this->output_branches.end();
+            bool is_input = std::find(regeneration_inputs.begin(), regeneration_inputs.end(), spec.name) != regeneration_inputs.end();
+            if (is_output || is_input) branches.push_back(&spec);
+        }
+        this->output_branches = branches; // still in output order
+    }
 
-    // Forward Array
-    tree->Branch("FA_multi",        &container.FA_multi,          "FA_multi/I");
-    tree->Branch("FA_time_min",     &container.FA_time_min,       "FA_time_min/D");
-    tree->Branch("FA_time_mean",    &container.FA_time_mean,      "FA_time_mean/D");
-    tree->Branch("FA_det",          &container.FA_det[0],         "FA_det[FA_multi]/I");
-    tree->Branch("FA_total",        &container.FA_total[0],       "FA_total[FA_multi]/S");
-    tree->Branch("FA_time",         &container.FA_time[0],        "FA_time[FA_multi]/D");
+    static std::vector<std::string> get_patterns(const std::string& name) {
+        if (name == "full") {
+            return {"*"};
+        }
+        if (name == "spectra") {
+            return {"TDC_mb_nw", "MB_multi", "VW_multi", "NWB_*"};
+        }
+        if (name == "nwb-only") {
+            return {"NWB_*"};
+        }
 
-    // Veto Wall
-    tree->Branch("VW_multi",        &container.VW_multi,          "VW_multi/I");
-    tree->Branch("VW_bar",          &container.VW_bar[0],         "VW_bar[VW_multi]/I");
-    tree->Branch("VW_total_T",      &container.VW_total_T[0],     "VW_total_T[VW_multi]/S");
-    tree->Branch("VW_total_B",      &container.VW_total_B[0],     "VW_total_B[VW_multi]/S");
-    tree->Branch("VW_time_T",       &container.VW_time_T[0],      "VW_time_T[VW_multi]/D");
-    tree->Branch("VW_time_B",       &container.VW_time_B[0],      "VW_time_B[VW_multi]/D");
+        std::ifstream file(name);
+        if (!file.is_open()) {
+            std::cerr << "Unknown schema \"" << name << "\"; expected full, spectra, nwb-only or a JSON manifest" << std::endl;
+            exit(1);
+        }
+        Json manifest;
+        try {
+            file >> manifest;
+            return manifest.at("branches").get<std::vector<std::string> >();
+        }
+        catch (...) {
+            std::cerr << "Failed to read the \"branches\" of schema manifest " << name << std::endl;
+            exit(1);
+        }
+    }
+};
 
-    // Neutron Wall A
-    tree->Branch("NWA_multi",       &container.NWA_multi,         "NWA_multi/I");
-    tree->Branch("NWA_bar",         &container.NWA_bar[0],        "NWA_bar[NWA_multi]/I");
+class OutputQuantizer {
+    /* Applies the quantization rules of OutputStorage to the float output
+     * branches of calibrated events, and keeps the largest error of every
+     * branch for the validation report. Thread-safe: every caller computes
+     * the errors of its own events and merges them once per call.
+     */
+public:
+    struct Branch {
+        const BranchSpec* spec;
+        const BranchSpec* counter; // nullptr for scalars
+        OutputStorage::Quantization quantization;
+        double max_error = 0;
+        long n_values = 0; // within range, i.e. quantized
+        long n_unchanged = 0; // out of range, e.g. sentinels
+    };
+    std::vector<Branch> branches;
+
+    OutputQuantizer(const OutputSchema& schema, const OutputStorage& storage) {
+        for (auto* spec : schema.output_branches) {
+            if (std::string(spec->leaflist).back() != 'F') continue;
+            const OutputStorage::Quantization* match = nullptr;
+            for (auto& quantization : storage.quantizations) {
+                for (auto& pattern : quantization.branches) {
+                    if (fnmatch(pattern.c_str(), spec->name, 0) == 0) match = &quantization;
+                }
+            }
+            if (match == nullptr) continue;
+            std::string counter = spec->get_counter();
+            this->branches.push_back({spec, counter.empty() ? nullptr : find_branch_spec(counter), *match});
+        }
+    }
 
-    // Neutron Wall B
-    tree->Branch("NWB_multi",       &container.NWB_multi,         "NWB_multi/I");
-    tree->Branch("NWB_bar",         &container.NWB_bar[0],        "NWB_bar[NWB_multi]/I");
-    tree->Branch("NWB_total_L",     &container.NWB_total_L[0],    "NWB_total_L[NWB_multi]/S");
-    tree->Branch("NWB_total_R",     &container.NWB_total_R[0],    "NWB_total_R[NWB_multi]/S");
-    tree->Branch("NWB_fast_L",      &container.NWB_fast_L[0],     "NWB_fast_L[NWB_multi]/S");
-    tree->Branch("NWB_fast_R",      &container.NWB_fast_R[0],     "NWB_fast_R[NWB_multi]/S");
-    tree->Branch("NWB_time_L",      &container.NWB_time_L[0],     "NWB_time_L[NWB_multi]/D");
-    tree->Branch("NWB_time_R",      &container.NWB_time_R[0],     "NWB_time_R[NWB_multi]/D");
-    /* new / modified branches */
-    tree->Branch("NWB_totalf_L",    &container.NWB_totalf_L[0],   "NWB_totalf_L[NWB_multi]/F");
-    tree->Branch("NWB_totalf_R",    &container.NWB_totalf_R[0],   "NWB_totalf_R[NWB_multi]/F");
-    tree->Branch("NWB_fastf_L",     &container.NWB_fastf_L[0],    "NWB_fastf_L[NWB_multi]/F");
-    tree->Branch("NWB_fastf_R",     &container.NWB_fastf_R[0],    "NWB_fastf_R[NWB_multi]/F");
-    tree->Branch("NWB_tof",         &container.NWB_tof[0],        "NWB_tof[NWB_multi]/F");
-    tree->Branch("NWB_pos_x",       &container.NWB_pos_x[0],      "NWB_pos_x[NWB_multi]/F");
-    tree->Branch("NWB_pos_y",       &container.NWB_pos_y[0],      "NWB_pos_y[NWB_multi]/F");
-    tree->Branch("NWB_pos_z",       &container.NWB_pos_z[0],      "NWB_pos_z[NWB_multi]/F");
-    tree->Branch("NWB_distance",    &container.NWB_distance[0],   "NWB_distance[NWB_multi]/F");
-    tree->Branch("NWB_theta",       &container.NWB_theta[0],      "NWB_theta[NWB_multi]/F");
-    tree->Branch("NWB_phi",         &container.NWB_phi[0],        "NWB_phi[NWB_multi]/F");
-    tree->Branch("NWB_distance_c",  &container.NWB_distance_c[0], "NWB_distance_c[NWB_multi]/F");
-    tree->Branch("NWB_theta_c",     &container.NWB_theta_c[0],    "NWB_theta_c[NWB_multi]/F");
-    tree->Branch("NWB_phi_c",       &container.NWB_phi_c[0],      "NWB_phi_c[NWB_multi]/F");
-    tree->Branch("NWB_light_GM",    &container.NWB_light_GM[0],   "NWB_light_GM[NWB_multi]/F");
-    tree->Branch("NWB_psd",         &container.NWB_psd[0],        "NWB_psd[NWB_multi]/F");
-    tree->Branch("NWB_psd_perp",    &container.NWB_psd_perp[0],   "NWB_psd_perp[NWB_multi]/F");
+    bool empty() const { return this->branches.empty(); }
+
+    void apply(Container* events, int n_events) {
+        std::vector<Branch> local = this->branches; // only the statistics are used
+        for (auto& branch : local) {
+            branch.max_error = 0;
+            branch.n_values = branch.n_unchanged = 0;
+        }
+        for (int i = 0; i < n_events; ++i) {
+            for (auto& branch : local) {
+                float* values = static_cast<float*>(branch.spec->address(events[i]));
+                int n = (branch.counter == nullptr) ? 1 : *static_cast<int*>(branch.counter->address(events[i]));
+                for (int j = 0; j < n; ++j) {
+                    float value = values[j];
+                    if (!(value >= branch.quantization.min && value <= branch.quantization.max)) {
+                        ++branch.n_unchanged;
+                        continue;
+                    }
+                    values[j] = branch.quantization.apply(value);
+                    branch.max_error = std::max(branch.max_error, std::abs(double(values[j]) - double(value)));
+                    ++branch.n_values;
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (std::size_t b = 0; b < local.size(); ++b) {
+            this->branches[b].max_error = std::max(this->branches[b].max_error, local[b].max_error);
+            this->branches[b].n_values += local[b].n_values;
+            this->branches[b].n_unchanged += local[b].n_unchanged;
+        }
+    }
+
+    void report(TFolder* metadata) const {
+        /* Prints the validation report and saves it in the folder "quantization" */
+        if (this->empty()) return;
+        TFolder* folder = metadata->AddFolder("quantization", "");
+        std::cout << Form("%-16s%12s%12s%12s%14s%14s", "quantization", "min", "max", "step", "max error", "unchanged") << std::endl;
+        for (auto& branch : this->branches) {
+            auto& q = branch.quantization;
+            std::cout << Form(
+                "%-16s%12g%12g%12g%14g%14ld", branch.spec->name, q.min, q.max, q.step, branch.max_error, branch.n_unchanged
+            ) << std::endl;
+            folder->Add(new TNamed(branch.spec->name, Form(
+                "min=%g max=%g bits=%d step=%g max_error=%g n_quantized=%ld n_unchanged=%ld",
+                q.min, q.max, q.bits, q.step, branch.max_error, branch.n_values, branch.n_unchanged
+            )));
+        }
+    }
+
+private:
+    std::mutex mutex;
+};
 
+class EventSelection {
+    /* The predicate of --sparse: a conjunction of comparisons of scalar
+     * branches with numbers, e.g. "NWB_multi > 0 && MB_multi >= 2", evaluated
+     * on calibrated events. Counts selected and skipped events; thread-safe.
+     */
+public:
+    struct Term {
+        const BranchSpec* spec;
+        std::string op;
+        double value;
+    };
+    std::string predicate; // empty selects every event
+    std::vector<Term> terms;
+    std::atomic<long> n_selected = 0;
+    std::atomic<long> n_skipped = 0;
+
+    EventSelection(const std::string& predicate = "") : predicate(predicate) {
+        if (predicate.empty()) return;
+        const std::regex term_regex(R"(\s*(\w+)\s*(>=|<=|==|!=|>|<)\s*([-+0-9.eE]+)\s*)");
+        std::size_t begin = 0;
+        while (begin <= predicate.size()) {
+            std::size_t end = std::min(predicate.find("&&", begin), predicate.size());
+            std::string text = predicate.substr(begin, end - begin);
+            std::smatch match;
+            const BranchSpec* spec = nullptr;
+            double value = 0.0;
+            if (std::regex_match(text, match, term_regex)) {
+                spec = find_branch_spec(match[1]);
+                // the whole number must parse, so that e.g. "e" or "1.2.3" are rejected
+                std::string number = match[3];
+                char* number_end = nullptr;
+                value = std::strtod(number.c_str(), &number_end);
+                if (number_end != number.c_str() + number.size()) {
+                    spec = nullptr;
+                }
+            }
+            if (spec == nullptr || spec->get_counter() != "") {
+                std::cerr << "Invalid term \"" << text << "\" of predicate \"" << predicate << "\";";
+                std::cerr << " expected a scalar branch, a comparison and a number" << std::endl;
+                exit(1);
+            }
+            this->terms.push_back({spec, match[2], value});
+            begin = end + 2;
+        }
+    }
+
+    std::vector<std::string> get_branches() const {
+        std::vector<std::string> names;
+        for (auto& term : this->terms) {
+            names.push_back(term.spec->name);
+        }
+        return names;
+    }
+
+    bool evaluate(Container& event) const {
+        for (auto& term : this->terms) {
+            void* address = term.spec->address(event);
+            double x;
+            switch (std::string(term.spec->leaflist).back()) {
+                case 'D': x = *static_cast<double*>(address); break;
+                case 'F': x = *static_cast<float*>(address); break;
+                case 'I': x = *static_cast<int*>(address); break;
+                case 'S': x = *static_cast<short*>(address); break;
+                default: x = *static_cast<long*>(address); break;
+            }
+            bool pass = (term.op == ">") ? x > term.value
+                : (term.op == ">=") ? x >= term.value
+                : (term.op == "<") ? x < term.value
+                : (term.op == "<=") ? x <= term.value
+                : (term.op == "==") ? x == term.value
+                : x != term.value;
+            if (!pass) return false;
+        }
+        return true;
+    }
+
+    void write_metadata(TFolder* metadata) const {
+        if (this->predicate.empty()) return;
+        metadata->Add(new TNamed(this->predicate.c_str(), "sparse_predicate"));
+        metadata->Add(new TNamed(Form("%ld", this->n_selected.load()), "n_selected"));
+        metadata->Add(new TNamed(Form("%ld", this->n_skipped.load()), "n_skipped"));
+    }
+};
+
+TChain* get_input_tree(
+    const std::string& path, const std::string& tree_name, Container& container,
+    const OutputSchema& schema
+) {
+    /* Reads both the flat trees of remove_tclass.exe and the class-based
+     * trees of the framework (--framework): in MakeClass mode, every split
+     * member is read into its own buffer, whatever the branch class.
+     */
+    TChain* chain = new TChain(tree_name.c_str());
+    chain->Add(path.c_str());
+
+    // enable class objects; set before the addresses, which class-based branches interpret by the mode
+    chain->SetMakeClass(1);
+    for (auto* spec : schema.input_branches) {
+        chain->SetBranchAddress(spec->input_name, spec->address(container));
+    }
+
+    // set branch status
+    chain->SetBranchStatus("*", false);
+    for (auto* spec : schema.input_branches) {
+        chain->SetBranchStatus(spec->input_name, true);
+    }
+
+    return chain;
+}
+
+TTree* get_output_tree(
+    TFile* outroot, const std::string& tree_name, Container& container,
+    const OutputSchema& schema, bool with_entry = false
+) {
+    /* With with_entry, the branch "entry" holds the input entry number of
+     * every output entry. In --friend mode, output entry i then aligns with
+     * input entry i whenever the whole input tree is calibrated, and
+     * everything else is read from the input tree through link_friend_tree().
+     * With --regen-dither, it is the entry of the random number keys, and
+     * with --sparse, it maps the selected events back to the input.
+     */
+    outroot->cd();
+    TTree* tree = new TTree(tree_name.c_str(), "");
+    if (with_entry) {
+        tree->Branch("entry", &container.entry, "entry/L");
+    }
+    for (auto* spec : schema.output_branches) {
+        tree->Branch(spec->name, spec->address(container), spec->leaflist);
+    }
     return tree;
 }
+
+void link_friend_tree(TTree* tree, const std::string& inroot_path, const std::string& intree_name) {
+    /* Record the input tree in the user info of the output tree, as
+     * TNamed("raw", "<path>:<tree name>"), and define every input branch
+     * missing from the output as an alias "raw.<input name>". Readers add the
+     * input tree as friend "raw" (e.g. Spectrum.build_rdataframe() in
+     * e15190/neutron_wall/spectra.py), after which all branches of the full
+     * output are available under their usual names.
+     */
+    tree->GetUserInfo()->Add(new TNamed("raw", (inroot_path + ":" + intree_name).c_str()));
+    for (auto& spec : branch_specs) {
+        if (!spec.is_raw() || tree->GetBranch(spec.name) != nullptr) continue;
+        tree->SetAlias(spec.name, (std::string("raw.") + spec.input_name).c_str());
+    }
+}
@@ -1,23 +1,17 @@
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "TError.h"
 #include "TFile.h"
-#include "TTree.h"
+
+#include "TreeIntrospection.h"
 
 int main(int argc, char* argv[]) {
     gErrorIgnoreLevel = kError;
-    TFile* inroot = new TFile(argv[1], "READ");
-    auto keys = gDirectory->GetListOfKeys();
-    std::vector<std::string> tree_names;
-    for (const auto&& key : *keys) {
-        std::string name = key->GetName();
-        auto obj = inroot->Get(name.c_str());
-        if (obj->IsA()->InheritsFrom("TTree")) {
-            tree_names.push_back(name);
-        }
-    }
+    std::unique_ptr<TFile> inroot(TFile::Open(argv[1], "READ"));
+    std::vector<std::string> tree_names = TreeIntrospection::find_tree_names(inroot.get());
     inroot->Close();
 
     if (tree_names.size() == 1) {
@@ -28,4 +22,4 @@ int main(int argc, char* argv[]) {
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -1,85 +1,207 @@
-#include <any>
-#include <array>
-#include <cstdint>
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <map>
 #include <stdexcept>
-#include <sstream>
 #include <string>
-#include <type_traits>
 #include <vector>
 
 #include <nlohmann/json.hpp>
 
+#include "TBasket.h"
 #include "TBranch.h"
-#include "TChain.h"
+#include "TBranchElement.h"
 #include "TError.h"
 #include "TFile.h"
+#include "TLeaf.h"
 #include "TTree.h"
+#include "TVirtualStreamerInfo.h"
 
-const int ARRAY_MULTI = 64;
-struct Container {
-    std::map<char, int> index;
-    std::vector<Short_t> S;
-    std::vector<UShort_t> s;
-    std::vector<Int_t> I;
-    std::vector<Double_t> D;
+#include "TreeIntrospection.h"
 
-    Container();
-    void resize(const std::vector<std::string>& leaflists);
-    void* assign_address(std::string leaflist);
-} container;
+class ColumnArena {
+    /* Buffers of all branches, of any of the 15 leaf types of
+     * TreeIntrospection::type_char_map, in one allocation. Every column
+     * starts on a 64-byte boundary, so that vectorized consumers can load
+     * whole cache lines. Arrays are sized from the largest size recorded in
+     * the input file; a larger size met while reading grows the arena
+     * geometrically, which moves every column, so branch addresses must be
+     * bound again whenever reserve() returns true.
+     */
+public:
+    static constexpr std::size_t alignment = 64;
+    struct Column {
+        std::string leaflist;
+        std::size_t element_size;
+        std::size_t capacity; // in elements
+        std::size_t offset; // in bytes, from the start of the arena
+    };
+    std::vector<Column> columns;
 
-std::string get_cmd_output(const char* cmd);
+    std::size_t add(const std::string& leaflist, std::size_t capacity);
+    void* address(std::size_t i_column);
+    long get_integer(std::size_t i_column) const; // first element of an integer column, e.g. a counter
+    bool reserve(std::size_t i_column, std::size_t capacity);
+
+private:
+    struct alignas(alignment) Line { std::byte bytes[alignment]; };
+    std::vector<Line> lines;
+    std::vector<std::size_t> allocated_bytes; // of every column, as last laid out
+
+    void allocate();
+} arena;
+
+std::filesystem::path get_project_dir();
 std::filesystem::path get_local_path(const std::filesystem::path database_dir, const std::string key);
-std::vector<std::string> get_leaflists(const std::string path, const std::string tree_name);
-std::vector<std::string> get_leaflists(const std::string path);
-std::string extract_branch_name(std::string leaflist);
-char extract_branch_type(std::string leaflist);
-bool is_array(std::string leaflist);
-void* assign_address(std::string leaflist);
+bool has_same_layout(TBranch* branch);
+long copy_baskets(TBranch* from, TBranch* to, long& n_bytes);
+std::vector<long> get_cluster_starts(TTree* tree);
+
+struct ClusterRangeImporter : public TTree {
+    /* TTree::ImportClusterRanges() is protected; TTreeCloner, a friend of
+     * TTree, calls it in the same place for the fast mode of CloneTree().
+     */
+    static void import(TTree* to, TTree* from) {
+        (to->*&ClusterRangeImporter::ImportClusterRanges)(from);
+    }
+};
 
 int main(int argc, char* argv[]) {
+    /* Usage: ./remove_tclass.exe RUN [--no-fast]
+     * By default, branches whose baskets are laid out on disk exactly as the
+     * flat branch would be are copied basket by basket, still compressed;
+     * only the other branches go through the entry loop. The output keeps
+     * the clusters of the input, which the copied baskets are aligned to.
+     * --no-fast reads and refills every branch of every entry, and the
+     * output is clustered by its own auto-flush.
+     */
     int run = std::stoi(argv[1]);
+    bool fast = !(argc > 2 && std::string(argv[2]) == "--no-fast");
 
     gErrorIgnoreLevel = kError;
-    std::filesystem::path PROJECT_DIR = get_cmd_output("echo $PROJECT_DIR");
+    std::filesystem::path PROJECT_DIR = get_project_dir();
     std::filesystem::path inroot_dir = get_local_path(PROJECT_DIR / "database", "daniele_root_files_dir");
     std::string filename = Form("CalibratedData_%04d.root", run);
     std::filesystem::path inpath = inroot_dir / filename;
     std::filesystem::path outpath = PROJECT_DIR / "database/root_files_daniele" / inpath.filename();
 
-    std::map<std::string, void*> addr_map;
-    auto leaflists = get_leaflists(inpath.string());
-    container.resize(leaflists);
+    // the input file stays open; its tree is read directly
+    TreeIntrospection introspection(inpath.string());
+    auto& leaflists = introspection.leaflists;
+    std::string tree_name = introspection.tree_name;
+    TTree* intree = introspection.get_tree();
 
-    std::string tree_name = get_cmd_output(Form("modular_scripts/infer_tree_name.exe %s", inpath.string().c_str()));
-    auto intree = new TChain(tree_name.c_str());
-    intree->Add(inpath.string().c_str());
     auto outroot = new TFile(outpath.string().c_str(), "RECREATE");
     auto outtree = new TTree(tree_name.c_str(), outpath.filename().string().c_str());
 
+    // input and output branches share their buffers
+    struct BranchPair {
+        TBranch* in;
+        TBranch* out;
+        long first_entry; // of the entry loop; entries before are copied as baskets
+        TBranch* count; // size of arrays, read first as it may have been copied
+        std::size_t i_column;
+        long i_count_column; // -1 for scalars and fixed-size arrays
+        int len_static; // elements per count, e.g. 2 for "x[n][2]"
+    };
+    std::vector<BranchPair> branch_pairs;
     intree->SetMakeClass(1);
     intree->SetBranchStatus("*", false);
+    std::map<std::string, std::size_t> column_indices;
     for (auto& leaflist : leaflists) {
         auto name = extract_branch_name(leaflist);
+        auto inbranch = intree->GetBranch(name.c_str());
+        TLeaf* leaf = inbranch->FindLeaf(name.c_str());
+        TLeaf* count = leaf->GetLeafCount();
 
+        // fixed sizes are part of the leaf; variable sizes are bounded by the largest count written
+        std::size_t capacity = std::max(leaf->GetLenStatic(), 1);
+        if (count != nullptr) {
+            capacity *= std::max(count->GetMaximum(), 1);
+        }
+        column_indices[name] = arena.add(leaflist, capacity);
+        branch_pairs.push_back({
+            inbranch, nullptr, 0, (count == nullptr) ? nullptr : count->GetBranch(),
+            column_indices[name], -1, std::max(leaf->GetLenStatic(), 1)
+        });
+    }
+    for (auto& pair : branch_pairs) {
+        auto& leaflist = arena.columns[pair.i_column].leaflist;
+        std::string name = extract_branch_name(leaflist);
+        if (pair.count != nullptr) {
+            pair.i_count_column = column_indices.at(pair.count->GetName());
+        }
         intree->SetBranchStatus(name.c_str(), true);
-        addr_map[name] = container.assign_address(leaflist);
-        intree->SetBranchAddress(name.c_str(), addr_map[name]);
+        intree->SetBranchAddress(name.c_str(), arena.address(pair.i_column));
+        pair.out = outtree->Branch(name.c_str(), arena.address(pair.i_column), leaflist.c_str());
+    }
+    auto bind_addresses = [&]() {
+        for (auto& pair : branch_pairs) {
+            intree->SetBranchAddress(pair.in->GetName(), arena.address(pair.i_column));
+            pair.out->SetAddress(arena.address(pair.i_column));
+        }
+    };
 
-        outtree->Branch(name.c_str(), addr_map[name], leaflist.c_str());
+    long n_entries = intree->GetEntries();
+    long n_fast = 0, n_copied_bytes = 0;
+    if (fast) {
+        // before any entry is added, since the ranges are appended after the current entries
+        ClusterRangeImporter::import(outtree, intree);
+        for (auto& pair : branch_pairs) {
+            if (!has_same_layout(pair.in)) continue;
+            pair.first_entry = copy_baskets(pair.in, pair.out, n_copied_bytes);
+            n_fast += (pair.first_entry == n_entries);
+        }
+        std::cout << Form("> %ld of %lu branches copied as baskets (%.1f MB)", n_fast, branch_pairs.size(), n_copied_bytes / 1e6) << std::endl;
     }
 
-    int n_entries = intree->GetEntries();
-    for (int i_entry = 0; i_entry < n_entries; i_entry++) {
+    // everything else, i.e. converted branches and the last baskets of copied
+    // ones if they were not written to disk, goes through the entry loop;
+    // without copies, the whole tree is filled
+    std::vector<BranchPair> loop_pairs;
+    for (auto& pair : branch_pairs) {
+        if (pair.first_entry < n_entries) loop_pairs.push_back(pair);
+    }
+    bool fill_tree = !fast;
+    std::vector<long> cluster_starts = get_cluster_starts(intree);
+    auto next_cluster = cluster_starts.begin();
+    for (long i_entry = 0; i_entry < n_entries && !loop_pairs.empty(); i_entry++) {
         if (i_entry % 2357 == 0) {
             std::cout << Form("\r> %6.2f", 100.0 * i_entry / n_entries) << "%" << std::flush;
         }
-        intree->GetEntry(i_entry);
-        outtree->Fill();
+
+        // branches filled one by one are never auto-flushed; their baskets end with the clusters instead
+        if (!fill_tree && next_cluster != cluster_starts.end() && *next_cluster == i_entry) {
+            for (auto& pair : loop_pairs) {
+                if (i_entry > pair.first_entry) pair.out->FlushBaskets();
+            }
+            ++next_cluster;
+        }
+
+        for (auto& pair : loop_pairs) {
+            if (i_entry < pair.first_entry) continue;
+            if (pair.count != nullptr) {
+                pair.count->GetEntry(i_entry);
+                if (arena.reserve(pair.i_column, arena.get_integer(pair.i_count_column) * pair.len_static)) {
+                    bind_addresses();
+                }
+            }
+            pair.in->GetEntry(i_entry);
+        }
+        if (fill_tree) {
+            outtree->Fill();
+            continue;
+        }
+        for (auto& pair : loop_pairs) {
+            if (i_entry >= pair.first_entry) pair.out->Fill();
+        }
+    }
+    if (!fill_tree) {
+        outtree->SetEntries(n_entries);
     }
     std::cout << Form("\r> %6.2f", 100.0) << "%" << std::endl;
 
@@ -90,17 +212,12 @@ int main(int argc, char* argv[]) {
     return 0;
 }
 
-std::string get_cmd_output(const char* cmd) {
-    std::array<char, 128> buffer;
-    std::string result;
-    auto pipe = popen(cmd, "r");
-    if (!pipe) throw std::runtime_error("popen() failed!");
-    while (!feof(pipe)) {
-        if (fgets(buffer.data(), 128, pipe) != nullptr)
-            result += buffer.data();
-    }
-    result.erase(std::remove(result.end() - 1, result.end(), '\n'), result.end());
-    return result;
+std::filesystem::path get_project_dir() {
+    const char* project_dir = std::getenv("PROJECT_DIR");
+    if (project_dir == nullptr) {
+        throw std::runtime_error("Environment variable $PROJECT_DIR is not defined in current session");
+    }
+    return std::filesystem::path(project_dir);
 }
 
 std::filesystem::path get_local_path(const std::filesystem::path database_dir, const std::string key) {
@@ -112,73 +229,144 @@ std::filesystem::path get_local_path(const std::filesystem::path database_dir, c
     return std::filesystem::path(local_paths_json[key]);
 }
 
-std::vector<std::string> get_leaflists(const std::string path, const std::string tree_name) {
-    std::string output = get_cmd_output(Form("modular_scripts/output_leaflists.exe %s %s", path.c_str(), tree_name.c_str()));
-    std::vector<std::string> leaflists;
-    std::stringstream ss(output);
-    std::string line;
-    while (std::getline(ss, line)) {
-        leaflists.push_back(line);
-    }
-    return leaflists;
+bool has_same_layout(TBranch* branch) {
+    /* Whether the baskets of branch hold exactly the bytes of a flat branch
+     * with the same leaflist: plain leaf branches, and split members of
+     * basic types or fixed-size arrays of them. Variable-size arrays of
+     * split classes are prefixed by a flag byte per entry, and Double32_t
+     * and Float16_t depend on the streamer info, so both are converted.
+     */
+    TLeaf* leaf = branch->FindLeaf(branch->GetName());
+    if (leaf == nullptr || leaf->GetLeafCount() != nullptr) return false;
+    auto element = dynamic_cast<TBranchElement*>(branch);
+    if (element == nullptr) return branch->GetListOfLeaves()->GetEntries() == 1;
+
+    int type = element->GetStreamerType();
+    int basic_type = (type > TVirtualStreamerInfo::kOffsetL && type < TVirtualStreamerInfo::kOffsetP)
+        ? type - TVirtualStreamerInfo::kOffsetL : type;
+    bool is_basic = (basic_type > 0 && basic_type < TVirtualStreamerInfo::kOffsetL);
+    bool is_compressed_float = (basic_type == TVirtualStreamerInfo::kDouble32 || basic_type == TVirtualStreamerInfo::kFloat16);
+    return element->GetType() == 0 && element->GetID() >= 0 && is_basic && !is_compressed_float;
 }
 
-std::vector<std::string> get_leaflists(const std::string path) {
-    std::string tree_name = get_cmd_output(Form("modular_scripts/infer_tree_name.exe %s", path.c_str()));
-    if (tree_name.substr(0, 5) == "ERROR") {
-        throw std::runtime_error(tree_name);
+long copy_baskets(TBranch* from, TBranch* to, long& n_bytes) {
+    /* Copies the baskets that from has written to disk to the end of the file
+     * of to, without decompressing them, the way TTreeCloner does for the
+     * fast mode of TTree::CloneTree(): the empty write basket of to carries
+     * every copy, and a new one is created by the next Fill(). Baskets that
+     * were kept in memory with the tree are left to the entry loop. Returns
+     * the first entry that was not copied.
+     */
+    TFile* infile = from->GetFile();
+    TFile* outfile = to->GetFile();
+    auto baskets = to->GetListOfBaskets();
+    TBasket* basket = static_cast<TBasket*>(baskets->UncheckedAt(to->GetWriteBasket()));
+    if (basket != nullptr) {
+        baskets->RemoveAt(to->GetWriteBasket());
+    }
+    else {
+        basket = to->GetTree()->CreateBasket(to);
     }
-    return get_leaflists(path, tree_name);
-}
 
-std::string extract_branch_name(std::string leaflist) {
-    auto pos_slash = leaflist.find("/");
-    auto str = leaflist.substr(0, pos_slash);
-    auto square_bracket_pos = str.find("[");
-    return str.substr(0, square_bracket_pos);
+    long first_entry = 0;
+    for (int i = 0; i < from->GetWriteBasket(); ++i) {
+        Long64_t seek = from->GetBasketSeek(i);
+        Int_t length = from->GetBasketBytes()[i];
+        if (seek == 0 || length == 0) break;
+        basket->LoadBasketBuffers(seek, length, infile, from->GetTree());
+        basket->CopyTo(outfile);
+        to->AddBasket(*basket, true, from->GetBasketEntry()[i]);
+        first_entry = from->GetBasketEntry()[i + 1];
+        n_bytes += length;
+    }
+    to->AddLastBasket(first_entry);
+    delete basket;
+    return first_entry;
 }
 
-char extract_branch_type(std::string leaflist) {
-    auto pos_slash = leaflist.find("/");
-    std::string type = leaflist.substr(pos_slash + 1);
-    if (type.size() != 1) {
-        throw std::runtime_error("leaflist has more than one character");
+std::vector<long> get_cluster_starts(TTree* tree) {
+    /* First entry of every cluster after the first one */
+    std::vector<long> starts;
+    auto cluster_iter = tree->GetClusterIterator(0);
+    long start;
+    while ((start = cluster_iter()) < tree->GetEntries()) {
+        if (start > 0) starts.push_back(start);
     }
-    return type[0];
+    return starts;
 }
 
-bool is_array(std::string leaflist) {
-    return (leaflist.find("[") != std::string::npos);
+std::size_t ColumnArena::add(const std::string& leaflist, std::size_t capacity) {
+    static const std::map<char, std::size_t> element_sizes = {
+        {'B', sizeof(Char_t)},      {'b', sizeof(UChar_t)},
+        {'S', sizeof(Short_t)},     {'s', sizeof(UShort_t)},
+        {'I', sizeof(Int_t)},       {'i', sizeof(UInt_t)},
+        {'F', sizeof(Float_t)},     {'f', sizeof(Float16_t)},
+        {'D', sizeof(Double_t)},    {'d', sizeof(Double32_t)},
+        {'L', sizeof(Long64_t)},    {'l', sizeof(ULong64_t)},
+        {'G', sizeof(Long_t)},      {'g', sizeof(ULong_t)},
+        {'O', sizeof(Bool_t)},
+    };
+    char type = extract_branch_type(leaflist);
+    if (element_sizes.count(type) == 0) {
+        throw std::runtime_error("leaflist \"" + leaflist + "\" has an unsupported type");
+    }
+    this->columns.push_back({leaflist, element_sizes.at(type), capacity, 0});
+    this->allocate();
+    return this->columns.size() - 1;
 }
 
-Container::Container() {
-    this->index['S'] = 0;
-    this->index['s'] = 0;
-    this->index['I'] = 0;
-    this->index['D'] = 0;
+void* ColumnArena::address(std::size_t i_column) {
+    return reinterpret_cast<std::byte*>(this->lines.data()) + this->columns[i_column].offset;
 }
 
-void Container::resize(const std::vector<std::string>& leaflists) {
-    std::map<char, int> sizes;
-    for (const auto& leaflist : leaflists) {
-        auto type = extract_branch_type(leaflist);
-        sizes[type] += (is_array(leaflist) ? ARRAY_MULTI : 1);
+long ColumnArena::get_integer(std::size_t i_column) const {
+    const std::byte* data = reinterpret_cast<const std::byte*>(this->lines.data()) + this->columns[i_column].offset;
+    switch (extract_branch_type(this->columns[i_column].leaflist)) {
+        case 'B': return *reinterpret_cast<const Char_t*>(data);
+        case 'b': return *reinterpret_cast<const UChar_t*>(data);
+        case 'S': return *reinterpret_cast<const Short_t*>(data);
+        case 's': return *reinterpret_cast<const UShort_t*>(data);
+        case 'I': return *reinterpret_cast<const Int_t*>(data);
+        case 'i': return *reinterpret_cast<const UInt_t*>(data);
+        case 'L': return *reinterpret_cast<const Long64_t*>(data);
+        case 'l': return *reinterpret_cast<const ULong64_t*>(data);
+        case 'G': return *reinterpret_cast<const Long_t*>(data);
+        case 'g': return *reinterpret_cast<const ULong_t*>(data);
     }
+    throw std::runtime_error("leaflist \"" + this->columns[i_column].leaflist + "\" is not an integer");
+}
 
-    this->S.resize(sizes['S']);
-    this->s.resize(sizes['s']);
-    this->I.resize(sizes['I']);
-    this->D.resize(sizes['D']);
+bool ColumnArena::reserve(std::size_t i_column, std::size_t capacity) {
+    /* Returns whether the columns have moved */
+    auto& column = this->columns[i_column];
+    if (capacity <= column.capacity) return false;
+    column.capacity = std::max(capacity, 2 * column.capacity);
+    this->allocate();
+    return true;
 }
 
-void* Container::assign_address(std::string leaflist) {
-    void* result;
-    char type = extract_branch_type(leaflist);
-    int i = this->index[type];
-    if      (type == 'S') result = &this->S[i];
-    else if (type == 's') result = &this->s[i];
-    else if (type == 'I') result = &this->I[i];
-    else if (type == 'D') result = &this->D[i];
-    this->index[type] += (is_array(leaflist) ? ARRAY_MULTI : 1);
-    return result;
-}
\ No newline at end of file
+void ColumnArena::allocate() {
+    /* Lays the columns out again and moves the contents of those already allocated */
+    std::vector<Line> old_lines;
+    std::swap(old_lines, this->lines);
+    std::vector<std::size_t> old_offsets;
+    std::size_t n_lines = 0;
+    for (auto& column : this->columns) {
+        old_offsets.push_back(column.offset);
+        column.offset = n_lines * alignment;
+        n_lines += (column.element_size * column.capacity + alignment - 1) / alignment;
+    }
+    this->lines.resize(n_lines);
+
+    for (std::size_t i = 0; i < this->allocated_bytes.size(); ++i) {
+        std::memcpy(
+            reinterpret_cast<std::byte*>(this->lines.data()) + this->columns[i].offset,
+            reinterpret_cast<std::byte*>(old_lines.data()) + old_offsets[i],
+            this->allocated_bytes[i]
+        );
+    }
+    this->allocated_bytes.clear();
+    for (auto& column : this->columns) {
+        this->allocated_bytes.push_back(column.element_size * column.capacity);
+    }
+}
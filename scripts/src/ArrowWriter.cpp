@@ -0,0 +1,166 @@
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef WITH_ARROW
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <arrow/ipc/writer.h>
+#include <arrow/util/key_value_metadata.h>
+#endif
+
+#include "ArrowWriter.h"
+
+#ifdef WITH_ARROW
+
+static void check(const arrow::Status& status, const std::string& what) {
+    if (!status.ok()) {
+        std::cerr << "ERROR: Arrow failed to " << what << ": " << status.ToString() << std::endl;
+        exit(1);
+    }
+}
+
+static std::shared_ptr<arrow::DataType> get_arrow_type(char type) {
+    switch (type) {
+        case 'D': return arrow::float64();
+        case 'F': return arrow::float32();
+        case 'L': return arrow::int64();
+        case 'I': return arrow::int32();
+        case 'S': return arrow::int16();
+    }
+    std::cerr << "ERROR: leaf type '" << type << "' has no Arrow counterpart" << std::endl;
+    exit(1);
+}
+
+template <typename ArrowType>
+static arrow::Status append_values(arrow::ArrayBuilder* builder, const char* ptr, int n) {
+    using CType = typename ArrowType::c_type;
+    return static_cast<arrow::NumericBuilder<ArrowType>*>(builder)->AppendValues(reinterpret_cast<const CType*>(ptr), n);
+}
+
+struct ArrowWriter::Impl {
+    std::vector<Column> columns;
+    std::shared_ptr<arrow::Schema> schema;
+    std::vector<std::unique_ptr<arrow::ArrayBuilder> > builders;
+    std::vector<arrow::ArrayBuilder*> value_builders; // the builder of the values of lists, or the builder itself
+    std::shared_ptr<arrow::io::FileOutputStream> sink;
+    std::shared_ptr<arrow::ipc::RecordBatchWriter> writer;
+    long batch_size;
+    long n_rows = 0;
+
+    void append(std::size_t i, const char* ptr, int n) {
+        arrow::Status status;
+        switch (this->columns[i].type) {
+            case 'D': status = append_values<arrow::DoubleType>(this->value_builders[i], ptr, n); break;
+            case 'F': status = append_values<arrow::FloatType>(this->value_builders[i], ptr, n); break;
+            case 'L': status = append_values<arrow::Int64Type>(this->value_builders[i], ptr, n); break;
+            case 'I': status = append_values<arrow::Int32Type>(this->value_builders[i], ptr, n); break;
+            case 'S': status = append_values<arrow::Int16Type>(this->value_builders[i], ptr, n); break;
+        }
+        check(status, "append " + this->columns[i].name);
+    }
+
+    void write_batch() {
+        if (this->n_rows == 0) return;
+        std::vector<std::shared_ptr<arrow::Array> > arrays(this->builders.size());
+        for (std::size_t i = 0; i < this->builders.size(); ++i) {
+            check(this->builders[i]->Finish(&arrays[i]), "finish " + this->columns[i].name);
+        }
+        auto batch = arrow::RecordBatch::Make(this->schema, this->n_rows, arrays);
+        check(this->writer->WriteRecordBatch(*batch), "write a record batch");
+        this->n_rows = 0;
+    }
+};
+
+ArrowWriter::ArrowWriter(
+    const std::string& path, const std::vector<Column>& columns,
+    const std::vector<std::pair<std::string, std::string> >& metadata, long batch_size
+) : impl(std::make_unique<Impl>()) {
+    auto& impl = *this->impl;
+    impl.columns = columns;
+    impl.batch_size = batch_size;
+
+    std::vector<std::shared_ptr<arrow::Field> > fields;
+    for (auto& column : columns) {
+        auto type = get_arrow_type(column.type);
+        if (column.counter_offset >= 0) {
+            type = arrow::list(type);
+        }
+        fields.push_back(arrow::field(column.name, type, false));
+
+        std::unique_ptr<arrow::ArrayBuilder> builder;
+        check(arrow::MakeBuilder(arrow::default_memory_pool(), type, &builder), "create a builder for " + column.name);
+        auto* list_builder = dynamic_cast<arrow::ListBuilder*>(builder.get());
+        impl.value_builders.push_back(list_builder ? list_builder->value_builder() : builder.get());
+        impl.builders.push_back(std::move(builder));
+    }
+
+    std::vector<std::string> keys, values;
+    for (auto& [key, value] : metadata) {
+        keys.push_back(key);
+        values.push_back(value);
+    }
+    impl.schema = arrow::schema(fields, arrow::key_value_metadata(keys, values));
+
+    auto sink = arrow::io::FileOutputStream::Open(path);
+    check(sink.status(), "open " + path);
+    impl.sink = *sink;
+    auto writer = arrow::ipc::MakeFileWriter(impl.sink, impl.schema);
+    check(writer.status(), "start " + path);
+    impl.writer = *writer;
+}
+
+ArrowWriter::~ArrowWriter() {
+    this->close();
+}
+
+void ArrowWriter::fill(const void* event) {
+    auto& impl = *this->impl;
+    const char* base = static_cast<const char*>(event);
+    for (std::size_t i = 0; i < impl.columns.size(); ++i) {
+        auto& column = impl.columns[i];
+        if (column.counter_offset < 0) {
+            impl.append(i, base + column.offset, 1);
+            continue;
+        }
+        int n = *reinterpret_cast<const int*>(base + column.counter_offset);
+        check(static_cast<arrow::ListBuilder*>(impl.builders[i].get())->Append(), "append " + column.name);
+        impl.append(i, base + column.offset, n);
+    }
+    if (++impl.n_rows == impl.batch_size) {
+        impl.write_batch();
+    }
+}
+
+void ArrowWriter::close() {
+    if (this->impl == nullptr || this->impl->writer == nullptr) return;
+    auto& impl = *this->impl;
+    impl.write_batch();
+    check(impl.writer->Close(), "write the footer");
+    check(impl.sink->Close(), "close the file");
+    impl.writer = nullptr;
+}
+
+#else
+
+struct ArrowWriter::Impl { };
+
+ArrowWriter::ArrowWriter(
+    const std::string& path, const std::vector<Column>& columns,
+    const std::vector<std::pair<std::string, std::string> >& metadata, long batch_size
+) {
+    std::cerr << "ERROR: cannot write " << path << ": built without Arrow; rebuild with `make calibrate ARROW=1`" << std::endl;
+    exit(1);
+}
+
+ArrowWriter::~ArrowWriter() { }
+
+void ArrowWriter::fill(const void* event) { }
+
+void ArrowWriter::close() { }
+
+#endif
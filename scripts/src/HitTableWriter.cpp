@@ -0,0 +1,171 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "TDirectory.h"
+#include "TList.h"
+#include "TNamed.h"
+#include "TString.h"
+#include "TTree.h"
+
+#include "HitTableWriter.h"
+
+HitTableWriter::HitTableWriter(
+    const std::string& tree_name, const std::vector<Column>& event_columns,
+    const std::vector<Column>& hit_columns, std::ptrdiff_t entry_offset,
+    const std::string& cluster_column, std::size_t max_buffer_bytes
+) : tree_name(tree_name), event_columns(event_columns), hit_columns(hit_columns), entry_offset(entry_offset),
+    max_buffer_bytes(max_buffer_bytes) {
+    if (hit_columns.empty()) {
+        std::cerr << "ERROR: hit table \"" << tree_name << "\" has no hit columns" << std::endl;
+        exit(1);
+    }
+    this->counter_offset = hit_columns[0].counter_offset;
+    this->cluster_index = hit_columns.size();
+    for (std::size_t i = 0; i < hit_columns.size(); ++i) {
+        if (hit_columns[i].counter_offset < 0 || hit_columns[i].counter_offset != this->counter_offset) {
+            std::cerr << "ERROR: hit column " << hit_columns[i].name << " is not an array of the same counter as " << hit_columns[0].name << std::endl;
+            exit(1);
+        }
+        if (hit_columns[i].name == cluster_column) {
+            this->cluster_index = i;
+        }
+    }
+    if (this->cluster_index == hit_columns.size() || hit_columns[this->cluster_index].type != 'I') {
+        std::cerr << "ERROR: hit table \"" << tree_name << "\" must have an integer hit column " << cluster_column << std::endl;
+        exit(1);
+    }
+    for (auto& column : event_columns) {
+        if (column.counter_offset >= 0) {
+            std::cerr << "ERROR: event column " << column.name << " of a hit table must be a scalar" << std::endl;
+            exit(1);
+        }
+    }
+
+    // every field is aligned to its own size, so that rows can be read in place
+    this->row_size = sizeof(long) + sizeof(int);
+    auto place = [this](char type) {
+        std::size_t size = HitTableWriter::get_size(type);
+        std::size_t offset = (this->row_size + size - 1) / size * size;
+        this->row_size = offset + size;
+        return offset;
+    };
+    for (auto& column : event_columns) {
+        this->event_offsets.push_back(place(column.type));
+    }
+    for (auto& column : hit_columns) {
+        this->hit_offsets.push_back(place(column.type));
+    }
+    this->row_size = (this->row_size + sizeof(long) - 1) / sizeof(long) * sizeof(long);
+}
+
+void HitTableWriter::fill(const void* event) {
+    const char* base = static_cast<const char*>(event);
+    long entry = *reinterpret_cast<const long*>(base + this->entry_offset);
+    int n_hits = *reinterpret_cast<const int*>(base + this->counter_offset);
+    const Column& cluster = this->hit_columns[this->cluster_index];
+    for (int hit = 0; hit < n_hits; ++hit) {
+        int value = reinterpret_cast<const int*>(base + cluster.offset)[hit];
+        std::vector<char>& rows = this->groups[value];
+        std::size_t start = rows.size();
+        rows.resize(start + this->row_size);
+        char* row = rows.data() + start;
+
+        std::memcpy(row, &entry, sizeof(long));
+        std::memcpy(row + sizeof(long), &hit, sizeof(int));
+        for (std::size_t i = 0; i < this->event_columns.size(); ++i) {
+            auto& column = this->event_columns[i];
+            std::memcpy(row + this->event_offsets[i], base + column.offset, HitTableWriter::get_size(column.type));
+        }
+        for (std::size_t i = 0; i < this->hit_columns.size(); ++i) {
+            auto& column = this->hit_columns[i];
+            std::size_t size = HitTableWriter::get_size(column.type);
+            std::memcpy(row + this->hit_offsets[i], base + column.offset + hit * size, size);
+        }
+        this->buffered_bytes += this->row_size;
+    }
+    if (this->buffered_bytes >= this->max_buffer_bytes) {
+        this->spill();
+    }
+}
+
+void HitTableWriter::spill() {
+    /* Appends the rows of every group to its temporary file and frees them */
+    for (auto& [value, rows] : this->groups) {
+        if (rows.empty()) continue;
+        auto& file = this->spills[value];
+        if (file == nullptr) {
+            file.reset(std::tmpfile());
+        }
+        if (file == nullptr || std::fwrite(rows.data(), 1, rows.size(), file.get()) != rows.size()) {
+            std::cerr << "ERROR: failed to write hits of " << this->tree_name << " to a temporary file" << std::endl;
+            exit(1);
+        }
+        std::vector<char>().swap(rows);
+    }
+    this->buffered_bytes = 0;
+}
+
+void HitTableWriter::write(TDirectory* directory, const OutputStorage& storage) {
+    std::vector<long> buffer(this->row_size / sizeof(long));
+    char* row = reinterpret_cast<char*>(buffer.data());
+
+    directory->cd();
+    TTree* tree = new TTree(this->tree_name.c_str(), this->tree_name.c_str());
+    tree->Branch("entry", row, "entry/L");
+    tree->Branch("hit", row + sizeof(long), "hit/I");
+    for (std::size_t i = 0; i < this->event_columns.size(); ++i) {
+        auto& column = this->event_columns[i];
+        tree->Branch(column.name.c_str(), row + this->event_offsets[i], Form("%s/%c", column.name.c_str(), column.type));
+    }
+    for (std::size_t i = 0; i < this->hit_columns.size(); ++i) {
+        auto& column = this->hit_columns[i];
+        tree->Branch(column.name.c_str(), row + this->hit_offsets[i], Form("%s/%c", column.name.c_str(), column.type));
+    }
+    storage.apply(tree);
+    tree->SetAutoFlush(0); // clusters are cut by hand, one per group
+
+    std::vector<char> chunk(4096 * this->row_size);
+    for (auto& [value, rows] : this->groups) {
+        Long64_t first = tree->GetEntries();
+        if (this->spills.count(value) > 0) {
+            std::FILE* file = this->spills[value].get();
+            std::rewind(file);
+            std::size_t n_bytes;
+            while ((n_bytes = std::fread(chunk.data(), 1, chunk.size(), file)) > 0) {
+                for (std::size_t start = 0; start + this->row_size <= n_bytes; start += this->row_size) {
+                    std::memcpy(row, chunk.data() + start, this->row_size);
+                    tree->Fill();
+                }
+            }
+            this->spills.erase(value);
+        }
+        for (std::size_t start = 0; start < rows.size(); start += this->row_size) {
+            std::memcpy(row, rows.data() + start, this->row_size);
+            tree->Fill();
+        }
+        tree->FlushBaskets(); // also ends the cluster
+        tree->GetUserInfo()->Add(new TNamed(Form("%d", value), Form("%lld %lld", first, tree->GetEntries())));
+        std::vector<char>().swap(rows);
+    }
+    this->groups.clear();
+    this->buffered_bytes = 0;
+    tree->Write();
+    delete tree;
+}
+
+std::size_t HitTableWriter::get_size(char type) {
+    switch (type) {
+        case 'D': return sizeof(double);
+        case 'F': return sizeof(float);
+        case 'L': return sizeof(long);
+        case 'I': return sizeof(int);
+        case 'S': return sizeof(short);
+    }
+    std::cerr << "ERROR: leaf type '" << type << "' is not supported in hit tables" << std::endl;
+    exit(1);
+}
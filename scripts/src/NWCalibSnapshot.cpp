@@ -0,0 +1,256 @@
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+#include "TFolder.h"
+#include "TNamed.h"
+#include "TString.h"
+
+#include "NWCalibSnapshot.h"
+#include "NWCalibration.h"
+#include "UniformGridTable.h"
+
+static_assert(std::is_trivially_copyable_v<NWBarCalibParams>, "NWBarCalibParams is written to snapshots as raw bytes");
+
+/*************************/
+/*****NWCalibSnapshot*****/
+/*************************/
+NWCalibSnapshot::NWCalibSnapshot(const std::filesystem::path& path) : path(path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(Header)) {
+        void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            this->data = static_cast<const char*>(addr);
+            this->size = st.st_size;
+        }
+    }
+    close(fd);
+}
+
+NWCalibSnapshot::~NWCalibSnapshot() {
+    if (this->data != nullptr) {
+        munmap(const_cast<char*>(this->data), this->size);
+    }
+}
+
+bool NWCalibSnapshot::is_valid(std::uint64_t source_hash, char AB, int run) const {
+    if (this->data == nullptr) {
+        return false;
+    }
+    const Header& header = this->header();
+    return (
+        std::memcmp(header.magic, NWCalibSnapshot::magic, sizeof(header.magic)) == 0
+        && header.version == NWCalibSnapshot::version
+        && header.bar_size == sizeof(NWBarCalibParams)
+        && header.source_hash == source_hash
+        && header.AB == AB
+        && header.run == run
+        && header.file_size == this->size
+    );
+}
+
+std::unique_ptr<NWCalibTable> NWCalibSnapshot::make_table() const {
+    const Header& header = this->header();
+    auto table = std::make_unique<NWCalibTable>();
+    table->AB = header.AB;
+    table->run = header.run;
+    std::memcpy(table->bars.data(), this->data + header.bars_offset, sizeof(table->bars));
+
+    auto* tables = reinterpret_cast<const Table*>(this->data + header.tables_offset);
+    auto* coeffs = reinterpret_cast<const std::array<double, 4>*>(this->data + header.coeffs_offset);
+    for (int bar = 0; bar <= NWCalibTable::n_bars; ++bar) {
+        for (int i = 0; i < NWCalibTable::n_psd_tables; ++i) {
+            const Table& src = tables[bar * NWCalibTable::n_psd_tables + i];
+            UniformGridTable& dst = table->psd_tables[bar][i];
+            dst.x_min = src.x_min;
+            dst.x_max = src.x_max;
+            dst.inv_h = src.inv_h;
+            dst.max_error = src.max_error;
+            dst.n_cells = src.n_cells;
+            dst.coeffs.assign(coeffs + src.first_coeff, coeffs + src.first_coeff + src.n_cells);
+        }
+    }
+    table->link_psd_tables();
+    return table;
+}
+
+void NWCalibSnapshot::write_metadata(TFolder* folder) const {
+    /* Recreate the folders written by NWCalibParamReaders::write_metadata() */
+    const Header& header = this->header();
+    const char* ptr = this->data + header.metadata_offset;
+    const char* end = ptr + header.metadata_size;
+    TFolder* subfolder = nullptr;
+    std::string subfolder_name;
+    while (ptr < end) {
+        std::string folder_name = ptr; ptr += folder_name.size() + 1;
+        std::string name = ptr; ptr += name.size() + 1;
+        std::string title = ptr; ptr += title.size() + 1;
+        if (subfolder == nullptr || folder_name != subfolder_name) {
+            subfolder = folder->AddFolder(folder_name.c_str(), "");
+            subfolder_name = folder_name;
+        }
+        if (name != "") {
+            subfolder->Add(new TNamed(name.c_str(), title.c_str()));
+        }
+    }
+}
+
+void NWCalibSnapshot::write(
+    const std::filesystem::path& path, const NWCalibTable& table,
+    TFolder* metadata, std::uint64_t source_hash
+) {
+    /* Written to a temporary file first, then renamed, so that concurrent
+     * jobs never map a half-written snapshot.
+     */
+    auto align = [](std::uint64_t offset) { return (offset + 63) / 64 * 64; };
+
+    // PSD tables and their cells
+    std::vector<Table> tables;
+    std::vector<std::array<double, 4> > coeffs;
+    for (int bar = 0; bar <= NWCalibTable::n_bars; ++bar) {
+        for (auto& src : table.psd_tables[bar]) {
+            tables.push_back({src.x_min, src.x_max, src.inv_h, src.max_error, src.n_cells, coeffs.size()});
+            coeffs.insert(coeffs.end(), src.coeffs.begin(), src.coeffs.end());
+        }
+    }
+
+    // metadata; every subfolder gets at least one triplet, so that empty ones survive
+    std::string meta;
+    auto append = [&meta](const char* str) { meta.append(str); meta.push_back('\0'); };
+    for (TObject* obj : *metadata->GetListOfFolders()) {
+        auto* subfolder = dynamic_cast<TFolder*>(obj);
+        if (subfolder == nullptr) continue;
+        append(subfolder->GetName()); append(""); append("");
+        for (TObject* item : *subfolder->GetListOfFolders()) {
+            append(subfolder->GetName()); append(item->GetName()); append(item->GetTitle());
+        }
+    }
+
+    Header header = {};
+    std::memcpy(header.magic, NWCalibSnapshot::magic, sizeof(header.magic));
+    header.version = NWCalibSnapshot::version;
+    header.bar_size = sizeof(NWBarCalibParams);
+    header.source_hash = source_hash;
+    header.run = table.run;
+    header.AB = table.AB;
+    header.bars_offset = align(sizeof(Header));
+    header.tables_offset = align(header.bars_offset + sizeof(table.bars));
+    header.coeffs_offset = align(header.tables_offset + tables.size() * sizeof(Table));
+    header.n_coeffs = coeffs.size();
+    header.metadata_offset = header.coeffs_offset + coeffs.size() * sizeof(coeffs[0]);
+    header.metadata_size = meta.size();
+    header.file_size = header.metadata_offset + header.metadata_size;
+
+    // table pointers are meaningless in a file
+    auto bars = table.bars;
+    for (auto& par : bars) {
+        par.gamma_fast_total_L = par.neutron_fast_total_L = nullptr;
+        par.gamma_fast_total_R = par.neutron_fast_total_R = nullptr;
+        par.gamma_vpsd_L = par.neutron_vpsd_L = nullptr;
+        par.gamma_vpsd_R = par.neutron_vpsd_R = nullptr;
+    }
+
+    std::vector<char> buffer(header.file_size, 0);
+    std::memcpy(buffer.data(), &header, sizeof(header));
+    std::memcpy(buffer.data() + header.bars_offset, bars.data(), sizeof(bars));
+    std::memcpy(buffer.data() + header.tables_offset, tables.data(), tables.size() * sizeof(Table));
+    std::memcpy(buffer.data() + header.coeffs_offset, coeffs.data(), coeffs.size() * sizeof(coeffs[0]));
+    std::memcpy(buffer.data() + header.metadata_offset, meta.data(), meta.size());
+
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+    auto tmp_path = path;
+    tmp_path += Form(".tmp%d", getpid());
+    std::ofstream file(tmp_path, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "WARNING: failed to write calibration snapshot " << path.string() << std::endl;
+        return;
+    }
+    file.write(buffer.data(), buffer.size());
+    file.close();
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        std::cerr << "WARNING: failed to write calibration snapshot " << path.string() << std::endl;
+        std::filesystem::remove(tmp_path, ec);
+    }
+}
+
+std::uint64_t NWCalibSnapshot::hash_files(const std::vector<std::filesystem::path>& paths, const std::string& salt) {
+    /* FNV-1a over the salt, then the path and the content of every file; a
+     * missing file contributes only its path, so that it cannot match an
+     * earlier hash.
+     */
+    std::uint64_t hash = 0xcbf29ce484222325UL;
+    auto update = [&hash](const char* ptr, std::size_t n) {
+        for (std::size_t i = 0; i < n; ++i) {
+            hash = (hash ^ (unsigned char)ptr[i]) * 0x100000001b3UL;
+        }
+    };
+    update(salt.c_str(), salt.size() + 1);
+    for (auto& path : paths) {
+        std::string path_str = path.string();
+        update(path_str.c_str(), path_str.size() + 1);
+        std::ifstream file(path, std::ios::binary);
+        std::vector<char> buffer(1 << 16);
+        while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0) {
+            update(buffer.data(), file.gcount());
+        }
+    }
+    return hash;
+}
+
+std::string NWCalibSnapshot::get_builder_key() {
+    /* Everything besides the source files that decides the content of a snapshot */
+    return Form(
+        "builder=%u tolerance=%.17g max_n_cells=%d",
+        NWCalibSnapshot::builder_version, UniformGridTable::default_tolerance, UniformGridTable::default_max_n_cells
+    );
+}
+
+
+
+/******************************/
+/*****NWCalibSnapshotCache*****/
+/******************************/
+NWCalibSnapshotCache::NWCalibSnapshotCache(const std::filesystem::path& dir, NWCalibParamReaders& readers) : dir(dir) {
+    this->source_hash = NWCalibSnapshot::hash_files(readers.get_source_paths(), NWCalibSnapshot::get_builder_key());
+}
+
+NWCalibSnapshotCache::~NWCalibSnapshotCache() { }
+
+std::filesystem::path NWCalibSnapshotCache::get_path(char AB, int run) const {
+    return this->dir / Form("NW%c_run-%04d.bin", AB, run);
+}
+
+std::unique_ptr<NWCalibTable> NWCalibSnapshotCache::get_table(NWCalibParamReaders& readers, int run, TFolder* metadata) {
+    char AB = readers.psd_reader.AB;
+    auto path = this->get_path(AB, run);
+    {
+        NWCalibSnapshot snapshot(path);
+        if (snapshot.is_valid(this->source_hash, AB, run)) {
+            snapshot.write_metadata(metadata);
+            metadata->Add(new TNamed(path.string().c_str(), "calib_snapshot"));
+            return snapshot.make_table();
+        }
+    }
+
+    readers.load(run);
+    auto table = std::make_unique<NWCalibTable>(readers);
+    readers.write_metadata(metadata);
+    NWCalibSnapshot::write(path, *table, metadata, this->source_hash);
+    return table;
+}
@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include "TFolder.h"
+#include "TMath.h"
+
+#include "CounterRNG.h"
+#include "NWCalibration.h"
+#include "ParamReader.h"
+
+/*****************************/
+/*****NWCalibParamReaders*****/
+/*****************************/
+NWCalibParamReaders::NWCalibParamReaders(const char AB)
+    : pcalib(AB), tcalib(AB, false), acalib(AB), lcalib(AB), psd_reader(AB)
+{ }
+
+NWCalibParamReaders::NWCalibParamReaders(const char AB, int run) : NWCalibParamReaders(AB) {
+    this->load(run);
+}
+
+void NWCalibParamReaders::load(int run) {
+    this->run = run;
+    this->pcalib.load(run);
+    this->tcalib.load(run);
+    this->acalib.load(run);
+    this->lcalib.load(run);
+    this->psd_reader.load(run);
+}
+
+std::vector<std::filesystem::path> NWCalibParamReaders::get_source_paths() {
+    return {
+        this->pcalib.pcalib_filepath,
+        this->pcalib.pca_filepath,
+        this->tcalib.json_path,
+        this->acalib.get_filepath("fast_total_L"),
+        this->acalib.get_filepath("fast_total_R"),
+        this->acalib.get_filepath("log_ratio_total"),
+        this->lcalib.pul_path,
+        this->psd_reader.param_path,
+    };
+}
+
+void NWCalibParamReaders::write_metadata(TFolder* metadata) {
+    TFolder* position_param_paths = metadata->AddFolder("position_param_paths", "");
+    TFolder* time_of_fligh_param_paths = metadata->AddFolder("time_of_flight_param_paths", "");
+    TFolder* adc_param_paths = metadata->AddFolder("adc_param_paths", "");
+    TFolder* light_param_paths = metadata->AddFolder("light_param_path", "");
+    TFolder* psd_param_paths = metadata->AddFolder("psd_param_paths", "");
+    this->pcalib.write_metadata(position_param_paths);
+    this->tcalib.write_metadata(time_of_fligh_param_paths);
+    this->acalib.write_metadata(adc_param_paths);
+    this->lcalib.write_metadata(light_param_paths);
+    this->psd_reader.write_metadata(psd_param_paths);
+}
+
+
+
+/**********************/
+/*****NWCalibTable*****/
+/**********************/
+NWCalibTable::NWCalibTable() {
+    this->AB = ' ';
+    this->bars = {};
+}
+
+NWCalibTable::NWCalibTable(NWCalibParamReaders& readers) {
+    this->AB = readers.psd_reader.AB;
+    this->run = readers.run;
+    this->bars = {};
+
+    auto& pcalib = readers.pcalib;
+    auto& tcalib = readers.tcalib;
+    auto& acalib = readers.acalib;
+    auto& lcalib = readers.lcalib;
+    auto& psd_reader = readers.psd_reader;
+    for (int bar = 1; bar <= this->n_bars; ++bar) {
+        auto& par = this->bars[bar];
+
+        par.pos_p0 = pcalib.get(bar, "p0");
+        par.pos_p1 = pcalib.get(bar, "p1");
+        for (int i = 0; i < 3; ++i) {
+            par.L[i] = pcalib.get(bar, "L" + std::to_string(i));
+            par.X[i] = pcalib.get(bar, "X" + std::to_string(i));
+            par.Y[i] = pcalib.get(bar, "Y" + std::to_string(i));
+            par.Z[i] = pcalib.get(bar, "Z" + std::to_string(i));
+        }
+
+        par.tof_offset = tcalib.tof_offset[bar];
+
+        for (int side = 0; side < 2; ++side) {
+            auto& ft = (side == 0) ? acalib.fast_total_L.at(bar) : acalib.fast_total_R.at(bar);
+            par.nonlinear_fast_threshold[side] = ft.at("nonlinear_fast_threshold");
+            par.stationary_point_x[side] = ft.at("stationary_point_x");
+            par.stationary_point_y[side] = ft.at("stationary_point_y");
+            par.fast_total_fit[side] = {ft.at("fit_params[0]"), ft.at("fit_params[1]"), ft.at("fit_params[2]")};
+        }
+        auto& lrt = acalib.log_ratio_total.at(bar);
+        par.two_over_attenuation_length = 2 / lrt.at("attenuation_length");
+        par.log_gain_ratio = log(lrt.at("gain_ratio"));
+
+        auto& lpar = lcalib.run_param.at(bar);
+        par.light_a = lpar.at("a");
+        par.light_b = lpar.at("b");
+        par.light_c = lpar.at("c");
+        par.light_d = lpar.at("d");
+        par.light_e = lpar.at("e");
+
+        this->psd_tables[bar] = {
+            psd_reader.gamma_fast_total_L_table.at(bar),
+            psd_reader.neutron_fast_total_L_table.at(bar),
+            psd_reader.gamma_fast_total_R_table.at(bar),
+            psd_reader.neutron_fast_total_R_table.at(bar),
+            psd_reader.gamma_vpsd_L_table.at(bar),
+            psd_reader.neutron_vpsd_L_table.at(bar),
+            psd_reader.gamma_vpsd_R_table.at(bar),
+            psd_reader.neutron_vpsd_R_table.at(bar),
+        };
+        par.pca_mean = psd_reader.pca_mean.at(bar);
+        par.pca_components = psd_reader.pca_components.at(bar);
+        par.pca_xpeaks = psd_reader.pca_xpeaks.at(bar);
+    }
+    this->link_psd_tables();
+}
+
+NWCalibTable::~NWCalibTable() { }
+
+void NWCalibTable::link_psd_tables() {
+    for (int bar = 1; bar <= this->n_bars; ++bar) {
+        auto& par = this->bars[bar];
+        auto& tables = this->psd_tables[bar];
+        par.gamma_fast_total_L = &tables[0];
+        par.neutron_fast_total_L = &tables[1];
+        par.gamma_fast_total_R = &tables[2];
+        par.neutron_fast_total_R = &tables[3];
+        par.gamma_vpsd_L = &tables[4];
+        par.neutron_vpsd_L = &tables[5];
+        par.gamma_vpsd_R = &tables[6];
+        par.neutron_vpsd_R = &tables[7];
+    }
+}
+
+
+
+/**************************************/
+/*****per-hit calibration functions****/
+/**************************************/
+double get_position(const NWBarCalibParams& par, double time_L, double time_R) {
+    return par.pos_p0 + par.pos_p1 * (time_L - time_R);
+}
+
+double get_time_of_flight(const NWBarCalibParams& par, double time_L, double time_R, double fa_time) {
+    return 0.5 * (time_L + time_R) - fa_time - par.tof_offset;
+}
+
+std::array<double, 4> get_corrected_adc(
+    const NWBarCalibParams& par, const CounterRNG& rng, long entry, int hit,
+    short total_L, short total_R, short fast_L, short fast_R, const double pos_x
+) {
+    double totalf_L, totalf_R, fastf_L, fastf_R;
+
+    // randomize ADC
+    totalf_L = randomize_adc(rng, entry, hit, CounterRNG::kTotalL, total_L);
+    totalf_R = randomize_adc(rng, entry, hit, CounterRNG::kTotalR, total_R);
+    fastf_L = randomize_adc(rng, entry, hit, CounterRNG::kFastL, fast_L);
+    fastf_R = randomize_adc(rng, entry, hit, CounterRNG::kFastR, fast_R);
+
+    double ratio_R_L = exp(par.two_over_attenuation_length * pos_x + par.log_gain_ratio);
+
+    // correct for total_L
+    if (totalf_L >= 4096 && totalf_R < 4096) {
+        totalf_L = totalf_R / ratio_R_L;
+    }
+    else if (fastf_L > par.nonlinear_fast_threshold[0] && fastf_L < par.stationary_point_x[0]) {
+        totalf_L += par.fast_total_fit[0][0];
+        totalf_L += par.fast_total_fit[0][1] * fastf_L;
+        totalf_L += par.fast_total_fit[0][2] * fastf_L * fastf_L;
+    }
+    else if (fastf_L > par.stationary_point_x[0]) {
+        totalf_L += par.stationary_point_y[0] - total_L;
+    }
+
+    // correct for total_R
+    if (totalf_R >= 4096 && totalf_L < 4096) {
+        totalf_R = totalf_L * ratio_R_L;
+    }
+    else if (fastf_R > par.nonlinear_fast_threshold[1] && fastf_R < par.stationary_point_x[1]) {
+        totalf_R += par.fast_total_fit[1][0];
+        totalf_R += par.fast_total_fit[1][1] * fastf_R;
+        totalf_R += par.fast_total_fit[1][2] * fastf_R * fastf_R;
+    }
+    else if (fastf_R > par.stationary_point_x[1]) {
+        totalf_R += par.stationary_point_y[1] - total_R;
+    }
+
+    return {totalf_L, totalf_R, fastf_L, fastf_R};
+}
+
+double get_light_output(const NWBarCalibParams& par, double total_L, double total_R, const double pos_x) {
+    double light_GM = sqrt(total_L * total_R);
+    light_GM = (light_GM - (par.light_b * pos_x + par.light_c * pos_x * pos_x)) / par.light_a;
+    light_GM = 4.196 * par.light_e * light_GM + par.light_d; // 4.196 MeVee is the Compton edge energy AmBe 4.4 MeV transition
+    return std::max(0.0, light_GM); // light output cannot be negative
+}
+
+std::array<double, 2> get_psd(
+    const NWBarCalibParams& par,
+    double total_L, double total_R,
+    double fast_L, double fast_R,
+    const double pos_x
+) {
+    /*****eliminate bad data*****/
+    if (fast_L < 0 || fast_R < 0 || total_L < 0 || total_R < 0) return {-9999.0, 0.0}; // these are invalid ADC values from original framework
+    if (fast_L > 4095 || fast_R > 4095) return {9999.0, 0.0}; // count as neutrons
+
+    /*****value assigning*****/
+    double gamma_L = par.gamma_fast_total_L->Eval(total_L);
+    double neutron_L = par.neutron_fast_total_L->Eval(total_L);
+    double vpsd_L = (fast_L - gamma_L) / (neutron_L - gamma_L);
+
+    double gamma_R = par.gamma_fast_total_R->Eval(total_R);
+    double neutron_R = par.neutron_fast_total_R->Eval(total_R);
+    double vpsd_R = (fast_R - gamma_R) / (neutron_R - gamma_R);
+
+    /*****position correction*****/
+    gamma_L = par.gamma_vpsd_L->Eval(pos_x);
+    neutron_L = par.neutron_vpsd_L->Eval(pos_x);
+    gamma_R = par.gamma_vpsd_R->Eval(pos_x);
+    neutron_R = par.neutron_vpsd_R->Eval(pos_x);
+
+    std::array<double, 2> xy = {vpsd_L - gamma_L, vpsd_R - gamma_R};
+    std::array<double, 2> gn_vec = {neutron_L - gamma_L, neutron_R - gamma_R};
+    std::array<double, 2> gn_rot90 = {-gn_vec[1], gn_vec[0]};
+
+    // project to gn_vec and gn_rot90
+    double x = (xy[0] * gn_vec[0] + xy[1] * gn_vec[1]);
+    x /= sqrt(gn_vec[0] * gn_vec[0] + gn_vec[1] * gn_vec[1]);
+    double y = (xy[0] * gn_rot90[0] + xy[1] * gn_rot90[1]);
+    y /= sqrt(gn_rot90[0] * gn_rot90[0] + gn_rot90[1] * gn_rot90[1]);
+
+    // PCA transform
+    x -= par.pca_mean[0];
+    y -= par.pca_mean[1];
+    auto& pca_matrix = par.pca_components;
+    double pca_x = pca_matrix[0][0] * x + pca_matrix[0][1] * y;
+    double pca_y = pca_matrix[1][0] * x + pca_matrix[1][1] * y;
+
+    // normalization
+    auto& xpeaks = par.pca_xpeaks;
+    double ppsd = (x - xpeaks[0]) / (xpeaks[1] - xpeaks[0]);
+    double ppsd_perp = y;
+
+    return {ppsd, ppsd_perp};
+}
+
+std::array<double, 3> randomize_position(const CounterRNG& rng, long entry, int hit, const double pos_x) {
+    const double y_length = 3 * 2.54; // cm
+    const double z_length = 2.5 * 2.54; // cm
+    double pos_y = rng.uniform(entry, hit, CounterRNG::kPositionY, -0.5 * y_length, 0.5 * y_length);
+    double pos_z = rng.uniform(entry, hit, CounterRNG::kPositionZ, -0.5 * z_length, 0.5 * z_length);
+    return {pos_x, pos_y, pos_z};
+}
+
+double randomize_adc(const CounterRNG& rng, long entry, int hit, CounterRNG::Purpose purpose, short raw) {
+    if (raw < 0) return double(raw); // e.g. -9999
+    else if (raw == 0) return raw + rng.uniform(entry, hit, purpose, 0, 0.5);
+    else if (raw < 4096) return raw + rng.uniform(entry, hit, purpose, -0.5, 0.5);
+    else return double(raw);
+}
+
+std::array<double, 3> get_spherical_coordinates(const NWBarCalibParams& par, const std::array<double, 3>& position) {
+    auto& L = par.L;
+    auto& X = par.X;
+    auto& Y = par.Y;
+    auto& Z = par.Z;
+
+    double lab_x = position[0] * X[0] + position[1] * Y[0] + position[2] * Z[0] + L[0];
+    double lab_y = position[0] * X[1] + position[1] * Y[1] + position[2] * Z[1] + L[1];
+    double lab_z = position[0] * X[2] + position[1] * Y[2] + position[2] * Z[2] + L[2];
+
+    double rho = sqrt(lab_x * lab_x + lab_y * lab_y + lab_z * lab_z);
+    double theta = acos(lab_z / rho) * TMath::RadToDeg();
+    double phi = atan2(lab_y, lab_x) * TMath::RadToDeg();
+
+    return {rho, theta, phi};
+}
@@ -0,0 +1,344 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "TMath.h"
+
+#include "CounterRNG.h"
+#include "NWCalibration.h"
+#include "NWHitBlock.h"
+
+NWHitBlock::NWHitBlock(std::size_t capacity) {
+    for (auto* vec : {&this->time_L, &this->time_R, &this->fa_time, &this->rand_pos_y, &this->rand_pos_z,
+                      &this->dithered_total_L, &this->dithered_total_R, &this->dithered_fast_L, &this->dithered_fast_R}) {
+        vec->reserve(capacity);
+    }
+    for (auto* vec : {&this->total_L, &this->total_R, &this->fast_L, &this->fast_R}) {
+        vec->reserve(capacity);
+    }
+    this->entry.reserve(capacity);
+    this->hit.reserve(capacity);
+    this->bar.reserve(capacity);
+}
+
+NWHitBlock::~NWHitBlock() { }
+
+void NWHitBlock::clear() {
+    this->n_hits = 0;
+    for (auto* vec : {&this->time_L, &this->time_R, &this->fa_time, &this->rand_pos_y, &this->rand_pos_z,
+                      &this->dithered_total_L, &this->dithered_total_R, &this->dithered_fast_L, &this->dithered_fast_R}) {
+        vec->clear();
+    }
+    for (auto* vec : {&this->total_L, &this->total_R, &this->fast_L, &this->fast_R}) {
+        vec->clear();
+    }
+    this->entry.clear();
+    this->hit.clear();
+    this->bar.clear();
+    this->invalid_bar_hits.clear();
+}
+
+void NWHitBlock::push_back(
+    long entry, int hit, int bar, double time_L, double time_R, double fa_time,
+    short total_L, short total_R, short fast_L, short fast_R
+) {
+    this->entry.push_back(entry);
+    this->hit.push_back(hit);
+    bool is_valid_bar = (bar >= 1 && bar <= NWCalibTable::n_bars);
+    if (!is_valid_bar) {
+        this->invalid_bar_hits.push_back(this->n_hits);
+    }
+    this->bar.push_back(is_valid_bar ? bar : 1);
+    this->time_L.push_back(time_L);
+    this->time_R.push_back(time_R);
+    this->fa_time.push_back(fa_time);
+    this->total_L.push_back(total_L);
+    this->total_R.push_back(total_R);
+    this->fast_L.push_back(fast_L);
+    this->fast_R.push_back(fast_R);
+    ++this->n_hits;
+}
+
+void NWHitBlock::calibrate(const NWCalibTable& table, const CounterRNG& rng) {
+    for (auto* vec : {&this->rand_pos_y, &this->rand_pos_z,
+                      &this->dithered_total_L, &this->dithered_total_R, &this->dithered_fast_L, &this->dithered_fast_R}) {
+        vec->resize(this->n_hits);
+    }
+    for (auto* vec : {&this->pos_x, &this->pos_y, &this->pos_z, &this->distance, &this->theta, &this->phi,
+                      &this->distance_c, &this->theta_c, &this->phi_c, &this->tof,
+                      &this->totalf_L, &this->totalf_R, &this->fastf_L, &this->fastf_R,
+                      &this->light_GM, &this->psd, &this->psd_perp}) {
+        vec->resize(this->n_hits);
+    }
+    this->status.resize(this->n_hits);
+    this->randomize(rng);
+    this->calibrate_position(table);
+    this->calibrate_spherical_coordinates(table);
+    this->calibrate_time_of_flight(table);
+    this->calibrate_adc(table);
+    this->calibrate_light_output(table);
+    this->calibrate_psd(table);
+    this->calibrate_status();
+    this->mask_invalid_bars();
+}
+
+void NWHitBlock::randomize(const CounterRNG& rng) {
+    const std::size_t n = this->n_hits;
+    const long* entry = this->entry.data();
+    const int* hit = this->hit.data();
+
+    // same ranges as randomize_position()
+    const double y_length = 3 * 2.54; // cm
+    const double z_length = 2.5 * 2.54; // cm
+    const double y_low = -0.5 * y_length, y_high = 0.5 * y_length;
+    const double z_low = -0.5 * z_length, z_high = 0.5 * z_length;
+    double* __restrict__ pos_y = this->rand_pos_y.data();
+    double* __restrict__ pos_z = this->rand_pos_z.data();
+    rng.fill_uniform(CounterRNG::kPositionY, n, entry, hit, pos_y);
+    rng.fill_uniform(CounterRNG::kPositionZ, n, entry, hit, pos_z);
+    for (std::size_t i = 0; i < n; ++i) {
+        pos_y[i] = y_low + (y_high - y_low) * pos_y[i];
+        pos_z[i] = z_low + (z_high - z_low) * pos_z[i];
+    }
+
+    // same dithering as randomize_adc()
+    auto dither = [&](CounterRNG::Purpose purpose, const std::vector<short>& raw_vec, std::vector<double>& out_vec) {
+        const short* __restrict__ raw = raw_vec.data();
+        double* __restrict__ out = out_vec.data();
+        rng.fill_uniform(purpose, n, entry, hit, out);
+        for (std::size_t i = 0; i < n; ++i) {
+            double u = out[i];
+            out[i] = (raw[i] < 0) ? double(raw[i])
+                : (raw[i] == 0) ? raw[i] + 0.5 * u
+                : (raw[i] < 4096) ? raw[i] + (-0.5 + u)
+                : double(raw[i]);
+        }
+    };
+    dither(CounterRNG::kTotalL, this->total_L, this->dithered_total_L);
+    dither(CounterRNG::kTotalR, this->total_R, this->dithered_total_R);
+    dither(CounterRNG::kFastL, this->fast_L, this->dithered_fast_L);
+    dither(CounterRNG::kFastR, this->fast_R, this->dithered_fast_R);
+}
+
+void NWHitBlock::calibrate_position(const NWCalibTable& table) {
+    const NWBarCalibParams* __restrict__ par = table.bars.data();
+    const int* __restrict__ bar = this->bar.data();
+    const double* __restrict__ time_L = this->time_L.data();
+    const double* __restrict__ time_R = this->time_R.data();
+    const double* __restrict__ rand_pos_y = this->rand_pos_y.data();
+    const double* __restrict__ rand_pos_z = this->rand_pos_z.data();
+    float* __restrict__ pos_x = this->pos_x.data();
+    float* __restrict__ pos_y = this->pos_y.data();
+    float* __restrict__ pos_z = this->pos_z.data();
+
+    const std::size_t n = this->n_hits;
+    for (std::size_t i = 0; i < n; ++i) {
+        const auto& p = par[bar[i]];
+        pos_x[i] = p.pos_p0 + p.pos_p1 * (time_L[i] - time_R[i]);
+        pos_y[i] = rand_pos_y[i];
+        pos_z[i] = rand_pos_z[i];
+    }
+}
+
+static inline void to_spherical(
+    const NWBarCalibParams& p, double x, double y, double z,
+    float& rho_out, float& theta_out, float& phi_out
+) {
+    // same arithmetic as get_spherical_coordinates()
+    double lab_x = x * p.X[0] + y * p.Y[0] + z * p.Z[0] + p.L[0];
+    double lab_y = x * p.X[1] + y * p.Y[1] + z * p.Z[1] + p.L[1];
+    double lab_z = x * p.X[2] + y * p.Y[2] + z * p.Z[2] + p.L[2];
+    double rho = sqrt(lab_x * lab_x + lab_y * lab_y + lab_z * lab_z);
+    rho_out = rho;
+    theta_out = acos(lab_z / rho) * TMath::RadToDeg();
+    phi_out = atan2(lab_y, lab_x) * TMath::RadToDeg();
+}
+
+void NWHitBlock::calibrate_spherical_coordinates(const NWCalibTable& table) {
+    const NWBarCalibParams* __restrict__ par = table.bars.data();
+    const int* __restrict__ bar = this->bar.data();
+    const float* __restrict__ pos_x = this->pos_x.data();
+    const double* __restrict__ rand_pos_y = this->rand_pos_y.data();
+    const double* __restrict__ rand_pos_z = this->rand_pos_z.data();
+    float* __restrict__ distance = this->distance.data();
+    float* __restrict__ theta = this->theta.data();
+    float* __restrict__ phi = this->phi.data();
+    float* __restrict__ distance_c = this->distance_c.data();
+    float* __restrict__ theta_c = this->theta_c.data();
+    float* __restrict__ phi_c = this->phi_c.data();
+
+    const std::size_t n = this->n_hits;
+    for (std::size_t i = 0; i < n; ++i) {
+        const auto& p = par[bar[i]];
+        to_spherical(p, pos_x[i], rand_pos_y[i], rand_pos_z[i], distance[i], theta[i], phi[i]);
+        to_spherical(p, pos_x[i], 0.0, 0.0, distance_c[i], theta_c[i], phi_c[i]);
+    }
+}
+
+void NWHitBlock::calibrate_time_of_flight(const NWCalibTable& table) {
+    const NWBarCalibParams* __restrict__ par = table.bars.data();
+    const int* __restrict__ bar = this->bar.data();
+    const double* __restrict__ time_L = this->time_L.data();
+    const double* __restrict__ time_R = this->time_R.data();
+    const double* __restrict__ fa_time = this->fa_time.data();
+    float* __restrict__ tof = this->tof.data();
+
+    const std::size_t n = this->n_hits;
+    for (std::size_t i = 0; i < n; ++i) {
+        tof[i] = 0.5 * (time_L[i] + time_R[i]) - fa_time[i] - par[bar[i]].tof_offset;
+    }
+}
+
+void NWHitBlock::calibrate_adc(const NWCalibTable& table) {
+    const NWBarCalibParams* __restrict__ par = table.bars.data();
+    const int* __restrict__ bar = this->bar.data();
+    const float* __restrict__ pos_x = this->pos_x.data();
+    const short* __restrict__ total_L = this->total_L.data();
+    const short* __restrict__ total_R = this->total_R.data();
+    const double* __restrict__ dithered_total_L = this->dithered_total_L.data();
+    const double* __restrict__ dithered_total_R = this->dithered_total_R.data();
+    const double* __restrict__ dithered_fast_L = this->dithered_fast_L.data();
+    const double* __restrict__ dithered_fast_R = this->dithered_fast_R.data();
+    float* __restrict__ totalf_L = this->totalf_L.data();
+    float* __restrict__ totalf_R = this->totalf_R.data();
+    float* __restrict__ fastf_L = this->fastf_L.data();
+    float* __restrict__ fastf_R = this->fastf_R.data();
+
+    const std::size_t n = this->n_hits;
+    for (std::size_t i = 0; i < n; ++i) {
+        // same corrections as get_corrected_adc(), with selects instead of branches
+        const auto& p = par[bar[i]];
+        double tL = dithered_total_L[i];
+        double tR = dithered_total_R[i];
+        double fL = dithered_fast_L[i];
+        double fR = dithered_fast_R[i];
+        double ratio_R_L = exp(p.two_over_attenuation_length * pos_x[i] + p.log_gain_ratio);
+
+        tL = (tL >= 4096 && tR < 4096) ? tR / ratio_R_L
+            : (fL > p.nonlinear_fast_threshold[0] && fL < p.stationary_point_x[0])
+                ? tL + p.fast_total_fit[0][0] + p.fast_total_fit[0][1] * fL + p.fast_total_fit[0][2] * fL * fL
+            : (fL > p.stationary_point_x[0]) ? tL + (p.stationary_point_y[0] - total_L[i])
+            : tL;
+        tR = (tR >= 4096 && tL < 4096) ? tL * ratio_R_L
+            : (fR > p.nonlinear_fast_threshold[1] && fR < p.stationary_point_x[1])
+                ? tR + p.fast_total_fit[1][0] + p.fast_total_fit[1][1] * fR + p.fast_total_fit[1][2] * fR * fR
+            : (fR > p.stationary_point_x[1]) ? tR + (p.stationary_point_y[1] - total_R[i])
+            : tR;
+
+        totalf_L[i] = tL;
+        totalf_R[i] = tR;
+        fastf_L[i] = fL;
+        fastf_R[i] = fR;
+    }
+}
+
+void NWHitBlock::calibrate_light_output(const NWCalibTable& table) {
+    const NWBarCalibParams* __restrict__ par = table.bars.data();
+    const int* __restrict__ bar = this->bar.data();
+    const float* __restrict__ pos_x = this->pos_x.data();
+    const float* __restrict__ totalf_L = this->totalf_L.data();
+    const float* __restrict__ totalf_R = this->totalf_R.data();
+    float* __restrict__ light_GM = this->light_GM.data();
+
+    const std::size_t n = this->n_hits;
+    for (std::size_t i = 0; i < n; ++i) {
+        const auto& p = par[bar[i]];
+        double x = pos_x[i];
+        double light = sqrt(double(totalf_L[i]) * double(totalf_R[i]));
+        light = (light - (p.light_b * x + p.light_c * x * x)) / p.light_a;
+        light = 4.196 * p.light_e * light + p.light_d;
+        light_GM[i] = std::max(0.0, light);
+    }
+}
+
+void NWHitBlock::calibrate_psd(const NWCalibTable& table) {
+    const NWBarCalibParams* __restrict__ par = table.bars.data();
+    const int* __restrict__ bar = this->bar.data();
+    const float* __restrict__ pos_x = this->pos_x.data();
+    const float* __restrict__ totalf_L = this->totalf_L.data();
+    const float* __restrict__ totalf_R = this->totalf_R.data();
+    const float* __restrict__ fastf_L = this->fastf_L.data();
+    const float* __restrict__ fastf_R = this->fastf_R.data();
+    float* __restrict__ psd = this->psd.data();
+    float* __restrict__ psd_perp = this->psd_perp.data();
+
+    const std::size_t n = this->n_hits;
+    for (std::size_t i = 0; i < n; ++i) {
+        // same as get_psd(), computed unconditionally and selected at the end
+        const auto& p = par[bar[i]];
+        double x_pos = pos_x[i];
+        double tL = totalf_L[i];
+        double tR = totalf_R[i];
+        double fL = fastf_L[i];
+        double fR = fastf_R[i];
+
+        double gamma_L = p.gamma_fast_total_L->Eval(tL);
+        double neutron_L = p.neutron_fast_total_L->Eval(tL);
+        double vpsd_L = (fL - gamma_L) / (neutron_L - gamma_L);
+        double gamma_R = p.gamma_fast_total_R->Eval(tR);
+        double neutron_R = p.neutron_fast_total_R->Eval(tR);
+        double vpsd_R = (fR - gamma_R) / (neutron_R - gamma_R);
+
+        gamma_L = p.gamma_vpsd_L->Eval(x_pos);
+        neutron_L = p.neutron_vpsd_L->Eval(x_pos);
+        gamma_R = p.gamma_vpsd_R->Eval(x_pos);
+        neutron_R = p.neutron_vpsd_R->Eval(x_pos);
+
+        double xy_0 = vpsd_L - gamma_L;
+        double xy_1 = vpsd_R - gamma_R;
+        double gn_0 = neutron_L - gamma_L;
+        double gn_1 = neutron_R - gamma_R;
+        double x = (xy_0 * gn_0 + xy_1 * gn_1);
+        x /= sqrt(gn_0 * gn_0 + gn_1 * gn_1);
+        double y = (xy_0 * (-gn_1) + xy_1 * gn_0);
+        y /= sqrt((-gn_1) * (-gn_1) + gn_0 * gn_0);
+        x -= p.pca_mean[0];
+        y -= p.pca_mean[1];
+        double ppsd = (x - p.pca_xpeaks[0]) / (p.pca_xpeaks[1] - p.pca_xpeaks[0]);
+
+        bool invalid = (fL < 0 || fR < 0 || tL < 0 || tR < 0); // invalid ADC values from original framework
+        bool overflow = (fL > 4095 || fR > 4095); // count as neutrons
+        psd[i] = invalid ? -9999.0 : (overflow ? 9999.0 : ppsd);
+        psd_perp[i] = (invalid || overflow) ? 0.0 : y;
+    }
+}
+
+void NWHitBlock::calibrate_status() {
+    const short* __restrict__ total_L = this->total_L.data();
+    const short* __restrict__ total_R = this->total_R.data();
+    const short* __restrict__ fast_L = this->fast_L.data();
+    const short* __restrict__ fast_R = this->fast_R.data();
+    const double* __restrict__ time_L = this->time_L.data();
+    const double* __restrict__ time_R = this->time_R.data();
+    const float* __restrict__ pos_x = this->pos_x.data();
+    const float* __restrict__ psd = this->psd.data();
+    short* __restrict__ status = this->status.data();
+
+    const std::size_t n = this->n_hits;
+    for (std::size_t i = 0; i < n; ++i) {
+        // same sentinels as calibrate_psd()
+        short min_adc = std::min(std::min(total_L[i], total_R[i]), std::min(fast_L[i], fast_R[i]));
+        status[i] = ((min_adc < 0) ? kInvalidADC : 0)
+            | ((min_adc == 0) ? kZeroADC : 0)
+            | ((total_L[i] >= 4096 || total_R[i] >= 4096) ? kSaturatedTotal : 0)
+            | ((psd[i] == 9999.0f) ? kPsdOverflow : 0)
+            | ((psd[i] == -9999.0f) ? kPsdInvalid : 0)
+            | ((pos_x[i] <= -bar_half_length || pos_x[i] >= bar_half_length) ? kOutsideBar : 0)
+            | ((time_L[i] < -9000 || time_R[i] < -9000) ? kInvalidTime : 0);
+    }
+}
+
+void NWHitBlock::mask_invalid_bars() {
+    /* Hits of an invalid bar went through the stages as bar 1; their outputs are discarded */
+    for (std::size_t i : this->invalid_bar_hits) {
+        for (auto* vec : {&this->pos_x, &this->pos_y, &this->pos_z, &this->distance, &this->theta, &this->phi,
+                          &this->distance_c, &this->theta_c, &this->phi_c, &this->tof,
+                          &this->totalf_L, &this->totalf_R, &this->fastf_L, &this->fastf_R,
+                          &this->light_GM, &this->psd, &this->psd_perp}) {
+            (*vec)[i] = -9999.0;
+        }
+        this->status[i] |= kInvalidBar;
+    }
+}
@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <cmath>
+#include <fnmatch.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "Compression.h"
+#include "TBranch.h"
+#include "TFile.h"
+#include "TFolder.h"
+#include "TNamed.h"
+#include "TObjArray.h"
+#include "TString.h"
+#include "TTree.h"
+
+#include "OutputStorage.h"
+
+using Json = nlohmann::json;
+
+static const std::vector<std::pair<std::string, int> > compression_algorithms = {
+    {"zlib", ROOT::RCompressionSetting::EAlgorithm::kZLIB},
+    {"lzma", ROOT::RCompressionSetting::EAlgorithm::kLZMA},
+    {"lz4", ROOT::RCompressionSetting::EAlgorithm::kLZ4},
+    {"zstd", ROOT::RCompressionSetting::EAlgorithm::kZSTD},
+};
+
+OutputStorage::OutputStorage() {
+    this->compression = OutputStorage::parse_compression("zstd:5");
+    this->auto_flush = 20000;
+
+    // everything spectra.py reads, from selection cuts to the kinematics
+    Group hot;
+    hot.branches = {
+        "MB_multi", "VW_multi", "TDC_mb_nw",
+        "NWB_multi", "NWB_bar", "NWB_total_?", "NWB_fast_?",
+        "NWB_pos_x", "NWB_distance", "NWB_theta", "NWB_tof", "NWB_light_GM", "NWB_psd", "NWB_status",
+    };
+    hot.compression = OutputStorage::parse_compression("lz4:4");
+    hot.basket_size = 64000;
+    this->groups.push_back(hot);
+}
+
+OutputStorage::OutputStorage(const std::string& path) : OutputStorage() {
+    this->path = path;
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "ERROR: failed to open output storage configuration " << path << std::endl;
+        exit(1);
+    }
+    Json content;
+    try {
+        file >> content;
+    }
+    catch (const Json::exception& err) {
+        std::cerr << "ERROR: failed to parse " << path << ": " << err.what() << std::endl;
+        exit(1);
+    }
+
+    this->compression = OutputStorage::parse_compression(content.value("compression", "zstd:5"));
+    this->auto_flush = content.value("auto_flush", this->auto_flush);
+    this->groups.clear();
+    for (auto& item : content.value("groups", Json::array())) {
+        Group group;
+        group.branches = item.at("branches").get<std::vector<std::string> >();
+        if (item.contains("compression")) {
+            group.compression = OutputStorage::parse_compression(item["compression"].get<std::string>());
+        }
+        group.basket_size = item.value("basket_size", -1);
+        this->groups.push_back(group);
+    }
+    for (auto& item : content.value("quantization", Json::array())) {
+        try {
+            this->quantizations.push_back(OutputStorage::make_quantization(
+                item.at("branches").get<std::vector<std::string> >(),
+                item.at("min").get<double>(), item.at("max").get<double>(), item.at("bits").get<int>()
+            ));
+        }
+        catch (const Json::exception& err) {
+            std::cerr << "ERROR: quantization rules in " << path << " need branches, min, max and bits: " << err.what() << std::endl;
+            exit(1);
+        }
+    }
+}
+
+OutputStorage::~OutputStorage() { }
+
+void OutputStorage::apply(TFile* file) const {
+    file->SetCompressionSettings(this->compression);
+}
+
+void OutputStorage::apply(TTree* tree) const {
+    /* Must be called before the first Fill(), while no basket has been written */
+    tree->SetAutoFlush(this->auto_flush);
+    for (TObject* obj : *tree->GetListOfBranches()) {
+        auto* branch = static_cast<TBranch*>(obj);
+        branch->SetCompressionSettings(this->compression);
+        for (auto& group : this->groups) {
+            bool matched = std::any_of(
+                group.branches.begin(), group.branches.end(),
+                [branch](const std::string& pattern) { return fnmatch(pattern.c_str(), branch->GetName(), 0) == 0; }
+            );
+            if (!matched) continue;
+            if (group.compression >= 0) branch->SetCompressionSettings(group.compression);
+            if (group.basket_size > 0) branch->SetBasketSize(group.basket_size);
+        }
+    }
+}
+
+void OutputStorage::write_metadata(TFolder* metadata) const {
+    TFolder* folder = metadata->AddFolder("output_storage", "");
+    folder->Add(new TNamed(this->path.empty() ? "default" : this->path.c_str(), "config"));
+    folder->Add(new TNamed(OutputStorage::format_compression(this->compression).c_str(), "compression"));
+    folder->Add(new TNamed(Form("%ld", this->auto_flush), "auto_flush"));
+    for (auto& group : this->groups) {
+        std::string branches;
+        for (auto& pattern : group.branches) {
+            branches += (branches.empty() ? "" : ",") + pattern;
+        }
+        std::string settings = (group.compression >= 0) ? OutputStorage::format_compression(group.compression) : "-";
+        if (group.basket_size > 0) {
+            settings += Form(" basket_size=%d", group.basket_size);
+        }
+        folder->Add(new TNamed(branches.c_str(), settings.c_str()));
+    }
+    for (auto& quantization : this->quantizations) {
+        std::string branches;
+        for (auto& pattern : quantization.branches) {
+            branches += (branches.empty() ? "" : ",") + pattern;
+        }
+        std::string settings = Form(
+            "quantization min=%g max=%g bits=%d step=%g",
+            quantization.min, quantization.max, quantization.bits, quantization.step
+        );
+        folder->Add(new TNamed(branches.c_str(), settings.c_str()));
+    }
+}
+
+int OutputStorage::parse_compression(const std::string& spec) {
+    if (spec == "none") {
+        return 0;
+    }
+    std::size_t pos = spec.find(':');
+    std::string name = spec.substr(0, pos);
+    for (auto& [algorithm_name, algorithm] : compression_algorithms) {
+        if (name != algorithm_name) continue;
+        int level = (pos == std::string::npos) ? -1 : std::atoi(spec.c_str() + pos + 1);
+        if (level < 1 || level > 9) {
+            std::cerr << "ERROR: compression level must be between 1 and 9: " << spec << std::endl;
+            exit(1);
+        }
+        return 100 * algorithm + level;
+    }
+    std::cerr << "ERROR: unknown compression algorithm: " << spec << std::endl;
+    exit(1);
+}
+
+std::string OutputStorage::format_compression(int settings) {
+    if (settings % 100 == 0) {
+        return "none";
+    }
+    for (auto& [algorithm_name, algorithm] : compression_algorithms) {
+        if (settings / 100 == algorithm) {
+            return Form("%s:%d", algorithm_name.c_str(), settings % 100);
+        }
+    }
+    return Form("%d", settings);
+}
+
+OutputStorage::Quantization OutputStorage::make_quantization(
+    const std::vector<std::string>& branches, double min, double max, int bits
+) {
+    if (!(min < max) || bits < 1 || bits > 24) {
+        std::cerr << "ERROR: quantization needs min < max and 1 <= bits <= 24; got min=" << min;
+        std::cerr << ", max=" << max << ", bits=" << bits << std::endl;
+        exit(1);
+    }
+    Quantization quantization{branches, min, max, bits};
+    quantization.step = std::exp2(std::ceil(std::log2((max - min) / std::exp2(bits))));
+    return quantization;
+}
@@ -49,31 +49,18 @@ std::filesystem::path NWPositionCalibParamReader::resolve_project_dir(const std:
     return path;
 }
 
-bool NWPositionCalibParamReader::load(int run) {
+bool NWPositionCalibParamReader::read_in_calib_params() {
+    /* Parse the position calibration database and the bar geometry, both of
+     * which cover all runs; called once, by the first load().
+     */
     std::ifstream pcalib_file(this->pcalib_filepath);
     if (!pcalib_file.is_open()) {
         std::cerr << "Error: Could not open the position calibration parameters file: " << this->pcalib_filepath << std::endl;
         return false;
     }
-
-    Json json_data;
-    pcalib_file >> json_data;
+    pcalib_file >> this->database;
     pcalib_file.close();
-
-    for (const auto& [bar, bar_entry] : json_data.items()) {
-        int b = std::stoi(bar);
-        for (const auto& run_range_entry : bar_entry) {
-            int run_start = run_range_entry["run_range"][0].get<int>();
-            int run_end = run_range_entry["run_range"][1].get<int>();
-
-            if (run >= run_start && run <= run_end) {
-                this->param[{b, "p0"}] = run_range_entry["parameters"][0].get<double>();
-                this->param[{b, "p1"}] = run_range_entry["parameters"][1].get<double>();
-                break;
-            }
-        }
-    }
-
+    this->index = RunRangeIndex(this->database, this->pcalib_filepath);
 
     std::ifstream pca_file(this->pca_filepath);
     if (!pca_file.is_open()) {
@@ -100,6 +87,24 @@ bool NWPositionCalibParamReader::load(int run) {
     return true;
 }
 
+bool NWPositionCalibParamReader::load(int run) {
+    if (this->database.is_null() && !this->read_in_calib_params()) {
+        return false;
+    }
+
+    for (const auto& [b, intervals] : this->index.intervals) {
+        this->param.erase({b, "p0"}); // from a previous run
+        this->param.erase({b, "p1"});
+        const Json* run_range_entry = this->index.find(b, run);
+        if (run_range_entry != nullptr) {
+            this->param[{b, "p0"}] = (*run_range_entry)["parameters"][0].get<double>();
+            this->param[{b, "p1"}] = (*run_range_entry)["parameters"][1].get<double>();
+        }
+    }
+
+    return true;
+}
+
 double NWPositionCalibParamReader::get(int bar, const std::string& par) {
     return this->param[{bar, par}];
 }
@@ -153,24 +158,23 @@ void NWTimeOfFlightCalibParamReader::load_tof_offset() {
     this->database.clear();
     file >> this->database;
     file.close();
+    this->index = RunRangeIndex(this->database, this->json_path.string());
 }
 
 void NWTimeOfFlightCalibParamReader::load(int run) {
     /* Load TOF offset parameters for a given run
      * from this->database to this->tof_offset.
      */
+    if (this->database.is_null()) {
+        this->load_tof_offset();
+    }
     for (auto& [bar, bar_info] : this->database.items()) {
-        bool found = false;
-        for (auto& par_info : bar_info) {
-            auto& run_range = par_info["run_range"];
-            if (run < run_range[0].get<int>() || run > run_range[1].get<int>()) {
-                continue;
-            }
-            this->tof_offset[std::stoi(bar)] = par_info["tof_offset"].get<double>();
-            found = true;
-            break;
+        this->tof_offset.erase(std::stoi(bar)); // from a previous run
+        const Json* par_info = this->index.find(std::stoi(bar), run);
+        if (par_info != nullptr) {
+            this->tof_offset[std::stoi(bar)] = (*par_info)["tof_offset"].get<double>();
         }
-        if (!found) {
+        else {
             std::cerr << Form(
                 "ERROR: run-%04d is not found for NW%c bar%02d",
                 run, this->AB, std::stoi(bar)
@@ -207,39 +211,47 @@ NWADCPreprocessorParamReader::~NWADCPreprocessorParamReader() { }
 
 void NWADCPreprocessorParamReader::load(int run) {
     this->run = run;
-    this->calib_reldir = this->project_dir / Form(this->calib_reldir.string().c_str(), this->run);
     this->load_fast_total('L');
     this->load_fast_total('R');
     this->load_log_ratio_total();
     return;
 }
 
-void NWADCPreprocessorParamReader::load_fast_total(char side) {
-    auto filepath = this->calib_reldir / Form(this->filename.c_str(), Form("fast_total_%c", side));
+std::filesystem::path NWADCPreprocessorParamReader::get_filepath(const std::string& name) {
+    return this->project_dir / this->calib_reldir / Form(this->filename.c_str(), name.c_str());
+}
+
+RunRangeIndex& NWADCPreprocessorParamReader::get_index(const std::string& name) {
+    /* Return the index of "calib_params_<name>.json", parsing the file on first use */
+    auto it = this->index.find(name);
+    if (it != this->index.end()) {
+        return it->second;
+    }
+
+    auto filepath = this->get_filepath(name);
     this->filepaths.push_back(filepath);
     std::ifstream file(filepath.string());
     if (!file.is_open()) {
         std::cerr << "ERROR: failed to open " << filepath.string() << std::endl;
         exit(1);
     }
-    Json content;
+    Json& content = this->database[name];
     file >> content;
     file.close();
+    return this->index[name] = RunRangeIndex(content, filepath.string());
+}
+
+void NWADCPreprocessorParamReader::load_fast_total(char side) {
+    RunRangeIndex& index = this->get_index(Form("fast_total_%c", side));
 
     auto& map = (side == 'L') ? this->fast_total_L : this->fast_total_R;
     for (int bar = 1; bar <= 24; ++bar) {
-        Json& bar_content = content[std::to_string(bar)];
-        Json info;
-        for (auto& chunk : bar_content) {
-            if (chunk["run_range"][0].get<int>() <= this->run && this->run <= chunk["run_range"][1].get<int>()) {
-                info = chunk;
-                break;
-            }
-        }
-        if (info.is_null()) {
+        const Json* chunk = index.find(bar, this->run);
+        if (chunk == nullptr) {
             std::cerr << Form("ERROR: run-%04d is not found for NW%c bar%02d", this->run, this->AB, bar) << std::endl;
             exit(1);
         }
+        const Json& info = *chunk;
         map[bar] = {
             {"nonlinear_fast_threshold", info["nonlinear_fast_threshold"].get<double>()},
             {"stationary_point_x", info["stationary_point_x"].get<double>()},
@@ -253,31 +265,16 @@ void NWADCPreprocessorParamReader::load_fast_total(char side) {
 }
 
 void NWADCPreprocessorParamReader::load_log_ratio_total() {
-    auto filepath = this->calib_reldir / Form(this->filename.c_str(), "log_ratio_total");
-    this->filepaths.push_back(filepath);
-    std::ifstream file(filepath.string());
-    if (!file.is_open()) {
-        std::cerr << "ERROR: failed to open " << filepath.string() << std::endl;
-        exit(1);
-    }
-    Json content;
-    file >> content;
-    file.close();
+    RunRangeIndex& index = this->get_index("log_ratio_total");
 
     auto& map = this->log_ratio_total;
     for (int bar = 1; bar <= 24; ++bar) {
-        Json& bar_content = content[std::to_string(bar)];
-        Json info;
-        for (auto& chunk : bar_content) {
-            if (chunk["run_range"][0].get<int>() <= this->run && this->run <= chunk["run_range"][1].get<int>()) {
-                info = chunk;
-                break;
-            }
-        }
-        if (info.is_null()) {
+        const Json* chunk = index.find(bar, this->run);
+        if (chunk == nullptr) {
             std::cerr << Form("ERROR: run-%04d is not found for NW%c bar%02d", this->run, this->AB, bar) << std::endl;
             exit(1);
         }
+        const Json& info = *chunk;
         map[bar] = {
             {"attenuation_length", info["attenuation_length"].get<double>()},
             {"gain_ratio", info["gain_ratio"].get<double>()},
@@ -337,7 +334,9 @@ void NWLightOutputCalibParamReader::load_pulse_height() {
 
 void NWLightOutputCalibParamReader::load(int run) {
     // run dependency not implemented
-    this->load_pulse_height();
+    if (this->run_param.empty()) {
+        this->load_pulse_height();
+    }
     return;
 }
 
@@ -387,22 +386,12 @@ std::vector<double> NWPulseShapeDiscriminationParamReader::get_neutron_linear_pa
 }
 
 Json NWPulseShapeDiscriminationParamReader::get_bar_params(int run, int bar) {
-    auto& bar_params = this->database[Form("%d", bar)];
-    Json params;
-    for (auto& run_range_params : bar_params) {
-        auto& run_range = run_range_params["run_range"];
-        int run_start = (int)run_range[0].get<double>();
-        int run_stop = (int)run_range[1].get<double>();
-        if (run >= run_start && run <= run_stop) {
-            params = run_range_params;
-            break;
-        }
-    }
-    if (params.empty()) {
+    const Json* params = this->index.find(bar, run);
+    if (params == nullptr) {
         std::cerr << Form("Cannot find run %04d for NW%c-bar%02d", run, this->AB, bar) << std::endl;
         exit(1);
     }
-    return params;
+    return *params;
 }
 
 void NWPulseShapeDiscriminationParamReader::fast_total_interpolation(int bar, Json& params) {
@@ -420,6 +409,7 @@ void NWPulseShapeDiscriminationParamReader::fast_total_interpolation(int bar, Js
         fasts.push_back(fast);
     }
     this->gamma_fast_total_L[bar] = new ROOT::Math::Interpolator(totals, fasts, method);
+    this->gamma_fast_total_L_table[bar] = UniformGridTable(*this->gamma_fast_total_L[bar], totals);
 
     fasts.clear();
     for (int i = 0; i < totals.size(); ++i) {
@@ -431,6 +421,7 @@ void NWPulseShapeDiscriminationParamReader::fast_total_interpolation(int bar, Js
         fasts.push_back(fast);
     }
     this->neutron_fast_total_L[bar] = new ROOT::Math::Interpolator(totals, fasts, method);
+    this->neutron_fast_total_L_table[bar] = UniformGridTable(*this->neutron_fast_total_L[bar], totals);
 
     fasts.clear();
     for (int i = 0; i < totals.size(); ++i) {
@@ -438,6 +429,7 @@ void NWPulseShapeDiscriminationParamReader::fast_total_interpolation(int bar, Js
         fasts.push_back(fast);
     }
     this->gamma_fast_total_R[bar] = new ROOT::Math::Interpolator(totals, fasts, method);
+    this->gamma_fast_total_R_table[bar] = UniformGridTable(*this->gamma_fast_total_R[bar], totals);
 
     fasts.clear();
     for (int i = 0; i < totals.size(); ++i) {
@@ -449,6 +441,7 @@ void NWPulseShapeDiscriminationParamReader::fast_total_interpolation(int bar, Js
         fasts.push_back(fast);
     }
     this->neutron_fast_total_R[bar] = new ROOT::Math::Interpolator(totals, fasts, method);
+    this->neutron_fast_total_R_table[bar] = UniformGridTable(*this->neutron_fast_total_R[bar], totals);
 }
 
 void NWPulseShapeDiscriminationParamReader::centroid_interpolation(int bar, Json& params) {
@@ -465,24 +458,28 @@ void NWPulseShapeDiscriminationParamReader::centroid_interpolation(int bar, Json
         coords.push_back(params["g_centroid_L"][i].get<double>());
     }
     this->gamma_vpsd_L[bar] = new ROOT::Math::Interpolator(pos_x, coords, method);
+    this->gamma_vpsd_L_table[bar] = UniformGridTable(*this->gamma_vpsd_L[bar], pos_x);
 
     coords.clear();
     for (int i = 0; i < pos_x.size(); ++i) {
         coords.push_back(params["n_centroid_L"][i].get<double>());
     }
     this->neutron_vpsd_L[bar] = new ROOT::Math::Interpolator(pos_x, coords, method);
+    this->neutron_vpsd_L_table[bar] = UniformGridTable(*this->neutron_vpsd_L[bar], pos_x);
 
     coords.clear();
     for (int i = 0; i < pos_x.size(); ++i) {
         coords.push_back(params["g_centroid_R"][i].get<double>());
     }
     this->gamma_vpsd_R[bar] = new ROOT::Math::Interpolator(pos_x, coords, method);
+    this->gamma_vpsd_R_table[bar] = UniformGridTable(*this->gamma_vpsd_R[bar], pos_x);
 
     coords.clear();
     for (int i = 0; i < pos_x.size(); ++i) {
         coords.push_back(params["n_centroid_R"][i].get<double>());
     }
     this->neutron_vpsd_R[bar] = new ROOT::Math::Interpolator(pos_x, coords, method);
+    this->neutron_vpsd_R_table[bar] = UniformGridTable(*this->neutron_vpsd_R[bar], pos_x);
 }
 
 void NWPulseShapeDiscriminationParamReader::process_pca(int bar, Json& params) {
@@ -507,12 +504,12 @@ NWPulseShapeDiscriminationParamReader::NWPulseShapeDiscriminationParamReader(con
     }
     this->project_dir = std::filesystem::path(PROJECT_DIR);
     this->param_dir = this->project_dir / this->param_reldir;
+    this->param_path = this->param_dir / Form("calib_params_nw%c.json", this->ab);
 }
 
 NWPulseShapeDiscriminationParamReader::~NWPulseShapeDiscriminationParamReader() { }
 
 void NWPulseShapeDiscriminationParamReader::read_in_calib_params() {
-    this->param_path = this->param_dir / Form("calib_params_nw%c.json", this->ab);
     std::ifstream database_file(this->param_path.string());
     if (!database_file.is_open()) {
         std::cerr << "Failed to open database file: " << this->param_path << std::endl;
@@ -520,22 +517,58 @@ void NWPulseShapeDiscriminationParamReader::read_in_calib_params() {
     }
     database_file >> this->database;
     database_file.close();
+    this->index = RunRangeIndex(this->database, this->param_path.string());
 }
 
 void NWPulseShapeDiscriminationParamReader::load(int run) {
-    this->read_in_calib_params();
+    /* The database is parsed on the first call only. Interpolators and lookup
+     * tables of a bar are rebuilt only when the run falls into a different
+     * run range than the previous call.
+     */
+    if (this->database.is_null()) {
+        this->read_in_calib_params();
+    }
     for (int bar: this->bars) {
         auto params = this->get_bar_params(run, bar);
+        if (this->loaded_params.count(bar) > 0 && this->loaded_params[bar] == params) {
+            continue;
+        }
+        this->loaded_params[bar] = params;
+        for (auto* interpolators : {
+            &this->gamma_fast_total_L, &this->neutron_fast_total_L,
+            &this->gamma_fast_total_R, &this->neutron_fast_total_R,
+            &this->gamma_vpsd_L, &this->neutron_vpsd_L,
+            &this->gamma_vpsd_R, &this->neutron_vpsd_R,
+        }) {
+            delete (*interpolators)[bar];
+        }
         this->fast_total_interpolation(bar, params);
         this->centroid_interpolation(bar, params);
         this->process_pca(bar, params);
     }
 }
 
+double NWPulseShapeDiscriminationParamReader::get_max_table_error() {
+    double max_error = 0.0;
+    for (auto* tables : {
+        &this->gamma_fast_total_L_table, &this->neutron_fast_total_L_table,
+        &this->gamma_fast_total_R_table, &this->neutron_fast_total_R_table,
+        &this->gamma_vpsd_L_table, &this->neutron_vpsd_L_table,
+        &this->gamma_vpsd_R_table, &this->neutron_vpsd_R_table,
+    }) {
+        for (auto& [bar, table] : *tables) {
+            max_error = std::max(max_error, table.max_error);
+        }
+    }
+    return max_error;
+}
+
 void NWPulseShapeDiscriminationParamReader::write_metadata(TFolder* folder, bool relative_path) {
     std::filesystem::path base_dir = (relative_path) ? this->project_dir : "/";
     std::filesystem::path path = std::filesystem::proximate(this->param_path, base_dir);
     TNamed* data = new TNamed(path.string().c_str(), "PulseShapeDiscrimination_param_path");
     folder->Add(data);
+    TNamed* error_data = new TNamed(Form("%.3e", this->get_max_table_error()), "lookup_table_max_error");
+    folder->Add(error_data);
     return;
 }
@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef WITH_RNTUPLE
+#include <ROOT/RField.hxx>
+#include <ROOT/RNTupleModel.hxx>
+#include <ROOT/RNTupleWriteOptions.hxx>
+#include <ROOT/RNTupleWriter.hxx>
+#include "RVersion.h"
+#endif
+
+#include "RNTupleEventWriter.h"
+
+#ifdef WITH_RNTUPLE
+
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6, 36, 0)
+namespace rntuple = ROOT;
+#else
+namespace rntuple = ROOT::Experimental;
+#endif
+
+static std::size_t get_size(char type) {
+    switch (type) {
+        case 'D': return sizeof(double);
+        case 'F': return sizeof(float);
+        case 'L': return sizeof(std::int64_t);
+        case 'I': return sizeof(std::int32_t);
+        case 'S': return sizeof(std::int16_t);
+    }
+    std::cerr << "ERROR: leaf type '" << type << "' has no RNTuple counterpart" << std::endl;
+    exit(1);
+}
+
+static std::unique_ptr<rntuple::RFieldBase> create_field(const std::string& name, char type) {
+    std::string type_name;
+    switch (type) {
+        case 'D': type_name = "double"; break;
+        case 'F': type_name = "float"; break;
+        case 'L': type_name = "std::int64_t"; break;
+        case 'I': type_name = "std::int32_t"; break;
+        case 'S': type_name = "std::int16_t"; break;
+        default: get_size(type); // reports the unknown type
+    }
+    return rntuple::RFieldBase::Create(name, type_name).Unwrap();
+}
+
+struct RNTupleEventWriter::Impl {
+    struct Scalar {
+        Column column;
+        std::uint64_t value; // bound to the field; large and aligned enough for every leaf type
+    };
+
+    struct Collection {
+        std::string name; // common prefix of the columns, e.g. "NWB"
+        std::ptrdiff_t counter_offset;
+        std::vector<Column> columns;
+        std::vector<std::size_t> item_offsets; // of every column within a record
+        std::size_t item_size;
+        std::vector<char> items; // bound to the field, which untyped vector fields read as std::vector<char>
+    };
+
+    std::vector<Scalar> scalars;
+    std::vector<Collection> collections;
+    std::unique_ptr<rntuple::RNTupleWriter> writer;
+    std::unique_ptr<rntuple::REntry> entry;
+};
+
+RNTupleEventWriter::RNTupleEventWriter(TFile* file, const std::string& name, const std::vector<Column>& columns, int compression)
+    : impl(std::make_unique<Impl>()) {
+    auto& impl = *this->impl;
+    for (auto& column : columns) {
+        if (column.counter_offset < 0) {
+            impl.scalars.push_back({column, 0});
+            continue;
+        }
+        auto collection = std::find_if(
+            impl.collections.begin(), impl.collections.end(),
+            [&column](auto& collection) { return collection.counter_offset == column.counter_offset; }
+        );
+        if (collection == impl.collections.end()) {
+            impl.collections.push_back({column.name.substr(0, column.name.find('_')), column.counter_offset});
+            collection = impl.collections.end() - 1;
+        }
+        collection->columns.push_back(column);
+    }
+
+    auto model = rntuple::RNTupleModel::Create();
+    for (auto& scalar : impl.scalars) {
+        model->AddField(create_field(scalar.column.name, scalar.column.type));
+    }
+    for (auto& collection : impl.collections) {
+        // records are laid out as the equivalent C struct, which is also how RRecordField lays them out
+        std::vector<std::unique_ptr<rntuple::RFieldBase> > item_fields;
+        std::size_t end = 0, alignment = 1;
+        for (auto& column : collection.columns) {
+            std::string prefix = collection.name + "_";
+            std::string item_name = column.name.rfind(prefix, 0) == 0 ? column.name.substr(prefix.size()) : column.name;
+            item_fields.push_back(create_field(item_name, column.type));
+
+            std::size_t size = get_size(column.type);
+            collection.item_offsets.push_back((end + size - 1) / size * size);
+            end = collection.item_offsets.back() + size;
+            alignment = std::max(alignment, size);
+        }
+        collection.item_size = (end + alignment - 1) / alignment * alignment;
+
+        auto record = std::make_unique<rntuple::RRecordField>("_0", std::move(item_fields));
+        if (record->GetValueSize() != collection.item_size) {
+            std::cerr << "ERROR: unexpected record size of RNTuple collection " << collection.name << std::endl;
+            exit(1);
+        }
+        model->AddField(std::make_unique<rntuple::RVectorField>(collection.name, std::move(record)));
+    }
+
+    rntuple::RNTupleWriteOptions options;
+    options.SetCompression(compression);
+    impl.writer = rntuple::RNTupleWriter::Append(std::move(model), name, *file, options);
+    impl.entry = impl.writer->CreateEntry();
+    for (auto& scalar : impl.scalars) {
+        impl.entry->BindRawPtr<void>(scalar.column.name, &scalar.value);
+    }
+    for (auto& collection : impl.collections) {
+        impl.entry->BindRawPtr<void>(collection.name, &collection.items);
+    }
+}
+
+RNTupleEventWriter::~RNTupleEventWriter() {
+    this->close();
+}
+
+void RNTupleEventWriter::fill(const void* event) {
+    auto& impl = *this->impl;
+    const char* base = static_cast<const char*>(event);
+    for (auto& scalar : impl.scalars) {
+        std::memcpy(&scalar.value, base + scalar.column.offset, get_size(scalar.column.type));
+    }
+    for (auto& collection : impl.collections) {
+        int n = *reinterpret_cast<const int*>(base + collection.counter_offset);
+        collection.items.resize(n * collection.item_size);
+        for (std::size_t i = 0; i < collection.columns.size(); ++i) {
+            auto& column = collection.columns[i];
+            std::size_t size = get_size(column.type);
+            char* item = collection.items.data() + collection.item_offsets[i];
+            for (int j = 0; j < n; ++j, item += collection.item_size) {
+                std::memcpy(item, base + column.offset + j * size, size);
+            }
+        }
+    }
+    impl.writer->Fill(*impl.entry);
+}
+
+void RNTupleEventWriter::close() {
+    if (this->impl == nullptr || this->impl->writer == nullptr) return;
+    this->impl->entry.reset();
+    this->impl->writer.reset(); // the destructor commits the dataset
+}
+
+#else
+
+struct RNTupleEventWriter::Impl { };
+
+RNTupleEventWriter::RNTupleEventWriter(TFile* file, const std::string& name, const std::vector<Column>& columns, int compression) {
+    std::cerr << "ERROR: cannot write RNTuple " << name << ": built without RNTuple; rebuild with `make calibrate RNTUPLE=1`" << std::endl;
+    exit(1);
+}
+
+RNTupleEventWriter::~RNTupleEventWriter() { }
+
+void RNTupleEventWriter::fill(const void* event) { }
+
+void RNTupleEventWriter::close() { }
+
+#endif
@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "TString.h"
+
+#include "RunRangeIndex.h"
+
+RunRangeIndex::RunRangeIndex() { }
+
+RunRangeIndex::RunRangeIndex(const Json& database, const std::string& name) : name(name) {
+    for (auto& [bar, records] : database.items()) {
+        this->add_bar(std::stoi(bar), records);
+    }
+
+    for (auto& gap : this->gaps) {
+        std::cerr << Form(
+            "WARNING: %s: NW bar%02d has no parameters for runs %04d-%04d",
+            this->name.c_str(), gap.bar, gap.first, gap.last
+        ) << std::endl;
+    }
+    for (auto& overlap : this->overlaps) {
+        std::cerr << Form(
+            "WARNING: %s: NW bar%02d has overlapping run ranges over runs %04d-%04d; the first record in the file is used",
+            this->name.c_str(), overlap.bar, overlap.first, overlap.last
+        ) << std::endl;
+    }
+}
+
+RunRangeIndex::~RunRangeIndex() { }
+
+void RunRangeIndex::add_bar(int bar, const Json& records) {
+    // run ranges in file order; PSD parameters store them as floating point numbers
+    std::vector<Interval> ranges;
+    for (auto& record : records) {
+        auto& run_range = record["run_range"];
+        ranges.push_back({int(run_range[0].get<double>()), int(run_range[1].get<double>()), &record});
+    }
+
+    // cut into elementary intervals, each assigned to the first record covering it
+    std::vector<int> bounds;
+    for (auto& range : ranges) {
+        bounds.push_back(range.first);
+        bounds.push_back(range.last + 1);
+    }
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+    auto& result = this->intervals[bar];
+    for (std::size_t i = 0; i + 1 < bounds.size(); ++i) {
+        int first = bounds[i];
+        int last = bounds[i + 1] - 1;
+        const Json* record = nullptr;
+        int n_covering = 0;
+        for (auto& range : ranges) {
+            if (range.first <= first && last <= range.last) {
+                if (record == nullptr) record = range.record;
+                ++n_covering;
+            }
+        }
+
+        if (n_covering > 1) {
+            if (!this->overlaps.empty() && this->overlaps.back().bar == bar && this->overlaps.back().last + 1 == first) {
+                this->overlaps.back().last = last;
+            }
+            else {
+                this->overlaps.push_back({bar, first, last});
+            }
+        }
+        if (record == nullptr) {
+            this->gaps.push_back({bar, first, last});
+            continue;
+        }
+        if (!result.empty() && result.back().record == record && result.back().last + 1 == first) {
+            result.back().last = last;
+        }
+        else {
+            result.push_back({first, last, record});
+        }
+    }
+}
+
+const Json* RunRangeIndex::find(int bar, int run) const {
+    auto it = this->intervals.find(bar);
+    if (it == this->intervals.end()) {
+        return nullptr;
+    }
+    auto& bar_intervals = it->second;
+
+    // last interval that starts at or before the run
+    auto next = std::upper_bound(
+        bar_intervals.begin(), bar_intervals.end(), run,
+        [](int run, const Interval& interval) { return run < interval.first; }
+    );
+    if (next == bar_intervals.begin()) {
+        return nullptr;
+    }
+    auto& interval = *(next - 1);
+    return (run <= interval.last) ? interval.record : nullptr;
+}
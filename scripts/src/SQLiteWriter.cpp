@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef WITH_SQLITE
+#include <sqlite3.h>
+#endif
+
+#include "SQLiteWriter.h"
+
+#ifdef WITH_SQLITE
+
+struct SQLiteWriter::Impl {
+    union Value {
+        sqlite3_int64 i;
+        double d;
+    };
+
+    struct TableState {
+        Table table;
+        std::ptrdiff_t counter_offset = -1; // of the arrays; negative for tables of scalars
+        std::vector<bool> is_integer; // per SQL column, "entry" and "subentry" included
+        std::vector<Value> pending; // rows not inserted yet, flattened
+        int rows_per_insert;
+        sqlite3_stmt* insert = nullptr; // for rows_per_insert rows
+    };
+
+    sqlite3* db = nullptr;
+    std::string path;
+    std::ptrdiff_t entry_offset;
+    std::vector<TableState> tables;
+
+    void check(int rc, const std::string& what) {
+        if (rc != SQLITE_OK && rc != SQLITE_DONE && rc != SQLITE_ROW) {
+            std::cerr << "ERROR: SQLite failed to " << what << " in " << this->path << ": " << sqlite3_errmsg(this->db) << std::endl;
+            exit(1);
+        }
+    }
+
+    void exec(const std::string& sql) {
+        this->check(sqlite3_exec(this->db, sql.c_str(), nullptr, nullptr, nullptr), "execute \"" + sql + "\"");
+    }
+
+    sqlite3_stmt* prepare_insert(const TableState& state, int n_rows) {
+        std::string row = "(?";
+        for (std::size_t i = 1; i < state.is_integer.size(); ++i) {
+            row += ",?";
+        }
+        row += ")";
+        std::string sql = "INSERT INTO \"" + state.table.name + "\" VALUES " + row;
+        for (int i = 1; i < n_rows; ++i) {
+            sql += "," + row;
+        }
+        sqlite3_stmt* stmt;
+        this->check(sqlite3_prepare_v2(this->db, sql.c_str(), -1, &stmt, nullptr), "prepare an insert into " + state.table.name);
+        return stmt;
+    }
+
+    void insert(TableState& state, sqlite3_stmt* stmt) {
+        std::size_t n_columns = state.is_integer.size();
+        for (std::size_t i = 0; i < state.pending.size(); ++i) {
+            if (state.is_integer[i % n_columns]) {
+                sqlite3_bind_int64(stmt, i + 1, state.pending[i].i);
+            }
+            else {
+                sqlite3_bind_double(stmt, i + 1, state.pending[i].d);
+            }
+        }
+        this->check(sqlite3_step(stmt), "insert into " + state.table.name);
+        sqlite3_reset(stmt);
+        state.pending.clear();
+    }
+
+    void append_row(TableState& state, const char* base, sqlite3_int64 entry, int subentry) {
+        state.pending.push_back({.i = entry});
+        if (subentry >= 0) {
+            state.pending.push_back({.i = subentry});
+        }
+        for (auto& column : state.table.columns) {
+            const char* ptr = base + column.offset;
+            if (column.counter_offset >= 0) {
+                ptr += subentry * get_size(column.type);
+            }
+            Value value;
+            switch (column.type) {
+                case 'D': value.d = *reinterpret_cast<const double*>(ptr); break;
+                case 'F': value.d = *reinterpret_cast<const float*>(ptr); break;
+                case 'L': value.i = *reinterpret_cast<const long long*>(ptr); break;
+                case 'I': value.i = *reinterpret_cast<const int*>(ptr); break;
+                case 'S': value.i = *reinterpret_cast<const short*>(ptr); break;
+            }
+            state.pending.push_back(value);
+        }
+        if (state.pending.size() == state.rows_per_insert * state.is_integer.size()) {
+            this->insert(state, state.insert);
+        }
+    }
+
+    static std::size_t get_size(char type) {
+        switch (type) {
+            case 'D': return sizeof(double);
+            case 'F': return sizeof(float);
+            case 'L': return sizeof(long long);
+            case 'I': return sizeof(int);
+            case 'S': return sizeof(short);
+        }
+        std::cerr << "ERROR: leaf type '" << type << "' has no SQLite counterpart" << std::endl;
+        exit(1);
+    }
+};
+
+SQLiteWriter::SQLiteWriter(const std::string& path, const std::vector<Table>& tables, std::ptrdiff_t entry_offset)
+    : impl(std::make_unique<Impl>()) {
+    auto& impl = *this->impl;
+    impl.path = path;
+    impl.entry_offset = entry_offset;
+    impl.check(sqlite3_open(path.c_str(), &impl.db), "open the database");
+    impl.exec("PRAGMA journal_mode=WAL");
+    impl.exec("PRAGMA synchronous=OFF");
+    impl.exec("BEGIN");
+
+    int max_variables = sqlite3_limit(impl.db, SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+    for (auto& table : tables) {
+        Impl::TableState state;
+        state.table = table;
+        std::string sql = "CREATE TABLE \"" + table.name + "\" (\"entry\" INTEGER";
+        state.is_integer.push_back(true);
+        for (auto& column : table.columns) {
+            if (column.counter_offset >= 0) {
+                state.counter_offset = column.counter_offset;
+            }
+        }
+        if (state.counter_offset >= 0) {
+            sql += ", \"subentry\" INTEGER";
+            state.is_integer.push_back(true);
+        }
+        for (auto& column : table.columns) {
+            Impl::get_size(column.type); // rejects unknown types
+            bool is_integer = (column.type != 'D' && column.type != 'F');
+            sql += ", \"" + column.name + "\" " + (is_integer ? "INTEGER" : "REAL");
+            state.is_integer.push_back(is_integer);
+        }
+        sql += ")";
+
+        impl.exec("DROP TABLE IF EXISTS \"" + table.name + "\"");
+        impl.exec(sql);
+        state.rows_per_insert = std::clamp(max_variables / int(state.is_integer.size()), 1, 256);
+        state.insert = impl.prepare_insert(state, state.rows_per_insert);
+        impl.tables.push_back(std::move(state));
+    }
+}
+
+SQLiteWriter::~SQLiteWriter() {
+    this->close();
+}
+
+void SQLiteWriter::fill(const void* event) {
+    auto& impl = *this->impl;
+    const char* base = static_cast<const char*>(event);
+    sqlite3_int64 entry = *reinterpret_cast<const long*>(base + impl.entry_offset);
+    for (auto& state : impl.tables) {
+        if (state.counter_offset < 0) {
+            impl.append_row(state, base, entry, -1);
+            continue;
+        }
+        int n = *reinterpret_cast<const int*>(base + state.counter_offset);
+        for (int subentry = 0; subentry < n; ++subentry) {
+            impl.append_row(state, base, entry, subentry);
+        }
+    }
+}
+
+void SQLiteWriter::close() {
+    if (this->impl == nullptr || this->impl->db == nullptr) return;
+    auto& impl = *this->impl;
+    for (auto& state : impl.tables) {
+        if (!state.pending.empty()) {
+            int n_rows = state.pending.size() / state.is_integer.size();
+            sqlite3_stmt* stmt = impl.prepare_insert(state, n_rows);
+            impl.insert(state, stmt);
+            sqlite3_finalize(stmt);
+        }
+        sqlite3_finalize(state.insert);
+    }
+    impl.exec("COMMIT");
+
+    // indexes are cheaper to build once than to maintain row by row
+    for (auto& state : impl.tables) {
+        std::string name = state.table.name;
+        if (state.counter_offset < 0) {
+            impl.exec("CREATE INDEX \"ix_" + name + "_entry\" ON \"" + name + "\" (\"entry\")");
+        }
+        else {
+            impl.exec("CREATE INDEX \"ix_" + name + "_entry_subentry\" ON \"" + name + "\" (\"entry\", \"subentry\")");
+        }
+    }
+    sqlite3_close(impl.db);
+    impl.db = nullptr;
+}
+
+#else
+
+struct SQLiteWriter::Impl { };
+
+SQLiteWriter::SQLiteWriter(const std::string& path, const std::vector<Table>& tables, std::ptrdiff_t entry_offset) {
+    std::cerr << "ERROR: cannot write " << path << ": built without SQLite; rebuild with `make calibrate SQLITE=1`" << std::endl;
+    exit(1);
+}
+
+SQLiteWriter::~SQLiteWriter() { }
+
+void SQLiteWriter::fill(const void* event) { }
+
+void SQLiteWriter::close() { }
+
+#endif
@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "TBranch.h"
+#include "TClass.h"
+#include "TFile.h"
+#include "TKey.h"
+#include "TLeaf.h"
+#include "TString.h"
+#include "TTree.h"
+
+#include "TreeIntrospection.h"
+
+const std::map<std::string, char> TreeIntrospection::type_char_map = {
+    {"Char_t",     'B'},
+    {"UChar_t",    'b'},
+    {"Short_t",    'S'},
+    {"UShort_t",   's'},
+    {"Int_t",      'I'},
+    {"UInt_t",     'i'},
+    {"Float_t",    'F'},
+    {"Float16_t",  'f'},
+    {"Double_t",   'D'},
+    {"Double32_t", 'd'},
+    {"Long64_t",   'L'},
+    {"ULong64_t",  'l'},
+    {"Long_t",     'G'},
+    {"ULong_t",    'g'},
+    {"Bool_t",     'O'}
+};
+
+TreeIntrospection::TreeIntrospection(const std::string& path, const std::string& tree_name) : path(path) {
+    this->file.reset(TFile::Open(path.c_str(), "READ"));
+    if (this->file == nullptr || this->file->IsZombie()) {
+        throw std::runtime_error("Cannot open \"" + path + "\".");
+    }
+
+    this->tree_name = tree_name;
+    if (this->tree_name.empty()) {
+        auto tree_names = find_tree_names(this->file.get());
+        if (tree_names.size() != 1) {
+            throw std::runtime_error(Form("Found %lu trees in \"%s\".", tree_names.size(), path.c_str()));
+        }
+        this->tree_name = tree_names[0];
+    }
+    this->tree = this->file->Get<TTree>(this->tree_name.c_str());
+    if (this->tree == nullptr) {
+        throw std::runtime_error("Tree \"" + this->tree_name + "\" not found in \"" + path + "\".");
+    }
+
+    // names first, since the size of an array may be a branch that comes after it
+    auto branches = this->tree->GetListOfBranches();
+    for (int i = 0; i < branches->GetEntries(); ++i) {
+        this->collect_branch_names(static_cast<TBranch*>(branches->At(i)));
+    }
+    this->name_set.insert(this->branch_names.begin(), this->branch_names.end());
+    for (auto& name : this->branch_names) {
+        this->leaflists.push_back(this->get_leaflist(this->tree->GetBranch(name.c_str())));
+    }
+}
+
+TreeIntrospection::~TreeIntrospection() {
+    if (this->file != nullptr) {
+        this->file->Close();
+    }
+}
+
+std::vector<std::string> TreeIntrospection::find_tree_names(TFile* file) {
+    /* Keys of older cycles share the name of the newest one; each name is listed once */
+    std::vector<std::string> tree_names;
+    for (auto&& obj : *file->GetListOfKeys()) {
+        auto key = static_cast<TKey*>(obj);
+        TClass* cls = TClass::GetClass(key->GetClassName());
+        if (cls == nullptr || !cls->InheritsFrom(TTree::Class())) continue;
+        if (std::find(tree_names.begin(), tree_names.end(), key->GetName()) != tree_names.end()) continue;
+        tree_names.push_back(key->GetName());
+    }
+    return tree_names;
+}
+
+void TreeIntrospection::collect_branch_names(TBranch* branch) {
+    auto sub_branches = branch->GetListOfBranches();
+    if (sub_branches->GetEntries() == 0) {
+        this->branch_names.push_back(branch->GetName());
+        return;
+    }
+    for (int i = 0; i < sub_branches->GetEntries(); ++i) {
+        this->collect_branch_names(static_cast<TBranch*>(sub_branches->At(i)));
+    }
+}
+
+std::string TreeIntrospection::get_leaflist(TBranch* branch) const {
+    /* Only supports scalars and 1D arrays */
+    std::string title = branch->GetTitle();
+    std::string branch_name = branch->GetName();
+    std::string type_name = branch->FindLeaf(branch->GetName())->GetTypeName();
+
+    char type_char = 'C'; // default
+    auto type = type_char_map.find(type_name);
+    if (type != type_char_map.end()) {
+        type_char = type->second;
+    }
+
+    // check branch is array or scalar
+    auto left_brac_pos = title.find('[');
+    auto right_brac_pos = title.find(']');
+    if (left_brac_pos == std::string::npos || right_brac_pos == std::string::npos) {
+        return Form("%s/%c", branch_name.c_str(), type_char);
+    }
+    std::string size_str = title.substr(left_brac_pos + 1, right_brac_pos - left_brac_pos - 1);
+
+    // array with fixed size, or with the size in another branch
+    bool is_integer = std::all_of(size_str.begin(), size_str.end(), [](char c) { return std::isdigit(c); });
+    if (is_integer || this->has_branch(size_str)) {
+        return Form("%s[%s]/%c", branch_name.c_str(), size_str.c_str(), type_char);
+    }
+
+    // branch name incomplete, attempts to add prefix
+    std::string prefix = branch_name.substr(0, branch_name.find('.'));
+    size_str = prefix + "." + size_str;
+    if (this->has_branch(size_str)) {
+        return Form("%s[%s]/%c", branch_name.c_str(), size_str.c_str(), type_char);
+    }
+    throw std::runtime_error("Cannot determine size variable for branch \"" + title + "\" in \"" + this->path + "\".");
+}
+
+std::string extract_branch_name(const std::string& leaflist) {
+    std::string str = leaflist.substr(0, leaflist.find('/'));
+    return str.substr(0, str.find('['));
+}
+
+char extract_branch_type(const std::string& leaflist) {
+    std::string type = leaflist.substr(leaflist.find('/') + 1);
+    if (type.size() != 1) {
+        throw std::runtime_error("leaflist has more than one character");
+    }
+    return type[0];
+}
+
+bool is_array(const std::string& leaflist) {
+    return (leaflist.find('[') != std::string::npos);
+}
@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "Math/Interpolator.h"
+#include "TString.h"
+
+#include "UniformGridTable.h"
+
+UniformGridTable::UniformGridTable() { }
+
+UniformGridTable::UniformGridTable(
+    const ROOT::Math::Interpolator& reference, const std::vector<double>& knots,
+    double tolerance, int max_n_cells
+) : x_min(knots.front()), x_max(knots.back()) {
+    // first grid on the knots, exact if they are evenly spaced
+    this->bake(reference, knots.size() - 1);
+    this->max_error = this->measure_error(reference, knots);
+    while (this->max_error > tolerance && 2 * this->n_cells <= max_n_cells) {
+        this->bake(reference, 2 * this->n_cells);
+        this->max_error = this->measure_error(reference, knots);
+    }
+    if (this->max_error > tolerance) {
+        std::cerr << Form(
+            "WARNING: lookup table on [%g, %g] with %d cells deviates by %g (tolerance %g)",
+            this->x_min, this->x_max, this->n_cells, this->max_error, tolerance
+        ) << std::endl;
+    }
+}
+
+UniformGridTable::~UniformGridTable() { }
+
+void UniformGridTable::bake(const ROOT::Math::Interpolator& reference, int n_cells) {
+    this->n_cells = n_cells;
+    double h = (this->x_max - this->x_min) / n_cells;
+    this->inv_h = 1.0 / h;
+
+    auto node = [&](int i) { return (i == n_cells) ? this->x_max : this->x_min + i * h; };
+    std::vector<double> y(n_cells + 1), dydx(n_cells + 1);
+    for (int i = 0; i <= n_cells; ++i) {
+        y[i] = reference.Eval(node(i));
+        dydx[i] = reference.Deriv(node(i));
+    }
+
+    this->coeffs.resize(n_cells);
+    for (int i = 0; i < n_cells; ++i) {
+        double m0 = dydx[i] * h;
+        double m1 = dydx[i + 1] * h;
+        this->coeffs[i] = {
+            y[i],
+            m0,
+            3 * (y[i + 1] - y[i]) - 2 * m0 - m1,
+            2 * (y[i] - y[i + 1]) + m0 + m1,
+        };
+    }
+}
+
+double UniformGridTable::measure_error(const ROOT::Math::Interpolator& reference, const std::vector<double>& knots) const {
+    /* Between consecutive points of the grid nodes and the knots merged,
+     * both curves are single cubics, and so is their difference d. Since
+     * both are C1, d on such a piece is the Hermite cubic of its values and
+     * slopes at the ends, and its largest magnitude is found at an end or at
+     * a root of d' inside.
+     */
+    double h = (this->x_max - this->x_min) / this->n_cells;
+    std::vector<double> points = knots;
+    for (int i = 0; i <= this->n_cells; ++i) {
+        points.push_back((i == this->n_cells) ? this->x_max : this->x_min + i * h);
+    }
+    std::sort(points.begin(), points.end());
+
+    double error = 0.0;
+    for (std::size_t k = 0; k + 1 < points.size(); ++k) {
+        double a = points[k], b = points[k + 1];
+        if (!(b > a)) continue;
+
+        // both ends on the cell of the piece, whichever cell they would round to
+        int i = std::min(int((0.5 * (a + b) - this->x_min) * this->inv_h), this->n_cells - 1);
+        const auto& c = this->coeffs[i];
+        auto table_value = [&](double x) {
+            double t = (x - this->x_min) * this->inv_h - i;
+            return c[0] + t * (c[1] + t * (c[2] + t * c[3]));
+        };
+        auto table_deriv = [&](double x) {
+            double t = (x - this->x_min) * this->inv_h - i;
+            return (c[1] + t * (2 * c[2] + t * 3 * c[3])) * this->inv_h;
+        };
+
+        double d0 = table_value(a) - reference.Eval(a);
+        double d1 = table_value(b) - reference.Eval(b);
+        double m0 = (table_deriv(a) - reference.Deriv(a)) * (b - a);
+        double m1 = (table_deriv(b) - reference.Deriv(b)) * (b - a);
+        double c2 = 3 * (d1 - d0) - 2 * m0 - m1;
+        double c3 = 2 * (d0 - d1) + m0 + m1;
+        error = std::max({error, std::abs(d0), std::abs(d1)});
+
+        // d'(t) = m0 + 2 c2 t + 3 c3 t^2, solved without cancellation
+        double qa = 3 * c3, qb = 2 * c2, qc = m0;
+        double discriminant = qb * qb - 4 * qa * qc;
+        if (discriminant < 0) continue;
+        double q = -0.5 * (qb + std::copysign(std::sqrt(discriminant), qb));
+        for (double t : {(qa != 0) ? q / qa : -1.0, (q != 0) ? qc / q : -1.0}) {
+            if (t > 0 && t < 1) {
+                error = std::max(error, std::abs(d0 + t * (m0 + t * (c2 + t * c3))));
+            }
+        }
+    }
+    return error;
+}
@@ -0,0 +1,52 @@
+import pytest
+
+import numpy as np
+import pandas as pd
+
+from e15190.neutron_wall import dither
+
+# values of scripts/include/CounterRNG.h for seed 4242 and run 4083
+@pytest.fixture
+def positions():
+    return pd.DataFrame([
+        (0, 0, 0.597652614, 1.20237947),
+        (0, 1, -1.97492099, 2.86872101),
+        (0, 2, 2.0468843, 0.12261273),
+        (1, 0, 1.03288078, -2.42167711),
+        (1, 1, 0.877358377, -1.97864568),
+        (1, 2, 1.52600396, -0.83880657),
+        (123456, 0, -3.16334987, -1.18712687),
+        (123456, 1, 2.95764136, 1.86695683),
+        (123456, 2, -1.33654642, 0.681964397),
+        (5000000000, 0, -1.61533546, -2.37170744),
+        (5000000000, 1, -1.45026231, -1.63133025),
+        (5000000000, 2, -0.514014363, -1.06043887),
+    ], columns=['entry', 'subentry', 'NWB_pos_y', 'NWB_pos_z'])
+
+def test_uniform():
+    # a seed wider than 32 bits, to cover both words of the key
+    result = dither.uniform(0x123456789ABC, 2222, 99, [0, 1, 2], dither.TOTAL_R)
+    expected = [0.72667028700155645, 0.72799147293738231, 0.97397816723445363]
+    assert np.array_equal(result, expected)
+
+def test_positions(positions):
+    entry, hit = positions['entry'], positions['subentry']
+    assert np.array_equal(dither.pos_y(4242, 4083, entry, hit), positions['NWB_pos_y'].astype(np.float32))
+    assert np.array_equal(dither.pos_z(4242, 4083, entry, hit), positions['NWB_pos_z'].astype(np.float32))
+
+def test_dither():
+    raw = np.array([-9999, 0, 1, 2047, 4095, 4096], dtype=np.int16)
+    result = dither.dither(raw, 4242, 4083, 7, np.arange(6), dither.FAST_L)
+    expected = np.array([-9999, 0.174086168, 0.858983696, 2047.34851, 4095.37891, 4096], dtype=np.float32)
+    assert result.dtype == np.float32
+    assert np.array_equal(result, expected)
+
+def test_add_columns(positions):
+    df = positions[['entry', 'subentry']].set_index(['entry', 'subentry'])
+    df['NWB_fast_L'] = np.int16(100)
+    result = dither.add_columns(df, 4242, 4083)
+    assert np.array_equal(result['NWB_pos_y'], positions['NWB_pos_y'].astype(np.float32))
+    assert np.array_equal(result['NWB_pos_z'], positions['NWB_pos_z'].astype(np.float32))
+    assert np.all(np.abs(result['NWB_fastf_L'] - 100) <= 0.5)
+    assert 'NWB_fastf_R' not in result.columns
+    assert 'NWB_pos_y' not in df.columns
@@ -0,0 +1,18 @@
+import pytest
+
+import re
+
+from e15190 import PROJECT_DIR
+from e15190.neutron_wall.hit_status import HitStatus, none_of
+
+def test_bits_match_calibrate():
+    header = (PROJECT_DIR / 'scripts/include/NWHitBlock.h').read_text()
+    bits = { # e.g. kInvalidADC -> INVALID_ADC
+        re.sub(r'(?<=[a-z])(?=[A-Z])', '_', name).upper(): 1 << int(shift)
+        for name, shift in re.findall(r'k(\w+) = 1 << (\d+)', header)
+    }
+    assert bits == {flag.name: int(flag) for flag in HitStatus}
+
+def test_none_of():
+    assert none_of(HitStatus.INVALID_ADC) == '(NWB_status & 1) == 0'
+    assert none_of(HitStatus.PSD_OVERFLOW, HitStatus.PSD_INVALID, column='status') == '(status & 24) == 0'
@@ -0,0 +1,71 @@
+import pytest
+
+import json
+import os
+
+from e15190.utilities.root_catalog import RootCatalog, find_n_entries, find_tree_name
+
+@pytest.fixture
+def catalog(tmp_path):
+    root_path = tmp_path / 'CalibratedData_4083.root'
+    root_path.write_bytes(b'\0' * 100)
+    index = {
+        'hash': 'fnv1a64-words',
+        'files': {
+            str(root_path): {
+                'size': 100,
+                'mtime': root_path.stat().st_mtime_ns,
+                'hash': '0123456789abcdef',
+                'tree': 'E15190',
+                'entries': 2500,
+                'clusters': [0, 1000, 2000, 2500],
+                'branches': {'NWB.fmulti': [300, 1000], 'NWB.fLeft': [4000, 9000]},
+            },
+        },
+    }
+    index_path = tmp_path / 'catalog.json'
+    index_path.write_text(json.dumps(index))
+    return RootCatalog(index_path), root_path
+
+def test_get(catalog):
+    catalog, root_path = catalog
+    assert catalog.get_tree_name(root_path) == 'E15190'
+    assert catalog.get_n_entries(str(root_path)) == 2500
+    assert catalog.get_clusters(root_path) == [(0, 1000), (1000, 2000), (2000, 2500)]
+    assert catalog.get_branch_bytes(root_path) == {'NWB.fmulti': 300, 'NWB.fLeft': 4000}
+    assert catalog.get_branch_bytes(root_path, compressed=False)['NWB.fLeft'] == 9000
+
+def test_changed_file(catalog):
+    catalog, root_path = catalog
+    assert root_path in catalog
+    root_path.write_bytes(b'\0' * 200)
+    assert root_path not in catalog
+    with pytest.raises(KeyError):
+        catalog.get_n_entries(root_path)
+
+def test_missing_file(catalog, tmp_path):
+    catalog, _ = catalog
+    assert tmp_path / 'run-4084.root' not in catalog
+
+def test_rewritten_file_of_same_size(catalog):
+    catalog, root_path = catalog
+    mtime_ns = root_path.stat().st_mtime_ns
+    root_path.write_bytes(b'\1' * 100)
+    os.utime(root_path, ns=(mtime_ns + 10**9, mtime_ns + 10**9))
+    assert root_path not in catalog
+    with pytest.raises(KeyError):
+        catalog.get_tree_name(root_path)
+
+def test_find_in_default_catalog(catalog, tmp_path, monkeypatch):
+    _, root_path = catalog
+    monkeypatch.setattr(RootCatalog, 'DEFAULT_PATH', tmp_path / 'catalog.json')
+    assert find_tree_name(root_path) == 'E15190'
+    assert find_n_entries(root_path) == 2500
+    assert find_n_entries(root_path, 'E15190') == 2500
+    assert find_n_entries(root_path, 'tree') is None
+    assert find_tree_name(tmp_path / 'run-4084.root') is None
+
+def test_no_default_catalog(tmp_path, monkeypatch):
+    monkeypatch.setattr(RootCatalog, 'DEFAULT_PATH', tmp_path / 'missing.json')
+    assert find_tree_name(tmp_path / 'run-4083.root') is None
+    assert find_n_entries(tmp_path / 'run-4083.root') is None